@@ -0,0 +1,134 @@
+#include "arena.h"
+
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNKSZ 16384
+#define ALIGN (sizeof (max_align_t))
+
+C_CLASS_DECL(Chunk);
+
+struct Chunk
+{
+    Chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+struct Arena
+{
+    Chunk *first;
+    Chunk *cur;
+};
+
+static Chunk *Chunk_create(size_t size)
+{
+    if (size < CHUNKSZ) size = CHUNKSZ;
+    Chunk *self = xmalloc(sizeof *self + size);
+    self->next = 0;
+    self->size = size;
+    self->used = 0;
+    return self;
+}
+
+static void *allocaligned(Arena *self, size_t size, size_t align)
+{
+    Chunk *c = self->cur;
+    for (;;)
+    {
+	size_t pos = (c->used + align - 1) & ~(align - 1);
+	if (pos + size <= c->size)
+	{
+	    c->used = pos + size;
+	    self->cur = c;
+	    return (char *)c->data + pos;
+	}
+	if (!c->next) break;
+	c = c->next;
+    }
+    c->next = Chunk_create(size);
+    c = c->next;
+    c->used = size;
+    self->cur = c;
+    return c->data;
+}
+
+Arena *Arena_create(void)
+{
+    Arena *self = xmalloc(sizeof *self);
+    self->first = self->cur = Chunk_create(0);
+    return self;
+}
+
+void *Arena_alloc(Arena *self, size_t size)
+{
+    return allocaligned(self, size, ALIGN);
+}
+
+void *Arena_realloc(Arena *self, void *ptr, size_t oldsize, size_t size)
+{
+    if (!ptr) return Arena_alloc(self, size);
+    Chunk *c = self->cur;
+    char *base = (char *)c->data;
+    if ((char *)ptr + oldsize == base + c->used
+	    && (size_t)((char *)ptr - base) + size <= c->size)
+    {
+	c->used = (size_t)((char *)ptr - base) + size;
+	return ptr;
+    }
+    if (size <= oldsize) return ptr;
+    void *m = Arena_alloc(self, size);
+    memcpy(m, ptr, oldsize);
+    return m;
+}
+
+char *Arena_strndup(Arena *self, const char *str, size_t len)
+{
+    char *res = allocaligned(self, len + 1, 1);
+    memcpy(res, str, len);
+    res[len] = 0;
+    return res;
+}
+
+void *Arena_growvec(Arena *self, void *vec, size_t *capa, size_t esz)
+{
+    size_t newcapa = *capa ? 2 * *capa : 4;
+    vec = Arena_realloc(self, vec, *capa * esz, newcapa * esz);
+    *capa = newcapa;
+    return vec;
+}
+
+ArenaMark Arena_mark(const Arena *self)
+{
+    ArenaMark mark = { self->cur, self->cur->used };
+    return mark;
+}
+
+void Arena_rollback(Arena *self, ArenaMark mark)
+{
+    Chunk *c = mark.chunk;
+    c->used = mark.used;
+    self->cur = c;
+    for (c = c->next; c; c = c->next) c->used = 0;
+}
+
+void Arena_reset(Arena *self)
+{
+    for (Chunk *c = self->first; c; c = c->next) c->used = 0;
+    self->cur = self->first;
+}
+
+void Arena_destroy(Arena *self)
+{
+    if (!self) return;
+    Chunk *next;
+    for (Chunk *c = self->first; c; c = next)
+    {
+	next = c->next;
+	free(c);
+    }
+    free(self);
+}
@@ -0,0 +1,39 @@
+#ifndef MKCLIDOC_ARENA_H
+#define MKCLIDOC_ARENA_H
+
+#include "decl.h"
+
+#include <stddef.h>
+
+C_CLASS_DECL(Arena);
+
+typedef struct ArenaMark
+{
+    void *chunk;
+    size_t used;
+} ArenaMark;
+
+Arena *Arena_create(void) ATTR_RETNONNULL;
+void *Arena_alloc(Arena *self, size_t size)
+    CMETHOD ATTR_MALLOC ATTR_ALLOCSZ((2)) ATTR_RETNONNULL;
+void *Arena_realloc(Arena *self, void *ptr, size_t oldsize, size_t size)
+    CMETHOD ATTR_ALLOCSZ((4)) ATTR_RETNONNULL;
+char *Arena_strndup(Arena *self, const char *str, size_t len)
+    CMETHOD ATTR_MALLOC ATTR_RETNONNULL;
+void *Arena_growvec(Arena *self, void *vec, size_t *capa, size_t esz)
+    CMETHOD ATTR_NONNULL((3)) ATTR_RETNONNULL;
+ArenaMark Arena_mark(const Arena *self) CMETHOD ATTR_PURE;
+void Arena_rollback(Arena *self, ArenaMark mark) CMETHOD;
+void Arena_reset(Arena *self) CMETHOD;
+void Arena_destroy(Arena *self);
+
+#define ArenaVec(T) struct { T *v; size_t n; size_t capa; }
+#define ArenaVec_push(a, vec) (((vec).n == (vec).capa \
+	? (void)((vec).v = Arena_growvec((a), (vec).v, &(vec).capa, \
+		sizeof *(vec).v)) : (void)0), (vec).v + (vec).n++)
+#define ArenaVec_shrink(a, vec) do { \
+    if ((vec).v) (vec).v = Arena_realloc((a), (vec).v, \
+	    (vec).capa * sizeof *(vec).v, (vec).n * sizeof *(vec).v); \
+    (vec).capa = (vec).n; } while (0)
+
+#endif
@@ -0,0 +1,15 @@
+#include "binwriter.h"
+
+#include "clidoc.h"
+#include "util.h"
+
+SOEXPORT int writeBin(Sink *out, const CliDoc *root, const char *args)
+{
+    if (args)
+    {
+	fputs("The bin format does not support any arguments.\n", diagout());
+	return -1;
+    }
+    CliDoc_writeImage(root, out);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef MKCLIDOC_BINWRITER_H
+#define MKCLIDOC_BINWRITER_H
+
+#include "decl.h"
+
+C_CLASS_DECL(CliDoc);
+C_CLASS_DECL(Sink);
+
+DECLEXPORT int writeBin(Sink *out, const CliDoc *root, const char *args)
+    ATTR_NONNULL((1)) ATTR_NONNULL((2));
+
+#endif
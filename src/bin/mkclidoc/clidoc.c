@@ -1,10 +1,14 @@
 #include "clidoc.h"
 
+#include "arena.h"
+#include "docarena.h"
+#include "sink.h"
 #include "util.h"
 
 #include <assert.h>
-#include <errno.h>
-#include <limits.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,17 +43,18 @@ struct CDRoot
     CliDoc *date;
     CliDoc *www;
     CDList *mrefs;
-    CDFlag **flags;
-    CDArg **args;
-    CDNamed **files;
-    CDNamed **vars;
-    CDNamed **sigs;
-    size_t nflags;
-    size_t nargs;
-    size_t nfiles;
-    size_t nvars;
-    size_t nsigs;
+    ArenaVec(CDFlag *) flags;
+    ArenaVec(CDArg *) args;
+    ArenaVec(CDNamed *) files;
+    ArenaVec(CDNamed *) vars;
+    ArenaVec(CDNamed *) sigs;
+    ArenaVec(CDSynItem) synitems;
+    ArenaVec(size_t) syngroups;
+    CDStr synflags;
+    Arena *arena;
+    char *input;
     int defgroup;
+    int ownarena;
 };
 
 struct CDArg
@@ -59,7 +64,7 @@ struct CDArg
     CliDoc *def;
     CliDoc *min;
     CliDoc *max;
-    char *arg;
+    CDStr arg;
     int group;
     int optional;
 };
@@ -70,21 +75,25 @@ struct CDFlag
     char flag;
 };
 
+typedef ArenaVec(CDSpan) CDSpans;
+
 struct CDList
 {
     CliDoc base;
-    size_t n;
-    CliDoc **c;
+    ArenaVec(CliDoc *) c;
 };
 
+typedef struct CDDictEntry
+{
+    CDStr key;
+    CDSpans keyspans;
+    CliDoc *val;
+} CDDictEntry;
+
 struct CDDict
 {
     CliDoc base;
-    size_t n;
-    struct {
-	char *key;
-	CliDoc *val;
-    } *v;
+    ArenaVec(CDDictEntry) v;
 };
 
 struct CDTable
@@ -92,20 +101,23 @@ struct CDTable
     CliDoc base;
     size_t width;
     size_t height;
-    char **cells;
+    ArenaVec(CDStr) cells;
+    ArenaVec(size_t) spanidx;
+    CDSpans spans;
 };
 
 struct CDNamed
 {
     CliDoc base;
     CliDoc *description;
-    char *name;
+    CDStr name;
 };
 
 struct CDText
 {
     CliDoc base;
-    char *text;
+    CDStr text;
+    CDSpans spans;
 };
 
 struct CDDate
@@ -117,917 +129,1499 @@ struct CDDate
 struct CDMRef
 {
     CliDoc base;
-    char *name;
-    const char *section;
+    CDStr name;
+    CDStr section;
+};
+
+typedef enum FieldKind
+{
+    FK_NONE,
+    FK_VAL,
+    FK_INT,
+    FK_DATE,
+    FK_REFS
+} FieldKind;
+
+typedef struct Field
+{
+    size_t offset;
+    FieldKind kind;
+    int unique;
+} Field;
+
+typedef struct Builder
+{
+    Arena *arena;
+    CDRoot *root;
+    CliDoc *node;
+    const Field *fields;
+    const Field *field;
+    CDDict *dict;
+    CDTable *table;
+    CDStr text;
+    size_t nchunks;
+    char *txt;
+    size_t txtlen;
+    size_t txtcapa;
+    CDSpan *spans;
+    size_t nspans;
+    size_t spanscapa;
+} Builder;
+
+#define NKEYS (CK_OPTIONAL + 1)
+#define FIELD(t, f, k, u) { offsetof(t, f), k, u }
+
+static const Field rootfields[NKEYS] = {
+    [CK_NAME] = FIELD(CDRoot, name, FK_VAL, 1),
+    [CK_VERSION] = FIELD(CDRoot, version, FK_VAL, 1),
+    [CK_COMMENT] = FIELD(CDRoot, comment, FK_VAL, 1),
+    [CK_AUTHOR] = FIELD(CDRoot, author, FK_VAL, 1),
+    [CK_LICENSE] = FIELD(CDRoot, license, FK_VAL, 1),
+    [CK_DESCRIPTION] = FIELD(CDRoot, description, FK_VAL, 1),
+    [CK_DATE] = FIELD(CDRoot, date, FK_DATE, 1),
+    [CK_WWW] = FIELD(CDRoot, www, FK_VAL, 1),
+    [CK_MANREFS] = FIELD(CDRoot, mrefs, FK_REFS, 0),
+    [CK_DEFGROUP] = FIELD(CDRoot, defgroup, FK_INT, 0)
+};
+
+static const Field argfields[NKEYS] = {
+    [CK_DESCRIPTION] = FIELD(CDArg, description, FK_VAL, 1),
+    [CK_DEFAULT] = FIELD(CDArg, def, FK_VAL, 1),
+    [CK_MIN] = FIELD(CDArg, min, FK_VAL, 1),
+    [CK_MAX] = FIELD(CDArg, max, FK_VAL, 1),
+    [CK_GROUP] = FIELD(CDArg, group, FK_INT, 0),
+    [CK_OPTIONAL] = FIELD(CDArg, optional, FK_INT, 0)
 };
 
-typedef struct Parser
-{
-    FILE *doc;
-    char *line;
-    unsigned long lineno;
-    char buf[1024];
-} Parser;
-
-static void setoradd(CliDoc **val, CliDoc *item);
-static int parsetable(Parser *p, CliDoc **val, CliDoc *parent);
-static int parsedict(Parser *p, CliDoc **val, CliDoc *parent);
-static int parseval(Parser *p, CliDoc **val, CliDoc *parent);
-static int parsemref(Parser *p, CDList **val, CliDoc *parent);
-static int parsemrefs(Parser *p, CDList **val, CliDoc *parent);
-static int parseint(Parser *p, int *intval);
-static int parseargvals(Parser *p, CDArg *arg);
-static int parsenamedvals(Parser *p, CDNamed *named);
-static int parseflag(Parser *p, CDRoot *root);
-static int parsearg(Parser *p, CDRoot *root);
-static int parsefile(Parser *p, CDRoot *root);
-static int parsevar(Parser *p, CDRoot *root);
-static int parse(CDRoot *root, FILE *doc);
-
-#define isws(c) (c == ' ' || c == '\t')
-#define skipws(p) while(isws(*(p))) ++(p)
-#define skipwsb(p) while(isws(*(p-1))) --(p)
-#define err(s) do { \
-    fprintf(stderr, "parse error in line %lu: %s\n", p->lineno, (s)); \
-    goto error; } while (0)
-#define nextline (p->line = ((++p->lineno), \
-	    fgets(p->buf, sizeof p->buf, p->doc)))
-#define isdict(t) (*p->line == '-' && p->line[1] == ' ' && p->line[2] == '[' \
-	&& ((t)=strchr(p->line, ']')) && (t)[1] == ':')
-#define istable(t) (*p->line == '|' && ((t)=strchr(p->line+1, '|')) \
-	&& strchr((t)+1, '|'))
-
-static void setoradd(CliDoc **val, CliDoc *item)
+static const Field namedfields[NKEYS] = {
+    [CK_DESCRIPTION] = FIELD(CDNamed, description, FK_VAL, 1)
+};
+
+#define ismpunct(c) (ispunct((unsigned char)(c)) && (c) != '\\' \
+	&& (c) != '%' && (c) != '`' && (c) != '<' && (c) != '>')
+#define isspanws(c) ((c) == ' ' || (c) == '\t')
+#define istpunct(s, e) (ismpunct(*(s)) && \
+	((s)+1 == (e) || isspanws((s)[1])))
+#define isrest(s, e, r) ((size_t)((e) - (s)) == sizeof (r) - 1 \
+	&& !memcmp((s), (r), sizeof (r) - 1))
+#define isword(s, l, r) ((l) == sizeof (r) - 1 \
+	&& !memcmp((s), (r), sizeof (r) - 1))
+
+#define fieldptr(b) ((void *)((char *)(b)->node + (b)->field->offset))
+#define buildparent(b) ((b)->dict ? (CliDoc *)(b)->dict : (b)->node)
+
+static void setoradd(Arena *arena, CliDoc **val, CliDoc *item)
 {
     if (!*val) *val = item;
     else if ((*val)->type == CT_LIST)
     {
 	item->parent = *val;
 	CDList *list = (CDList *)*val;
-	list->c = xrealloc(list->c, (list->n+1) * sizeof *list->c);
-	list->c[list->n++] = item;
+	*ArenaVec_push(arena, list->c) = item;
     }
     else
     {
-	CDList *list = xmalloc(sizeof *list);
+	CDList *list = Arena_alloc(arena, sizeof *list);
+	memset(list, 0, sizeof *list);
 	list->base.parent = item->parent;
 	list->base.type = CT_LIST;
-	list->n = 2;
-	list->c = xmalloc(2 * sizeof *list->c);
 	(*val)->parent = (CliDoc *)list;
 	item->parent = (CliDoc *)list;
-	list->c[0] = *val;
-	list->c[1] = item;
+	*ArenaVec_push(arena, list->c) = *val;
+	*ArenaVec_push(arena, list->c) = item;
 	*val = (CliDoc *)list;
     }
 }
 
-static int parsetable(Parser *p, CliDoc **val, CliDoc *parent)
+static void setvalue(Builder *b, CliDoc *item)
+{
+    if (b->dict) b->dict->v.v[b->dict->v.n - 1].val = item;
+    else setoradd(b->arena, fieldptr(b), item);
+}
+
+/* growing by doubling keeps assembling a text linear in its length */
+static void txtappend(Builder *b, const char *s, size_t len)
+{
+    if (b->txtlen + len + 1 > b->txtcapa)
+    {
+	size_t capa = b->txtcapa ? b->txtcapa : 256;
+	while (b->txtlen + len + 1 > capa) capa *= 2;
+	b->txt = Arena_realloc(b->arena, b->txt, b->txtcapa, capa);
+	b->txtcapa = capa;
+    }
+    if (b->txtlen) b->txt[b->txtlen++] = ' ';
+    memcpy(b->txt + b->txtlen, s, len);
+    b->txtlen += len;
+}
+
+static int isenvname(const char *str, size_t len)
 {
-    CDTable *table = xmalloc(sizeof *table);
-    memset(table, 0, sizeof *table);
-    table->base.parent = parent;
-    table->base.type = CT_TABLE;
+    int haveupper = 0;
+    for (const char *end = str + len; str < end; ++str)
+    {
+	if (isupper((unsigned char)*str))
+	{
+	    ++haveupper;
+	    continue;
+	}
+	if (haveupper && isdigit((unsigned char)*str)) continue;
+	if (*str != '_') return 0;
+    }
+    return haveupper > 1;
+}
 
-    int width = -1;
-    char *tmp = 0;
-    while (istable(tmp))
+static CDSpanType spantype(const char *word, size_t len)
+{
+    if (isword(word, len, "%%name%%")) return SP_NAME;
+    if (isword(word, len, "%%arg%%")) return SP_ARG;
+    if (isword(word, len, "%%var%%")) return SP_VAR;
+    if (len > 2 && word[0] == '`' && word[len-1] == '`')
     {
-	++p->line;
-	tmp = strchr(p->line, '\n');
-	if (!tmp) err("Expected end of line");
-	if (width > 0)
+	const char *in = word + 1;
+	size_t inlen = len - 2;
+	if (inlen == 2 && in[0] == '-' && in[1] != '\\') return SP_FLAG;
+	if (in[0] == '/' || (inlen > 1 && in[0] == '~' && in[1] == '/')
+		|| (inlen > 1 && in[0] == '.' && (in[1] == '/'
+			|| (inlen > 2 && in[1] == '.' && in[2] == '/'))))
 	{
-	    table->cells = xrealloc(table->cells,
-		    (table->height + 1) * table->width * sizeof *table->cells);
+	    return SP_PATH;
 	}
-	for (int x = 0; width < 0 || x < width; ++x)
+	if (isenvname(in, inlen)) return SP_ENV;
+	return SP_LITERAL;
+    }
+    if (len > 1 && word[0] == '<' && word[len-1] == '>')
+    {
+	for (size_t i = 1; i + 3 < len; ++i)
 	{
-	    skipws(p->line);
-	    tmp = strchr(p->line, '|');
-	    if (!tmp)
+	    if (!memcmp(word + i, "://", 3)) return SP_LINK;
+	}
+	if (memchr(word + 1, '@', len - 2)) return SP_MAIL;
+    }
+    return SP_WORD;
+}
+
+static CDSpan *pushspan(Builder *b)
+{
+    if (b->nspans == b->spanscapa)
+    {
+	b->spans = Arena_growvec(b->arena, b->spans,
+		&b->spanscapa, sizeof *b->spans);
+    }
+    return b->spans + b->nspans++;
+}
+
+static void keepspans(Builder *b, CDSpans *spans)
+{
+    spans->n = spans->capa = b->nspans;
+    spans->v = 0;
+    if (b->nspans)
+    {
+	spans->v = Arena_alloc(b->arena, b->nspans * sizeof *b->spans);
+	memcpy(spans->v, b->spans, b->nspans * sizeof *b->spans);
+    }
+    b->nspans = 0;
+}
+
+static int scanspans(Builder *b, const char *str, size_t len)
+{
+    if (len > UINT32_MAX) return -1;
+    const char *end = str + len;
+    const char *s = str;
+    while (s < end)
+    {
+	int flags = 0;
+	while (s < end && isspanws(*s))
+	{
+	    ++s;
+	    flags = SF_SPACE;
+	}
+	if (s == end) break;
+
+	CDSpan *span = pushspan(b);
+	span->off = s - str;
+	span->ref = 0;
+	if (ismpunct(*s))
+	{
+	    const char *e = s + 1;
+	    while (e < end && ismpunct(*e) && *e != '.') ++e;
+	    span->len = e - s;
+	    span->type = SP_PUNCT;
+	    span->flags = flags;
+	    s = e;
+	    continue;
+	}
+
+	const char *word = s;
+	int quote = *s == '`';
+	int special = -1;
+	while (s < end && !isspanws(*s) && !istpunct(s, end))
+	{
+	    if (*s == '%')
 	    {
-		if (width < 0)
+		if (isrest(s, end, "%%name%%")) special = SP_NAME;
+		else if (isrest(s, end, "%%arg%%")) special = SP_ARG;
+		else if (isrest(s, end, "%%var%%")) special = SP_VAR;
+		if (special >= 0)
 		{
-		    width = x;
+		    if (s == word) s = end;
+		    else special = -1;
 		    break;
 		}
-		err("Expected table cell");
 	    }
-	    if (width < 0)
-	    {
-		table->cells = xrealloc(table->cells,
-			++table->width * sizeof *table->cells);
-	    }
-	    char *end = tmp;
-	    skipwsb(end);
-	    char *text = 0;
-	    size_t txtlen = end > p->line ? end - p->line : 0;
-	    if (txtlen)
-	    {
-		text = xmalloc(txtlen + 1);
-		strncpy(text, p->line, txtlen);
-		text[txtlen] = 0;
-	    }
-	    table->cells[table->height*table->width + x] = text;
-	    p->line = tmp+1;
+	    if (*s++ == '\\') flags |= SF_ESCAPE;
+	    if (quote && s - word > 2 && s[-1] == '`') break;
 	}
-	++table->height;
-	if (!nextline) err("Unexpected end of file");
-	skipws(p->line);
+	span->len = s - word;
+	span->type = special >= 0 ? (CDSpanType)special
+	    : spantype(word, span->len);
+	span->flags = flags;
     }
-    setoradd(val, (CliDoc *)table);
     return 0;
+}
 
-error:
-    CliDoc_destroy((CliDoc *)table);
-    return -1;
+typedef struct RefIndex
+{
+    const CDRoot *root;
+    size_t mask;
+    size_t *slots;
+} RefIndex;
+
+static CDStr mrefname(const CDRoot *root, size_t i)
+{
+    CDStr name = ((const CDMRef *)root->mrefs->c.v[i])->name;
+    if (name.len && *name.s == '&') ++name.s, --name.len;
+    return name;
 }
 
-static int parsedict(Parser *p, CliDoc **val, CliDoc *parent)
+static size_t strhash(const char *str, size_t len)
 {
-    CDDict *dict = xmalloc(sizeof *dict);
-    memset(dict, 0, sizeof *dict);
-    dict->base.parent = parent;
-    dict->base.type = CT_DICT;
+    size_t h = 2166136261U;
+    for (const char *end = str + len; str < end; ++str)
+    {
+	h = (h ^ (unsigned char)*str) * 16777619U;
+    }
+    return h;
+}
 
-    char *tmp = 0;
-    while (isdict(tmp))
+static size_t findref(const RefIndex *idx, const char *str, size_t len)
+{
+    for (size_t h = strhash(str, len) & idx->mask; idx->slots[h];
+	    h = (h + 1) & idx->mask)
     {
-	*tmp = 0;
-	p->line += 3;
-	skipws(p->line);
-	if (!*p->line) err("Empty dictionary key");
-	char *key = xmalloc(strlen(p->line)+1);
-	strcpy(key, p->line);
-	p->line = tmp+2;
-	skipws(p->line);
-
-	CliDoc *entry = 0;
-	if (*p->line == '\n')
+	CDStr name = mrefname(idx->root, idx->slots[h] - 1);
+	if (name.len == len && !memcmp(name.s, str, len))
 	{
-	    if (!nextline) err("Unexpected end of file");
-	    skipws(p->line);
-	    if (istable(tmp))
+	    return idx->slots[h];
+	}
+    }
+    return 0;
+}
+
+static void indexrefs(RefIndex *idx, CDRoot *root)
+{
+    size_t n = root->mrefs->c.n;
+    size_t size = 16;
+    while (size < 2 * n) size *= 2;
+    idx->root = root;
+    idx->mask = size - 1;
+    idx->slots = Arena_alloc(root->arena, size * sizeof *idx->slots);
+    memset(idx->slots, 0, size * sizeof *idx->slots);
+    for (size_t i = 0; i < n; ++i)
+    {
+	CDStr name = mrefname(root, i);
+	if (findref(idx, name.s, name.len)) continue;
+	size_t h = strhash(name.s, name.len) & idx->mask;
+	while (idx->slots[h]) h = (h + 1) & idx->mask;
+	idx->slots[h] = i + 1;
+    }
+}
+
+static void resolvespans(const RefIndex *idx, CDSpans *spans,
+	const char *str)
+{
+    for (size_t i = 0; i < spans->n; ++i)
+    {
+	CDSpan *span = spans->v + i;
+	if (span->type != SP_LITERAL) continue;
+	size_t ref = findref(idx, str + span->off + 1, span->len - 2);
+	if (ref)
+	{
+	    span->type = SP_MREF;
+	    span->ref = ref - 1;
+	}
+    }
+}
+
+static void resolvenode(const RefIndex *idx, CliDoc *node)
+{
+    if (!node) return;
+    switch (node->type)
+    {
+	case CT_LIST:
+	    for (size_t i = 0; i < ((CDList *)node)->c.n; ++i)
 	    {
-		if (parsetable(p, &entry, (CliDoc *)dict) < 0) goto error;
+		resolvenode(idx, ((CDList *)node)->c.v[i]);
 	    }
-	}
+	    break;
+
+	case CT_DICT:
+	    for (size_t i = 0; i < ((CDDict *)node)->v.n; ++i)
+	    {
+		CDDictEntry *e = ((CDDict *)node)->v.v + i;
+		resolvespans(idx, &e->keyspans, e->key.s);
+		resolvenode(idx, e->val);
+	    }
+	    break;
+
+	case CT_TABLE:
+	    {
+		CDTable *table = (CDTable *)node;
+		for (size_t i = 0; i < table->cells.n; ++i)
+		{
+		    CDSpans cell = { table->spans.v + table->spanidx.v[i],
+			table->spanidx.v[i+1] - table->spanidx.v[i], 0 };
+		    resolvespans(idx, &cell, table->cells.v[i].s);
+		}
+	    }
+	    break;
+
+	case CT_TEXT:
+	    resolvespans(idx, &((CDText *)node)->spans,
+		    ((CDText *)node)->text.s);
+	    break;
+
+	default:
+	    break;
+    }
+}
+
+static void resolverefs(CDRoot *root)
+{
+    ArenaMark mark = Arena_mark(root->arena);
+    RefIndex idx;
+    indexrefs(&idx, root);
+    resolvenode(&idx, root->name);
+    resolvenode(&idx, root->version);
+    resolvenode(&idx, root->comment);
+    resolvenode(&idx, root->author);
+    resolvenode(&idx, root->license);
+    resolvenode(&idx, root->description);
+    resolvenode(&idx, root->www);
+    for (size_t i = 0; i < root->flags.n + root->args.n; ++i)
+    {
+	CDArg *arg = i < root->flags.n ? &root->flags.v[i]->base
+	    : root->args.v[i - root->flags.n];
+	resolvenode(&idx, arg->description);
+	resolvenode(&idx, arg->def);
+	resolvenode(&idx, arg->min);
+	resolvenode(&idx, arg->max);
+    }
+    for (size_t i = 0; i < root->files.n; ++i)
+    {
+	resolvenode(&idx, root->files.v[i]->description);
+    }
+    for (size_t i = 0; i < root->vars.n; ++i)
+    {
+	resolvenode(&idx, root->vars.v[i]->description);
+    }
+    for (size_t i = 0; i < root->sigs.n; ++i)
+    {
+	resolvenode(&idx, root->sigs.v[i]->description);
+    }
+    Arena_rollback(root->arena, mark);
+}
+
+#define synbucket(t) ((t) - ((t) >= SY_SEPARATOR))
+#define NSYNBUCKETS (synbucket(SY_OPTARG) + 1)
+
+typedef struct SynEntry
+{
+    size_t key;
+    CDSynItem item;
+} SynEntry;
 
-	if (!entry)
+static int synentrycmp(const void *a, const void *b)
+{
+    const SynEntry *x = a;
+    const SynEntry *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->item.index > y->item.index) - (x->item.index < y->item.index);
+}
+
+static int synentry(const CDRoot *root, size_t i, SynEntry *e)
+{
+    const CDArg *arg;
+    int isflag = i < root->flags.n;
+    if (isflag) arg = &root->flags.v[i]->base;
+    else arg = root->args.v[i - root->flags.n];
+    int group = arg->group;
+    if (group < 0) group = root->defgroup;
+    if (group < 0) group = 0;
+    if (group > root->defgroup) return 0;
+    e->item.index = isflag ? i : i - root->flags.n;
+    e->item.len = 0;
+    if (!isflag) e->item.type = arg->optional ? SY_OPTARG : SY_ARG;
+    else if (arg->arg.s)
+    {
+	e->item.type = arg->optional ? SY_OPTFLAGARG : SY_FLAGARG;
+    }
+    else if (root->flags.v[i]->flag == '-')
+    {
+	if (!arg->optional) return 0;
+	e->item.type = SY_SEPARATOR;
+    }
+    else e->item.type = arg->optional ? SY_OPTFLAGS : SY_FLAGS;
+    e->key = (size_t)group * NSYNBUCKETS + synbucket(e->item.type);
+    return 1;
+}
+
+static void buildsynopsis(Builder *b)
+{
+    CDRoot *root = b->root;
+    size_t n = root->flags.n + root->args.n;
+    if (!n || root->defgroup < 0) return;
+    char *flags = Arena_alloc(b->arena, root->flags.n + 1);
+    root->synitems.v = Arena_alloc(b->arena, n * sizeof *root->synitems.v);
+    root->synitems.capa = n;
+    root->syngroups.capa = (size_t)root->defgroup + 2;
+    root->syngroups.v = Arena_alloc(b->arena,
+	    root->syngroups.capa * sizeof *root->syngroups.v);
+    ArenaMark mark = Arena_mark(b->arena);
+    SynEntry *entries = Arena_alloc(b->arena, n * sizeof *entries);
+    size_t nentries = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+	if (synentry(root, i, entries + nentries)) ++nentries;
+    }
+    qsort(entries, nentries, sizeof *entries, synentrycmp);
+    size_t nflags = 0;
+    const SynEntry *e = entries;
+    const SynEntry *end = entries + nentries;
+    for (size_t g = 0; g <= (size_t)root->defgroup; ++g)
+    {
+	*ArenaVec_push(b->arena, root->syngroups) = root->synitems.n;
+	while (e < end && e->key / NSYNBUCKETS == g)
 	{
-	    size_t txtlen = 0;
-	    char *txt = 0;
-	    for (;;)
+	    CDSynItem *item = ArenaVec_push(b->arena, root->synitems);
+	    *item = e->item;
+	    if (item->type == SY_FLAGS || item->type == SY_OPTFLAGS)
 	    {
-		if (*p->line == '\n' ||
-			(*p->line == '.' && p->line[1] == '\n')) break;
-		if (isdict(tmp)) break;
-		tmp = strchr(p->line, '\n');
-		if (!tmp) err("Expected end of line");
-		skipwsb(tmp);
-		size_t linelen = tmp - p->line;
-		txt = xrealloc(txt, txtlen + linelen + 2);
-		strncpy(txt + txtlen, p->line, linelen);
-		txt[txtlen + linelen] = ' ';
-		txt[txtlen + ++linelen] = 0;
-		txtlen += linelen;
-		if (!nextline) err("Unexpected end of file");
-		skipws(p->line);
+		item->index = nflags;
+		for (size_t key = e->key; e < end && e->key == key; ++e)
+		{
+		    flags[nflags++] = root->flags.v[e->item.index]->flag;
+		    ++item->len;
+		}
 	    }
-	    if (!txt) err("Empty dictionary value");
-	    txt[--txtlen] = 0;
-
-	    CDText *text = xmalloc(sizeof *text);
-	    text->base.parent = (CliDoc *)dict;
-	    text->base.type = CT_TEXT;
-	    text->text = txt;
-	    entry = (CliDoc *)text;
+	    else ++e;
 	}
-
-	dict->v = xrealloc(dict->v, (dict->n+1) * sizeof *dict->v);
-	dict->v[dict->n].key = key;
-	dict->v[dict->n++].val = entry;
     }
-    setoradd(val, (CliDoc *)dict);
-    return 0;
+    *ArenaVec_push(b->arena, root->syngroups) = root->synitems.n;
+    Arena_rollback(b->arena, mark);
+    flags[nflags] = 0;
+    root->synflags.s = flags;
+    root->synflags.len = nflags;
+}
 
-error:
-    CliDoc_destroy((CliDoc *)dict);
+static int toolong(const CDEvent *ev)
+{
+    fprintf(diagout(), "parse error in line %lu: Text too long\n", ev->line);
     return -1;
 }
 
-static int parseval(Parser *p, CliDoc **val, CliDoc *parent)
+static CliDoc *buildsection(Builder *b, const CDEvent *ev)
 {
-    char *tmp;
-    char *txt = 0;
-    if (*p->line == '\n')
+    CDRoot *root = b->root;
+    if (ev->section == CS_FLAG || ev->section == CS_ARG)
+    {
+	CDArg *arg;
+	if (ev->section == CS_FLAG)
+	{
+	    CDFlag *flag = Arena_alloc(b->arena, sizeof *flag);
+	    memset(flag, 0, sizeof *flag);
+	    flag->flag = ev->flag;
+	    flag->base.base.type = CT_FLAG;
+	    *ArenaVec_push(b->arena, root->flags) = flag;
+	    arg = &flag->base;
+	}
+	else
+	{
+	    arg = Arena_alloc(b->arena, sizeof *arg);
+	    memset(arg, 0, sizeof *arg);
+	    arg->base.type = CT_ARG;
+	    *ArenaVec_push(b->arena, root->args) = arg;
+	}
+	arg->group = -1;
+	arg->optional = -1;
+	arg->base.parent = (CliDoc *)root;
+	arg->arg = ev->str;
+	b->fields = argfields;
+	return (CliDoc *)arg;
+    }
+    CDNamed *named = Arena_alloc(b->arena, sizeof *named);
+    memset(named, 0, sizeof *named);
+    named->base.parent = (CliDoc *)root;
+    named->base.type = CT_NAMED;
+    named->name = ev->str;
+    if (ev->section == CS_FILE) *ArenaVec_push(b->arena, root->files) = named;
+    else if (ev->section == CS_VAR) *ArenaVec_push(b->arena, root->vars) = named;
+    else *ArenaVec_push(b->arena, root->sigs) = named;
+    b->fields = namedfields;
+    return (CliDoc *)named;
+}
+
+static int build(void *ctx, const CDEvent *ev)
+{
+    Builder *b = ctx;
+    switch (ev->type)
     {
-	int done = 0;
-	size_t txtlen = 0;
-	while (!done) {
-	    while (*p->line == '\n')
+	case CE_SECTION:
+	    b->node = buildsection(b, ev);
+	    break;
+
+	case CE_KEY:
+	    b->field = b->fields + ev->key;
+	    assert(b->field->kind != FK_NONE);
+	    if (b->field->unique && *(CliDoc **)fieldptr(b))
+	    {
+		fprintf(diagout(), "parse error in line %lu: Duplicate key\n",
+			ev->line);
+		return -1;
+	    }
+	    break;
+
+	case CE_TEXT:
+	    if (b->nchunks++ == 1)
 	    {
-		if (!nextline) err("Unexpected end of file");
-		skipws(p->line);
+		b->txtlen = 0;
+		txtappend(b, b->text.s, b->text.len);
 	    }
-	    int havedict = 0;
-	    int havetable = 0;
-	    while (*p->line != '\n')
+	    if (b->nchunks > 1) txtappend(b, ev->str.s, ev->str.len);
+	    else b->text = ev->str;
+	    break;
+
+	case CE_TEXTEND:
 	    {
-		if (*p->line == '.' && p->line[1] == '\n')
+		CDText *text = Arena_alloc(b->arena, sizeof *text);
+		text->base.parent = buildparent(b);
+		text->base.type = CT_TEXT;
+		if (b->nchunks > 1)
 		{
-		    done = 1;
-		    break;
+		    text->text.s = Arena_strndup(b->arena, b->txt, b->txtlen);
+		    text->text.len = b->txtlen;
 		}
-		if (isdict(tmp))
+		else text->text = b->text;
+		b->nchunks = 0;
+		if (scanspans(b, text->text.s, text->text.len) < 0)
 		{
-		    havedict = 1;
-		    break;
+		    return toolong(ev);
 		}
-		if (istable(tmp))
+		keepspans(b, &text->spans);
+		setvalue(b, (CliDoc *)text);
+	    }
+	    break;
+
+	case CE_DICT:
+	    b->dict = Arena_alloc(b->arena, sizeof *b->dict);
+	    memset(b->dict, 0, sizeof *b->dict);
+	    b->dict->base.parent = b->node;
+	    b->dict->base.type = CT_DICT;
+	    break;
+
+	case CE_DICTITEM:
+	    {
+		CDDictEntry *e = ArenaVec_push(b->arena, b->dict->v);
+		e->key = ev->str;
+		e->val = 0;
+		if (scanspans(b, e->key.s, e->key.len) < 0)
 		{
-		    havetable = 1;
-		    break;
+		    return toolong(ev);
 		}
-		tmp = strchr(p->line, '\n');
-		if (!tmp) err("Expected end of line");
-		skipwsb(tmp);
-		*tmp++ = ' ';
-		*tmp = 0;
-		size_t linelen = strlen(p->line);
-		txt = xrealloc(txt, txtlen + linelen + 1);
-		strcpy(txt+txtlen, p->line);
-		txtlen += linelen;
-		if (!nextline) err("Unexpected end of file");
-		skipws(p->line);
+		keepspans(b, &e->keyspans);
 	    }
-	    if (txt)
+	    break;
+
+	case CE_DICTEND:
+	    ArenaVec_shrink(b->arena, b->dict->v);
+	    setoradd(b->arena, fieldptr(b), (CliDoc *)b->dict);
+	    b->dict = 0;
+	    break;
+
+	case CE_TABLE:
+	    b->table = Arena_alloc(b->arena, sizeof *b->table);
+	    memset(b->table, 0, sizeof *b->table);
+	    b->table->base.parent = buildparent(b);
+	    b->table->base.type = CT_TABLE;
+	    break;
+
+	case CE_TABLEROW:
+	    if (!b->table->height) b->table->width = ev->ncells;
+	    assert(ev->ncells == b->table->width);
+	    for (size_t i = 0; i < ev->ncells; ++i)
 	    {
-		txt[txtlen-1] = 0;
-		CDText *text = xmalloc(sizeof *text);
-		text->base.parent = parent;
-		text->base.type = CT_TEXT;
-		text->text = txt;
-		txt = 0;
-		txtlen = 0;
-		setoradd(val, (CliDoc *)text);
+		*ArenaVec_push(b->arena, b->table->cells) = ev->cells[i];
+		*ArenaVec_push(b->arena, b->table->spanidx) = b->nspans;
+		if (scanspans(b, ev->cells[i].s, ev->cells[i].len) < 0)
+		{
+		    return toolong(ev);
+		}
+	    }
+	    ++b->table->height;
+	    break;
+
+	case CE_TABLEEND:
+	    *ArenaVec_push(b->arena, b->table->spanidx) = b->nspans;
+	    ArenaVec_shrink(b->arena, b->table->cells);
+	    ArenaVec_shrink(b->arena, b->table->spanidx);
+	    keepspans(b, &b->table->spans);
+	    setvalue(b, (CliDoc *)b->table);
+	    b->table = 0;
+	    break;
+
+	case CE_MREF:
+	    {
+		CDList **val = fieldptr(b);
+		if (!*val)
+		{
+		    CDList *list = Arena_alloc(b->arena, sizeof *list);
+		    memset(list, 0, sizeof *list);
+		    list->base.parent = b->node;
+		    list->base.type = CT_LIST;
+		    *val = list;
+		}
+		CDMRef *mref = Arena_alloc(b->arena, sizeof *mref);
+		mref->base.parent = (CliDoc *)*val;
+		mref->base.type = CT_MREF;
+		mref->name = ev->str;
+		mref->section = ev->str2;
+		if (ev->transient)
+		{
+		    mref->name.s = Arena_strndup(b->arena,
+			    ev->str.s, ev->str.len);
+		    mref->section.s = Arena_strndup(b->arena,
+			    ev->str2.s, ev->str2.len);
+		}
+		*ArenaVec_push(b->arena, (*val)->c) = (CliDoc *)mref;
 	    }
-	    if (havedict)
+	    break;
+
+	case CE_INT:
+	    *(int *)fieldptr(b) = ev->intval;
+	    break;
+
+	case CE_DATE:
 	    {
-		if (parsedict(p, val, parent) < 0) goto error;
-		if (*p->line == '.' && p->line[1] == '\n') done = 1;
+		CDDate *date = Arena_alloc(b->arena, sizeof *date);
+		date->base.parent = b->node;
+		date->base.type = CT_DATE;
+		date->date = ev->date;
+		*(CliDoc **)fieldptr(b) = (CliDoc *)date;
 	    }
-	    if (havetable)
+	    break;
+
+	case CE_VALUEEND:
+	    if (b->field->kind == FK_VAL)
 	    {
-		if (parsetable(p, val, parent) < 0) goto error;
-		if (*p->line == '.' && p->line[1] == '\n') done = 1;
+		CliDoc *val = *(CliDoc **)fieldptr(b);
+		if (val && val->type == CT_LIST)
+		{
+		    ArenaVec_shrink(b->arena, ((CDList *)val)->c);
+		}
 	    }
-	}
-    }
-    else
-    {
-	tmp = strchr(p->line, '\n');
-	if (!tmp) err("Expected end of line");
-	skipwsb(tmp);
-	*tmp = 0;
-	CDText *text = xmalloc(sizeof *text);
-	text->base.parent = parent;
-	text->base.type = CT_TEXT;
-	text->text = malloc(strlen(p->line)+1);
-	strcpy(text->text, p->line);
-	*val = (CliDoc *)text;
+	    break;
+
+	case CE_END:
+	    ArenaVec_shrink(b->arena, b->root->flags);
+	    ArenaVec_shrink(b->arena, b->root->args);
+	    ArenaVec_shrink(b->arena, b->root->files);
+	    ArenaVec_shrink(b->arena, b->root->vars);
+	    ArenaVec_shrink(b->arena, b->root->sigs);
+	    if (b->root->mrefs)
+	    {
+		ArenaVec_shrink(b->arena, b->root->mrefs->c);
+		resolverefs(b->root);
+	    }
+	    buildsynopsis(b);
+	    break;
     }
-    p->line = 0;
     return 0;
-
-error:
-    free(txt);
-    return -1;
 }
 
-static int parsemref(Parser *p, CDList **val, CliDoc *parent)
+SOEXPORT CliDoc *CliDoc_create(FILE *doc)
 {
-    char *name = 0;
-    const char *section = 0;
-    CDMRef *mref = 0;
+    Arena *arena = Arena_create();
+    CliDoc *self = CliDoc_createInArena(doc, arena);
+    if (self) ((CDRoot *)self)->ownarena = 1;
+    else Arena_destroy(arena);
+    return self;
+}
 
-    size_t wordlen = strcspn(p->line, " \t");
-    size_t namelen = 0;
-    size_t sectpos = 0;
-    name = xmalloc(wordlen + 3);
-    for (size_t i = 0; i < wordlen; ++i)
-    {
-	if (p->line[i] == '\\')
-	{
-	    if (++i == wordlen) err("stray backslash");
-	}
-	else if (!sectpos && p->line[i] == '.')
-	{
-	    p->line[i] = 0;
-	    sectpos = namelen + 1;
-	}
-	name[namelen++] = p->line[i];
-    }
-    if (!sectpos)
-    {
-	sectpos = namelen + 1;
-	name[namelen++] = 0;
-	name[namelen++] = '1';
-    }
-    name[namelen] = 0;
-    name = xrealloc(name, namelen + 1);
-    section = name + sectpos;
-    p->line += wordlen;
-    skipws(p->line);
-
-    size_t pos;
-    if (!*val)
-    {
-	pos = 0;
-	CDList *list = xmalloc(sizeof *list);
-	list->base.parent = parent;
-	list->base.type = CT_LIST;
-	list->n = 1;
-	list->c = xmalloc(1 * sizeof *list->c);
-	*val = list;
-    }
-    else
+CliDoc *CliDoc_createInArena(FILE *doc, Arena *arena)
+{
+    size_t len;
+    char *buf = readfile(doc, &len);
+    if (!buf) return 0;
+    CliDoc *self;
+    if (CliDoc_isImage(buf, len))
     {
-	pos = (*val)->n++;
-	(*val)->c = xrealloc((*val)->c, (*val)->n * sizeof (*val)->c);
+	self = CliDoc_createFromImage(buf, len);
+	if (self) ((CDRoot *)self)->arena = arena;
     }
-    mref = xmalloc(sizeof *mref);
-    mref->base.type = CT_MREF;
-    mref->name = name;
-    mref->section = section;
-    mref->base.parent = (CliDoc *)*val;
-    (*val)->c[pos] = (CliDoc *)mref;
-    return 0;
+    else self = CliDoc_createFromBufferInArena(buf, len, arena);
+    if (self) ((CDRoot *)self)->input = buf;
+    else free(buf);
+    return self;
+}
 
-error:
-    free(name);
-    return -1;
+SOEXPORT CliDoc *CliDoc_createFromBuffer(const char *buf, size_t len)
+{
+    Arena *arena = Arena_create();
+    CliDoc *self = CliDoc_createFromBufferInArena(buf, len, arena);
+    if (self) ((CDRoot *)self)->ownarena = 1;
+    else Arena_destroy(arena);
+    return self;
 }
 
-static int parsemrefs(Parser *p, CDList **val, CliDoc *parent)
+CliDoc *CliDoc_createFromBufferInArena(const char *buf, size_t len,
+	Arena *arena)
 {
-    char *tmp;
-    if (*p->line == '\n')
+    ArenaMark mark = Arena_mark(arena);
+    CDRoot *self = Arena_alloc(arena, sizeof *self);
+    memset(self, 0, sizeof *self);
+    self->base.type = CT_ROOT;
+    self->arena = arena;
+
+    Builder builder;
+    memset(&builder, 0, sizeof builder);
+    builder.arena = arena;
+    builder.root = self;
+    builder.node = (CliDoc *)self;
+    builder.fields = rootfields;
+    int rc = CliDoc_parseInArena(buf, len, build, &builder, arena);
+    if (rc < 0)
     {
-	for (;;)
-	{
-	    if (*p->line != '\n')
-	    {
-		if (*p->line == '.' && p->line[1] == '\n') break;
-		tmp = strchr(p->line, '\n');
-		if (!tmp) err("Expected end of line");
-		skipwsb(tmp);
-		*tmp = 0;
-		while (p->line < tmp) parsemref(p, val, parent);
-	    }
-	    if (!nextline) err("Unexpected end of file");
-	    skipws(p->line);
-	}
+	Arena_rollback(arena, mark);
+	return 0;
     }
-    else
+    return (CliDoc *)self;
+}
+
+#define IMGMAGIC "CLIDOCB\1"
+#define IMGALIGN (_Alignof (max_align_t))
+
+typedef struct ImgHeader
+{
+    char magic[8];
+    size_t layout;
+    size_t size;
+    size_t root;
+    size_t relocs;
+    size_t nrelocs;
+} ImgHeader;
+
+typedef struct ImgWriter
+{
+    char *buf;
+    size_t len;
+    size_t capa;
+    char *strs;
+    size_t strslen;
+    size_t strscapa;
+    size_t *relocs;
+    size_t nrelocs;
+    size_t relocscapa;
+    size_t *srelocs;
+    size_t nsrelocs;
+    size_t srelocscapa;
+} ImgWriter;
+
+static size_t imglayout(void)
+{
+    static const size_t sizes[] = {
+	sizeof (void *), sizeof (size_t), sizeof (time_t), sizeof (CDStr),
+	sizeof (CDRoot), sizeof (CDArg), sizeof (CDFlag), sizeof (CDList),
+	sizeof (CDDict), sizeof (CDDictEntry), sizeof (CDTable),
+	sizeof (CDNamed), sizeof (CDText), sizeof (CDDate), sizeof (CDMRef),
+	sizeof (CDSpan), sizeof (CDSynItem)
+    };
+    size_t layout = 0x01020304;
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i)
     {
-	tmp = strchr(p->line, '\n');
-	if (!tmp) err("Expected end of line");
-	skipwsb(tmp);
-	*tmp = 0;
-	while (p->line < tmp) parsemref(p, val, parent);
+	layout = layout * 31 + sizes[i];
     }
-    p->line = 0;
-    return 0;
+    return layout;
+}
 
-error:
-    return -1;
+static void *imggrow(void *buf, size_t *capa, size_t need)
+{
+    if (need <= *capa) return buf;
+    if (!*capa) *capa = 4096;
+    while (need > *capa) *capa *= 2;
+    return xrealloc(buf, *capa);
 }
 
-static int parseint(Parser *p, int *intval)
+static size_t imgput(ImgWriter *w, const void *data, size_t size)
 {
-    if (*p->line == '\n') err("Empty value");
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    if (tmp == p->line) err("Empty value");
-    errno = 0;
-    char *endp;
-    long tmpval = strtol(p->line, &endp, 10);
-    if (endp != tmp) err("Non-numeric value");
-    if (errno == ERANGE || tmpval < INT_MIN || tmpval > INT_MAX)
+    size_t off = (w->len + IMGALIGN - 1) & ~(IMGALIGN - 1);
+    w->buf = imggrow(w->buf, &w->capa, off + size);
+    memset(w->buf + w->len, 0, off - w->len);
+    if (data) memcpy(w->buf + off, data, size);
+    else memset(w->buf + off, 0, size);
+    w->len = off + size;
+    return off;
+}
+
+static void imgptr(ImgWriter *w, size_t slot, size_t target)
+{
+    if (target)
     {
-	err("Value out of range");
+	w->relocs = imggrow(w->relocs, &w->relocscapa,
+		(w->nrelocs + 1) * sizeof *w->relocs);
+	w->relocs[w->nrelocs++] = slot;
     }
-    *intval = tmpval;
-    p->line = 0;
-    return 0;
+    memcpy(w->buf + slot, &target, sizeof target);
+}
 
-error:
-    return -1;
+static void imgstr(ImgWriter *w, size_t slot, CDStr str)
+{
+    size_t target = 0;
+    if (str.s)
+    {
+	w->strs = imggrow(w->strs, &w->strscapa, w->strslen + str.len + 1);
+	memcpy(w->strs + w->strslen, str.s, str.len);
+	w->strs[w->strslen + str.len] = 0;
+	target = w->strslen;
+	w->strslen += str.len + 1;
+	w->srelocs = imggrow(w->srelocs, &w->srelocscapa,
+		(w->nsrelocs + 1) * sizeof *w->srelocs);
+	w->srelocs[w->nsrelocs++] = slot + offsetof(CDStr, s);
+    }
+    memcpy(w->buf + slot + offsetof(CDStr, s), &target, sizeof target);
 }
 
-static int parsedate(Parser *p, CliDoc **val, CliDoc *parent)
-{
-    struct tm tm = {0};
-    char buf[5] = {0};
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    if (tmp == p->line) err ("Empty value");
-    if (tmp - p->line != 8) err ("Expected YYYYMMDD");
-
-    char *endp;
-    memcpy(buf, p->line + 6, 2);
-    tm.tm_mday = strtol(buf, &endp, 10);
-    if (endp != buf + 2) err("Expected YYYYMMDD");
-    memcpy(buf, p->line + 4, 2);
-    tm.tm_mon = strtol(buf, &endp, 10) - 1;
-    if (endp != buf + 2) err("Expected YYYYMMDD");
-    memcpy(buf, p->line, 4);
-    tm.tm_year = strtol(buf, &endp, 10) - 1900;
-    if (endp != buf + 4) err("Expected YYYYMMDD");
-    time_t dv = mktime(&tm);
-    if (dv == (time_t)(-1)) err("Expected YYYYMMDD");
-    p->line = 0;
-    CDDate *date = xmalloc(sizeof *date);
-    date->base.parent = parent;
-    date->base.type = CT_DATE;
-    date->date = dv;
-    *val = (CliDoc *)date;
-    return 0;
+static size_t imgnode(ImgWriter *w, const CliDoc *node, size_t parent);
 
-error:
-    return -1;
+static void imgdata(ImgWriter *w, size_t slot, const void *data, size_t size)
+{
+    size_t arr = imgput(w, data, size);
+    imgptr(w, slot, size ? arr : 0);
 }
 
-static int parseargvals(Parser *p, CDArg *arg)
+static void imgspans(ImgWriter *w, size_t off, const CDSpans *spans)
 {
-    for (;;)
-    {
-	if (!p->line)
-	{
-	    if (!nextline) break;
-	}
-	skipws(p->line);
-	if (!*p->line) err("Expected end of line");
+    size_t arr = imgput(w, spans->v, spans->n * sizeof *spans->v);
+    CDSpans *s = (CDSpans *)(w->buf + off);
+    s->capa = s->n;
+    imgptr(w, off + offsetof(CDSpans, v), spans->n ? arr : 0);
+}
 
-	if (*p->line == '\n')
-	{
-	    p->line = 0;
-	    continue;
-	}
-	if (*p->line == '[')
-	{
-	    break;
-	}
-	char *tmp;
-	if (isws(*p->line) || *p->line == ':') err("Empty key");
-	else tmp = strchr(p->line, ':');
-	if (!tmp || tmp == p->line) err("Expected key");
-	*tmp = 0;
-	CliDoc **val = 0;
-	int *intval = 0;
-	if (!strcmp(p->line, "description")) val = &arg->description;
-	else if (!strcmp(p->line, "default")) val = &arg->def;
-	else if (!strcmp(p->line, "min")) val = &arg->min;
-	else if (!strcmp(p->line, "max")) val = &arg->max;
-	else if (!strcmp(p->line, "group")) intval = &arg->group;
-	else if (!strcmp(p->line, "optional")) intval = &arg->optional;
-	else err("Unknown key");
-	if (val && *val) err("Duplicate key");
-	p->line = tmp+1;
-	skipws(p->line);
-	if (intval)
-	{
-	    if (parseint(p, intval) < 0) goto error;
-	}
-	else if (parseval(p, val, (CliDoc *)arg) < 0) goto error;
-    }
-    return 0;
+#define imgchild(w, off, t, f, v) \
+    imgptr((w), (off) + offsetof(t, f), imgnode((w), (v), (off)))
 
-error:
-    return -1;
+static size_t imgvec(ImgWriter *w, size_t off, CliDoc *const *v, size_t n,
+	size_t parent)
+{
+    size_t arr = imgput(w, 0, n * sizeof *v);
+    for (size_t i = 0; i < n; ++i)
+    {
+	imgptr(w, arr + i * sizeof *v, imgnode(w, v[i], parent));
+    }
+    imgptr(w, off, arr);
+    return arr;
 }
 
-static int parsenamedvals(Parser *p, CDNamed *named)
+static size_t imgnode(ImgWriter *w, const CliDoc *node, size_t parent)
 {
-    for (;;)
+    if (!node) return 0;
+    size_t off;
+    switch (node->type)
     {
-	if (!p->line)
-	{
-	    if (!nextline) break;
-	}
-	skipws(p->line);
-	if (!*p->line) err("Expected end of line");
+	case CT_ROOT:
+	    {
+		const CDRoot *root = (const CDRoot *)node;
+		off = imgput(w, root, sizeof *root);
+		CDRoot *r = (CDRoot *)(w->buf + off);
+		r->arena = 0;
+		r->input = 0;
+		r->ownarena = 0;
+		r->flags.capa = r->flags.n;
+		r->args.capa = r->args.n;
+		r->files.capa = r->files.n;
+		r->vars.capa = r->vars.n;
+		r->sigs.capa = r->sigs.n;
+		r->synitems.capa = r->synitems.n;
+		r->syngroups.capa = r->syngroups.n;
+		imgchild(w, off, CDRoot, name, root->name);
+		imgchild(w, off, CDRoot, version, root->version);
+		imgchild(w, off, CDRoot, comment, root->comment);
+		imgchild(w, off, CDRoot, author, root->author);
+		imgchild(w, off, CDRoot, license, root->license);
+		imgchild(w, off, CDRoot, description, root->description);
+		imgchild(w, off, CDRoot, date, root->date);
+		imgchild(w, off, CDRoot, www, root->www);
+		imgchild(w, off, CDRoot, mrefs, (CliDoc *)root->mrefs);
+		imgvec(w, off + offsetof(CDRoot, flags.v),
+			(CliDoc *const *)root->flags.v, root->flags.n, off);
+		imgvec(w, off + offsetof(CDRoot, args.v),
+			(CliDoc *const *)root->args.v, root->args.n, off);
+		imgvec(w, off + offsetof(CDRoot, files.v),
+			(CliDoc *const *)root->files.v, root->files.n, off);
+		imgvec(w, off + offsetof(CDRoot, vars.v),
+			(CliDoc *const *)root->vars.v, root->vars.n, off);
+		imgvec(w, off + offsetof(CDRoot, sigs.v),
+			(CliDoc *const *)root->sigs.v, root->sigs.n, off);
+		imgdata(w, off + offsetof(CDRoot, synitems.v),
+			root->synitems.v,
+			root->synitems.n * sizeof *root->synitems.v);
+		imgdata(w, off + offsetof(CDRoot, syngroups.v),
+			root->syngroups.v,
+			root->syngroups.n * sizeof *root->syngroups.v);
+		imgstr(w, off + offsetof(CDRoot, synflags), root->synflags);
+	    }
+	    break;
 
-	if (*p->line == '\n')
-	{
-	    p->line = 0;
-	    continue;
-	}
-	if (*p->line == '[')
-	{
+	case CT_ARG:
+	case CT_FLAG:
+	    {
+		const CDArg *arg = (const CDArg *)node;
+		off = imgput(w, arg, node->type == CT_FLAG
+			? sizeof (CDFlag) : sizeof (CDArg));
+		imgchild(w, off, CDArg, description, arg->description);
+		imgchild(w, off, CDArg, def, arg->def);
+		imgchild(w, off, CDArg, min, arg->min);
+		imgchild(w, off, CDArg, max, arg->max);
+		imgstr(w, off + offsetof(CDArg, arg), arg->arg);
+	    }
 	    break;
-	}
-	char *tmp;
-	if (isws(*p->line) || *p->line == ':') err("Empty key");
-	else tmp = strchr(p->line, ':');
-	if (!tmp || tmp == p->line) err("Expected key");
-	*tmp = 0;
-	CliDoc **val = 0;
-	if (!strcmp(p->line, "description")) val = &named->description;
-	else err("Unknown key");
-	if (val && *val) err("Duplicate key");
-	p->line = tmp+1;
-	skipws(p->line);
-	if (parseval(p, val, (CliDoc *)named) < 0) goto error;
-    }
-    return 0;
 
-error:
-    return -1;
+	case CT_LIST:
+	    {
+		const CDList *list = (const CDList *)node;
+		off = imgput(w, list, sizeof *list);
+		((CDList *)(w->buf + off))->c.capa = list->c.n;
+		imgvec(w, off + offsetof(CDList, c.v), list->c.v, list->c.n, off);
+	    }
+	    break;
+
+	case CT_DICT:
+	    {
+		const CDDict *dict = (const CDDict *)node;
+		off = imgput(w, dict, sizeof *dict);
+		((CDDict *)(w->buf + off))->v.capa = dict->v.n;
+		size_t arr = imgput(w, dict->v.v, dict->v.n * sizeof *dict->v.v);
+		for (size_t i = 0; i < dict->v.n; ++i)
+		{
+		    size_t e = arr + i * sizeof *dict->v.v;
+		    imgstr(w, e + offsetof(CDDictEntry, key), dict->v.v[i].key);
+		    imgspans(w, e + offsetof(CDDictEntry, keyspans),
+			    &dict->v.v[i].keyspans);
+		    imgptr(w, e + offsetof(CDDictEntry, val),
+			    imgnode(w, dict->v.v[i].val, off));
+		}
+		imgptr(w, off + offsetof(CDDict, v.v), arr);
+	    }
+	    break;
+
+	case CT_TABLE:
+	    {
+		const CDTable *table = (const CDTable *)node;
+		off = imgput(w, table, sizeof *table);
+		((CDTable *)(w->buf + off))->cells.capa = table->cells.n;
+		size_t arr = imgput(w, table->cells.v,
+			table->cells.n * sizeof *table->cells.v);
+		for (size_t i = 0; i < table->cells.n; ++i)
+		{
+		    imgstr(w, arr + i * sizeof *table->cells.v,
+			    table->cells.v[i]);
+		}
+		imgptr(w, off + offsetof(CDTable, cells.v), arr);
+		CDTable *t = (CDTable *)(w->buf + off);
+		t->spanidx.capa = t->spanidx.n;
+		arr = imgput(w, table->spanidx.v,
+			table->spanidx.n * sizeof *table->spanidx.v);
+		imgptr(w, off + offsetof(CDTable, spanidx.v), arr);
+		imgspans(w, off + offsetof(CDTable, spans), &table->spans);
+	    }
+	    break;
+
+	case CT_NAMED:
+	    {
+		const CDNamed *named = (const CDNamed *)node;
+		off = imgput(w, named, sizeof *named);
+		imgchild(w, off, CDNamed, description, named->description);
+		imgstr(w, off + offsetof(CDNamed, name), named->name);
+	    }
+	    break;
+
+	case CT_TEXT:
+	    off = imgput(w, node, sizeof (CDText));
+	    imgstr(w, off + offsetof(CDText, text),
+		    ((const CDText *)node)->text);
+	    imgspans(w, off + offsetof(CDText, spans),
+		    &((const CDText *)node)->spans);
+	    break;
+
+	case CT_DATE:
+	    off = imgput(w, node, sizeof (CDDate));
+	    break;
+
+	case CT_MREF:
+	    {
+		const CDMRef *mref = (const CDMRef *)node;
+		off = imgput(w, mref, sizeof *mref);
+		imgstr(w, off + offsetof(CDMRef, name), mref->name);
+		imgstr(w, off + offsetof(CDMRef, section), mref->section);
+	    }
+	    break;
+
+	default:
+	    assert(0);
+	    return 0;
+    }
+    imgptr(w, off + offsetof(CliDoc, parent), parent);
+    return off;
 }
 
-static int parseflag(Parser *p, CDRoot *root)
+SOEXPORT void CliDoc_writeImage(const CliDoc *self, Sink *out)
 {
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    --tmp;
-    if (tmp <= p->line) err("Unexpected end of line");
-    if (*tmp != ']') err("Tag not closed");
-    if (!isws(p->line[1]) && p->line[1] != ']')
-    {
-	err("Missing or invalid flag character");
-    }
-    CDFlag *flag = xmalloc(sizeof *flag);
-    memset(flag, 0, sizeof *flag);
-    flag->base.group = -1;
-    flag->base.optional = -1;
-    flag->base.base.parent = (CliDoc *)root;
-    flag->base.base.type = CT_FLAG;
-    root->flags = xrealloc(root->flags,
-	    (root->nflags+1) * sizeof *root->flags);
-    root->flags[root->nflags++] = flag;
-    flag->flag = *p->line++;
-    skipws(p->line);
-    if (p->line != tmp)
+    assert(self->type == CT_ROOT);
+    ImgWriter w;
+    memset(&w, 0, sizeof w);
+    ImgHeader hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, IMGMAGIC, sizeof hdr.magic);
+    hdr.layout = imglayout();
+    imgput(&w, &hdr, sizeof hdr);
+    hdr.root = imgnode(&w, self, 0);
+
+    size_t strbase = w.len;
+    for (size_t i = 0; i < w.nsrelocs; ++i)
     {
-	size_t arglen = tmp - p->line;
-	flag->base.arg = xmalloc(arglen + 1);
-	strncpy(flag->base.arg, p->line, arglen);
-	flag->base.arg[arglen] = 0;
+	size_t target;
+	memcpy(&target, w.buf + w.srelocs[i], sizeof target);
+	target += strbase;
+	imgptr(&w, w.srelocs[i], target);
     }
-    p->line = 0;
-    return parseargvals(p, (CDArg *)flag);
+    hdr.relocs = (strbase + w.strslen + IMGALIGN - 1) & ~(IMGALIGN - 1);
+    hdr.nrelocs = w.nrelocs;
+    hdr.size = hdr.relocs + w.nrelocs * sizeof *w.relocs;
+    memcpy(w.buf, &hdr, sizeof hdr);
 
-error:
-    return -1;
+    Sink_write(out, w.buf, w.len);
+    Sink_write(out, w.strs, w.strslen);
+    Sink_pad(out, 0, hdr.relocs - strbase - w.strslen);
+    Sink_write(out, (const char *)w.relocs, w.nrelocs * sizeof *w.relocs);
+    free(w.buf);
+    free(w.strs);
+    free(w.relocs);
+    free(w.srelocs);
 }
 
-static int parsearg(Parser *p, CDRoot *root)
-{
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    --tmp;
-    if (tmp <= p->line) err("Unexpected end of line");
-    if (*tmp != ']') err("Tag not closed");
-    skipws(p->line);
-    if (p->line == tmp) err("Missing argument name");
-    CDArg *arg = xmalloc(sizeof *arg);
-    memset(arg, 0, sizeof *arg);
-    arg->group = -1;
-    arg->optional = -1;
-    arg->base.parent = (CliDoc *)root;
-    arg->base.type = CT_ARG;
-    root->args = xrealloc(root->args, (root->nargs+1) * sizeof *root->args);
-    root->args[root->nargs++] = arg;
-    size_t arglen = tmp - p->line;
-    arg->arg = xmalloc(arglen + 1);
-    strncpy(arg->arg, p->line, arglen);
-    arg->arg[arglen] = 0;
-    p->line = 0;
-    return parseargvals(p, arg);
-
-error:
-    return -1;
+SOEXPORT int CliDoc_isImage(const void *buf, size_t len)
+{
+    return len >= sizeof (ImgHeader)
+	&& !memcmp(buf, IMGMAGIC, sizeof IMGMAGIC - 1);
 }
 
-static int parsefile(Parser *p, CDRoot *root)
-{
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    --tmp;
-    if (tmp <= p->line) err("Unexpected end of line");
-    if (*tmp != ']') err("Tag not closed");
-    skipws(p->line);
-    if (p->line == tmp) err("Missing file name");
-    CDNamed *file = xmalloc(sizeof *file);
-    memset(file, 0, sizeof *file);
-    file->base.parent = (CliDoc *)root;
-    file->base.type = CT_NAMED;
-    root->files = xrealloc(root->files,
-	    (root->nfiles+1) * sizeof *root->files);
-    root->files[root->nfiles++] = file;
-    size_t filelen = tmp - p->line;
-    file->name = xmalloc(filelen + 1);
-    strncpy(file->name, p->line, filelen);
-    file->name[filelen] = 0;
-    p->line = 0;
-    return parsenamedvals(p, file);
+#define TB(t) (1U << (t))
+#define VALTYPES (TB(CT_TEXT)|TB(CT_DICT)|TB(CT_TABLE)|TB(CT_LIST))
 
-error:
-    return -1;
+typedef struct ImgCheck
+{
+    const char *base;
+    size_t size;
+    size_t nrefs;
+} ImgCheck;
+
+static int imgin(const ImgCheck *c, const void *p, size_t n, size_t size)
+{
+    uintptr_t off = (uintptr_t)p - (uintptr_t)c->base;
+    return off % IMGALIGN == 0 && off <= c->size
+	&& n <= (c->size - off) / size;
 }
 
-static int parsevar(Parser *p, CDRoot *root)
-{
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    --tmp;
-    if (tmp <= p->line) err("Unexpected end of line");
-    if (*tmp != ']') err("Tag not closed");
-    skipws(p->line);
-    if (p->line == tmp) err("Missing var name");
-    CDNamed *var = xmalloc(sizeof *var);
-    memset(var, 0, sizeof *var);
-    var->base.parent = (CliDoc *)root;
-    var->base.type = CT_NAMED;
-    root->vars = xrealloc(root->vars,
-	    (root->nvars+1) * sizeof *root->vars);
-    root->vars[root->nvars++] = var;
-    size_t varlen = tmp - p->line;
-    var->name = xmalloc(varlen + 1);
-    strncpy(var->name, p->line, varlen);
-    var->name[varlen] = 0;
-    p->line = 0;
-    return parsenamedvals(p, var);
+static int imgcheckstr(const ImgCheck *c, CDStr str)
+{
+    if (!str.s) return !str.len;
+    uintptr_t off = (uintptr_t)str.s - (uintptr_t)c->base;
+    return off < c->size && str.len < c->size - off && !str.s[str.len];
+}
 
-error:
-    return -1;
+static int imgcheckspans(const ImgCheck *c, const CDSpan *v, size_t n,
+	size_t len)
+{
+    if (n && !imgin(c, v, n, sizeof *v)) return 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+	if (v[i].type > SP_MAIL || v[i].off > len
+		|| v[i].len > len - v[i].off
+		|| (v[i].type >= SP_FLAG && v[i].len < 2)
+		|| (v[i].type == SP_MREF && v[i].ref >= c->nrefs)) return 0;
+    }
+    return 1;
 }
 
-static int parsesig(Parser *p, CDRoot *root)
-{
-    char *tmp = strchr(p->line, '\n');
-    if (!tmp) err("Expected end of line");
-    skipwsb(tmp);
-    --tmp;
-    if (tmp <= p->line) err("Unexpected end of line");
-    if (*tmp != ']') err("Tag not closed");
-    skipws(p->line);
-    if (p->line == tmp) err("Missing sig name");
-    CDNamed *sig = xmalloc(sizeof *sig);
-    memset(sig, 0, sizeof *sig);
-    sig->base.parent = (CliDoc *)root;
-    sig->base.type = CT_NAMED;
-    root->sigs = xrealloc(root->sigs,
-	    (root->nsigs+1) * sizeof *root->sigs);
-    root->sigs[root->nsigs++] = sig;
-    size_t siglen = tmp - p->line;
-    sig->name = xmalloc(siglen + 1);
-    strncpy(sig->name, p->line, siglen);
-    sig->name[siglen] = 0;
-    p->line = 0;
-    return parsenamedvals(p, sig);
+static int imgchecknode(ImgCheck *c, const CliDoc *node,
+	const CliDoc *parent, unsigned types);
 
-error:
-    return -1;
+static int imgcheckchild(ImgCheck *c, const CliDoc *node,
+	const CliDoc *parent, unsigned types)
+{
+    return !node || imgchecknode(c, node, parent, types);
 }
 
-static int parse(CDRoot *root, FILE *doc)
+static int imgcheckvec(ImgCheck *c, CliDoc *const *v, size_t n,
+	const CliDoc *parent, unsigned types)
 {
-    Parser parser = { doc, 0, 0, {0} };
-    Parser *p = &parser;
-
-    for (;;)
+    if (n && !imgin(c, v, n, sizeof *v)) return 0;
+    for (size_t i = 0; i < n; ++i)
     {
-	if (!p->line)
+	if (!imgchecknode(c, v[i], parent, types)) return 0;
+    }
+    return 1;
+}
+
+static int imgcheckroot(ImgCheck *c, const CDRoot *root)
+{
+    const CliDoc *node = (const CliDoc *)root;
+    if (!imgcheckchild(c, (const CliDoc *)root->mrefs, node,
+		TB(CT_LIST)|TB(CT_MREF))
+	    || (root->mrefs && root->mrefs->base.type != CT_LIST)) return 0;
+    c->nrefs = root->mrefs ? root->mrefs->c.n : 0;
+    if (!imgcheckchild(c, root->name, node, VALTYPES)
+	    || !imgcheckchild(c, root->version, node, VALTYPES)
+	    || !imgcheckchild(c, root->comment, node, VALTYPES)
+	    || !imgcheckchild(c, root->author, node, VALTYPES)
+	    || !imgcheckchild(c, root->license, node, VALTYPES)
+	    || !imgcheckchild(c, root->description, node, VALTYPES)
+	    || !imgcheckchild(c, root->date, node, TB(CT_DATE))
+	    || !imgcheckchild(c, root->www, node, VALTYPES)
+	    || !imgcheckvec(c, (CliDoc *const *)root->flags.v,
+		root->flags.n, node, TB(CT_FLAG))
+	    || !imgcheckvec(c, (CliDoc *const *)root->args.v,
+		root->args.n, node, TB(CT_ARG))
+	    || !imgcheckvec(c, (CliDoc *const *)root->files.v,
+		root->files.n, node, TB(CT_NAMED))
+	    || !imgcheckvec(c, (CliDoc *const *)root->vars.v,
+		root->vars.n, node, TB(CT_NAMED))
+	    || !imgcheckvec(c, (CliDoc *const *)root->sigs.v,
+		root->sigs.n, node, TB(CT_NAMED))
+	    || !imgcheckstr(c, root->synflags)) return 0;
+
+    const CDSynItem *items = root->synitems.v;
+    if (root->synitems.n && !imgin(c, items,
+		root->synitems.n, sizeof *items)) return 0;
+    for (size_t i = 0; i < root->synitems.n; ++i)
+    {
+	switch (items[i].type)
 	{
-	    if (!nextline) break;
+	    case SY_FLAGS:
+	    case SY_OPTFLAGS:
+		if (items[i].index > root->synflags.len || items[i].len
+			> root->synflags.len - items[i].index) return 0;
+		break;
+
+	    case SY_FLAGARG:
+	    case SY_OPTFLAGARG:
+		if (items[i].index >= root->flags.n) return 0;
+		break;
+
+	    case SY_SEPARATOR:
+		break;
+
+	    case SY_ARG:
+	    case SY_OPTARG:
+		if (items[i].index >= root->args.n) return 0;
+		break;
+
+	    default:
+		return 0;
 	}
-	skipws(p->line);
-	if (!*p->line) err("Expected end of line");
+    }
+    const size_t *groups = root->syngroups.v;
+    if (root->syngroups.n && !imgin(c, groups,
+		root->syngroups.n, sizeof *groups)) return 0;
+    for (size_t i = 0; i < root->syngroups.n; ++i)
+    {
+	if (groups[i] > root->synitems.n
+		|| (i && groups[i] < groups[i-1])) return 0;
+    }
+    return 1;
+}
+
+static int imgchecktable(ImgCheck *c, const CDTable *table)
+{
+    size_t ncells = table->cells.n;
+    if ((table->width && table->height > SIZE_MAX / table->width)
+	    || ncells != table->width * table->height
+	    || table->spanidx.n != ncells + 1
+	    || (ncells && !imgin(c, table->cells.v, ncells,
+		    sizeof *table->cells.v))
+	    || !imgin(c, table->spanidx.v, ncells + 1,
+		sizeof *table->spanidx.v)
+	    || (table->spans.n && !imgin(c, table->spans.v, table->spans.n,
+		    sizeof *table->spans.v))) return 0;
+    const size_t *idx = table->spanidx.v;
+    if (idx[ncells] > table->spans.n) return 0;
+    for (size_t i = 0; i < ncells; ++i)
+    {
+	if (idx[i] > idx[i+1] || !imgcheckstr(c, table->cells.v[i])
+		|| (idx[i] < idx[i+1] && !imgcheckspans(c,
+			table->spans.v + idx[i], idx[i+1] - idx[i],
+			table->cells.v[i].len))) return 0;
+    }
+    return 1;
+}
+
+static int imgchecknode(ImgCheck *c, const CliDoc *node,
+	const CliDoc *parent, unsigned types)
+{
+    static const size_t sizes[] = {
+	[CT_ROOT] = sizeof (CDRoot),
+	[CT_ARG] = sizeof (CDArg),
+	[CT_FLAG] = sizeof (CDFlag),
+	[CT_LIST] = sizeof (CDList),
+	[CT_DICT] = sizeof (CDDict),
+	[CT_TABLE] = sizeof (CDTable),
+	[CT_NAMED] = sizeof (CDNamed),
+	[CT_TEXT] = sizeof (CDText),
+	[CT_DATE] = sizeof (CDDate),
+	[CT_MREF] = sizeof (CDMRef)
+    };
+
+    if ((uintptr_t)node <= (uintptr_t)parent
+	    || !imgin(c, node, 1, sizeof *node) || node->parent != parent
+	    || (unsigned)node->type > CT_MREF || !(types & TB(node->type))
+	    || !imgin(c, node, 1, sizes[node->type])) return 0;
+    switch (node->type)
+    {
+	case CT_ROOT:
+	    return imgcheckroot(c, (const CDRoot *)node);
 
-	if (*p->line == '\n')
-	{
-	    p->line = 0;
-	    continue;
-	}
+	case CT_ARG:
+	case CT_FLAG:
+	    {
+		const CDArg *arg = (const CDArg *)node;
+		return imgcheckchild(c, arg->description, node, VALTYPES)
+		    && imgcheckchild(c, arg->def, node, VALTYPES)
+		    && imgcheckchild(c, arg->min, node, VALTYPES)
+		    && imgcheckchild(c, arg->max, node, VALTYPES)
+		    && imgcheckstr(c, arg->arg);
+	    }
 
-	if (*p->line == '[')
-	{
-	    if (!strncmp(p->line+1, "flag ", 5))
+	case CT_LIST:
 	    {
-		p->line += 6;
-		if (parseflag(p, root) < 0) goto error;
+		const CDList *list = (const CDList *)node;
+		return imgcheckvec(c, list->c.v, list->c.n, node,
+			types & ~TB(CT_LIST));
 	    }
-	    else if (!strncmp(p->line+1, "arg ", 4))
+
+	case CT_DICT:
 	    {
-		p->line += 5;
-		if (parsearg(p, root) < 0) goto error;
+		const CDDict *dict = (const CDDict *)node;
+		const CDDictEntry *e = dict->v.v;
+		if (dict->v.n && !imgin(c, e, dict->v.n, sizeof *e)) return 0;
+		for (size_t i = 0; i < dict->v.n; ++i)
+		{
+		    if (!imgcheckstr(c, e[i].key)
+			    || !imgcheckspans(c, e[i].keyspans.v,
+				e[i].keyspans.n, e[i].key.len)
+			    || !imgchecknode(c, e[i].val, node,
+				TB(CT_TEXT)|TB(CT_TABLE))) return 0;
+		}
+		return 1;
 	    }
-	    else if (!strncmp(p->line+1, "file ", 5))
+
+	case CT_TABLE:
+	    return imgchecktable(c, (const CDTable *)node);
+
+	case CT_NAMED:
 	    {
-		p->line += 6;
-		if (parsefile(p, root) < 0) goto error;
+		const CDNamed *named = (const CDNamed *)node;
+		return imgcheckchild(c, named->description, node, VALTYPES)
+		    && imgcheckstr(c, named->name);
 	    }
-	    else if (!strncmp(p->line+1, "var ", 4))
+
+	case CT_TEXT:
 	    {
-		p->line += 5;
-		if (parsevar(p, root) < 0) goto error;
+		const CDText *text = (const CDText *)node;
+		return imgcheckstr(c, text->text)
+		    && imgcheckspans(c, text->spans.v, text->spans.n,
+			    text->text.len);
 	    }
-	    else if (!strncmp(p->line+1, "sig ", 4))
+
+	case CT_MREF:
 	    {
-		p->line += 5;
-		if (parsesig(p, root) < 0) goto error;
+		const CDMRef *mref = (const CDMRef *)node;
+		return imgcheckstr(c, mref->name)
+		    && imgcheckstr(c, mref->section);
 	    }
-	    else err("Unknown tag");
-	    continue;
-	}
 
-	char *tmp;
-	if (isws(*p->line) || *p->line == ':') err("Empty key");
-	else tmp = strchr(p->line, ':');
-	if (!tmp || tmp == p->line) err("Expected key");
-	*tmp = 0;
-	int *intval = 0;
-	CliDoc **val = 0;
-	CDList **refs = 0;
-	CliDoc **dateval = 0;
-	if (!strcmp(p->line, "name")) val = &root->name;
-	else if (!strcmp(p->line, "version")) val = &root->version;
-	else if (!strcmp(p->line, "comment")) val = &root->comment;
-	else if (!strcmp(p->line, "author")) val = &root->author;
-	else if (!strcmp(p->line, "license")) val = &root->license;
-	else if (!strcmp(p->line, "description")) val = &root->description;
-	else if (!strcmp(p->line, "date")) dateval = &root->date;
-	else if (!strcmp(p->line, "www")) val = &root->www;
-	else if (!strcmp(p->line, "manrefs")) refs = &root->mrefs;
-	else if (!strcmp(p->line, "defgroup")) intval = &root->defgroup;
-	else err("Unknown key");
-	if (val && *val) err("Duplicate key");
-	if (dateval && *dateval) err("Duplicate key");
-	p->line = tmp+1;
-	skipws(p->line);
-	if (intval)
-	{
-	    if (parseint(p, intval) < 0) goto error;
-	}
-	else if (dateval)
-	{
-	    if (parsedate(p, dateval, (CliDoc *)root) < 0) goto error;
-	}
-	else if (refs)
-	{
-	    if (parsemrefs(p, refs, (CliDoc *)root) < 0) goto error;
-	}
-	else if (parseval(p, val, (CliDoc *)root) < 0) goto error;
+	default:
+	    return 1;
     }
-    return 0;
-
-error:
-    return -1;
 }
 
-CliDoc *CliDoc_create(FILE *doc)
+SOEXPORT CliDoc *CliDoc_createFromImage(void *buf, size_t len)
 {
-    CDRoot *self = xmalloc(sizeof *self);
-    memset(self, 0, sizeof *self);
-    self->base.type = CT_ROOT;
-
-    if (parse(self, doc) < 0)
+    char *base = buf;
+    ImgHeader hdr;
+    if (!CliDoc_isImage(buf, len)) goto error;
+    memcpy(&hdr, base, sizeof hdr);
+    if (hdr.layout != imglayout()) goto error;
+    if ((uintptr_t)base % IMGALIGN) goto error;
+    if (hdr.size != len || hdr.relocs < sizeof hdr || hdr.relocs > len
+	    || hdr.nrelocs > (len - hdr.relocs) / sizeof (size_t)
+	    || hdr.relocs % IMGALIGN
+	    || hdr.root < sizeof hdr || hdr.relocs < sizeof (CDRoot)
+	    || hdr.root > hdr.relocs - sizeof (CDRoot))
     {
-	CliDoc_destroy((CliDoc *)self);
-	return 0;
+	goto error;
     }
-    return (CliDoc *)self;
+    const size_t *relocs = (const size_t *)(base + hdr.relocs);
+    for (size_t i = 0; i < hdr.nrelocs; ++i)
+    {
+	size_t target;
+	if (relocs[i] < sizeof hdr
+		|| relocs[i] > hdr.relocs - sizeof target) goto error;
+	memcpy(&target, base + relocs[i], sizeof target);
+	if (target >= hdr.relocs) goto error;
+	char *ptr = base + target;
+	memcpy(base + relocs[i], &ptr, sizeof ptr);
+    }
+    CliDoc *self = (CliDoc *)(base + hdr.root);
+    ImgCheck check = { base, hdr.relocs, 0 };
+    if (!imgchecknode(&check, self, 0, TB(CT_ROOT))) goto error;
+    CDRoot *root = (CDRoot *)self;
+    root->arena = 0;
+    root->input = 0;
+    root->ownarena = 0;
+    return self;
+
+error:
+    fputs("Invalid or incompatible clidoc image\n", diagout());
+    return 0;
 }
 
-ContentType CliDoc_type(const CliDoc *self)
+SOEXPORT ContentType CliDoc_type(const CliDoc *self)
 {
     return self->type;
 }
 
-const CliDoc *CliDoc_parent(const CliDoc *self)
+SOEXPORT const CliDoc *CliDoc_parent(const CliDoc *self)
 {
     return self->parent;
 }
 
-const CliDoc *CDRoot_name(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_name(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->name;
 }
 
-const CliDoc *CDRoot_version(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_version(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->version;
 }
 
-const CliDoc *CDRoot_comment(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_comment(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->comment;
 }
 
-const CliDoc *CDRoot_author(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_author(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->author;
 }
 
-const CliDoc *CDRoot_license(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_license(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->license;
 }
 
-const CliDoc *CDRoot_description(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_description(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->description;
 }
 
-const CliDoc *CDRoot_date(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_date(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->date;
 }
 
-const CliDoc *CDRoot_www(const CliDoc *self)
+SOEXPORT const CliDoc *CDRoot_www(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->www;
 }
 
-size_t CDRoot_nflags(const CliDoc *self)
+SOEXPORT size_t CDRoot_nflags(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
-    return ((const CDRoot *)self)->nflags;
+    return ((const CDRoot *)self)->flags.n;
 }
 
-const CliDoc *CDRoot_flag(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_flag(const CliDoc *self, size_t i)
 {
     assert(i < CDRoot_nflags(self));
-    return (const CliDoc *)((const CDRoot *)self)->flags[i];
+    return (const CliDoc *)((const CDRoot *)self)->flags.v[i];
 }
 
-size_t CDRoot_nargs(const CliDoc *self)
+SOEXPORT size_t CDRoot_nargs(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
-    return ((const CDRoot *)self)->nargs;
+    return ((const CDRoot *)self)->args.n;
 }
 
-const CliDoc *CDRoot_arg(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_arg(const CliDoc *self, size_t i)
 {
     assert(i < CDRoot_nargs(self));
-    return (const CliDoc *)((const CDRoot *)self)->args[i];
+    return (const CliDoc *)((const CDRoot *)self)->args.v[i];
 }
 
-size_t CDRoot_nfiles(const CliDoc *self)
+SOEXPORT size_t CDRoot_nfiles(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
-    return ((const CDRoot *)self)->nfiles;
+    return ((const CDRoot *)self)->files.n;
 }
 
-const CliDoc *CDRoot_file(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_file(const CliDoc *self, size_t i)
 {
     assert(i < CDRoot_nfiles(self));
-    return (const CliDoc *)((const CDRoot *)self)->files[i];
+    return (const CliDoc *)((const CDRoot *)self)->files.v[i];
 }
 
-size_t CDRoot_nvars(const CliDoc *self)
+SOEXPORT size_t CDRoot_nvars(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
-    return ((const CDRoot *)self)->nvars;
+    return ((const CDRoot *)self)->vars.n;
 }
 
-const CliDoc *CDRoot_var(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_var(const CliDoc *self, size_t i)
 {
     assert(i < CDRoot_nvars(self));
-    return (const CliDoc *)((const CDRoot *)self)->vars[i];
+    return (const CliDoc *)((const CDRoot *)self)->vars.v[i];
 }
 
-size_t CDRoot_nsigs(const CliDoc *self)
+SOEXPORT size_t CDRoot_nsigs(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
-    return ((const CDRoot *)self)->nsigs;
+    return ((const CDRoot *)self)->sigs.n;
 }
 
-const CliDoc *CDRoot_sig(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_sig(const CliDoc *self, size_t i)
 {
     assert(i < CDRoot_nsigs(self));
-    return (const CliDoc *)((const CDRoot *)self)->sigs[i];
+    return (const CliDoc *)((const CDRoot *)self)->sigs.v[i];
 }
 
-size_t CDRoot_nrefs(const CliDoc *self)
+SOEXPORT size_t CDRoot_nrefs(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     const CDList *list = ((const CDRoot *)self)->mrefs;
@@ -1035,7 +1629,7 @@ size_t CDRoot_nrefs(const CliDoc *self)
     return CDList_length((const CliDoc *)list);
 }
 
-const CliDoc *CDRoot_ref(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDRoot_ref(const CliDoc *self, size_t i)
 {
     assert(self->type == CT_ROOT);
     const CDList *list = ((const CDRoot *)self)->mrefs;
@@ -1043,276 +1637,214 @@ const CliDoc *CDRoot_ref(const CliDoc *self, size_t i)
     return CDList_entry((const CliDoc *)list, i);
 }
 
-int CDRoot_defgroup(const CliDoc *self)
+SOEXPORT int CDRoot_defgroup(const CliDoc *self)
 {
     assert(self->type == CT_ROOT);
     return ((const CDRoot *)self)->defgroup;
 }
 
-const CliDoc *CDArg_description(const CliDoc *self)
+SOEXPORT size_t CDRoot_ngroups(const CliDoc *self)
+{
+    assert(self->type == CT_ROOT);
+    const CDRoot *root = (const CDRoot *)self;
+    return root->syngroups.n ? root->syngroups.n - 1 : 0;
+}
+
+SOEXPORT const CDSynItem *CDRoot_group(const CliDoc *self, size_t i, size_t *n)
+{
+    assert(i < CDRoot_ngroups(self));
+    const CDRoot *root = (const CDRoot *)self;
+    const size_t *idx = root->syngroups.v + i;
+    *n = idx[1] - idx[0];
+    return root->synitems.v + idx[0];
+}
+
+SOEXPORT const char *CDRoot_synflags(const CliDoc *self)
+{
+    assert(self->type == CT_ROOT);
+    return ((const CDRoot *)self)->synflags.s;
+}
+
+SOEXPORT const CliDoc *CDArg_description(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->description;
 }
 
-const CliDoc *CDArg_default(const CliDoc *self)
+SOEXPORT const CliDoc *CDArg_default(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->def;
 }
 
-const CliDoc *CDArg_min(const CliDoc *self)
+SOEXPORT const CliDoc *CDArg_min(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->min;
 }
 
-const CliDoc *CDArg_max(const CliDoc *self)
+SOEXPORT const CliDoc *CDArg_max(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->max;
 }
 
-const char *CDArg_arg(const CliDoc *self)
+SOEXPORT const char *CDArg_argn(const CliDoc *self, size_t *len)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
-    return ((const CDArg *)self)->arg;
+    const CDArg *arg = (const CDArg *)self;
+    if (len) *len = arg->arg.len;
+    return arg->arg.s;
 }
 
-int CDArg_group(const CliDoc *self)
+SOEXPORT int CDArg_group(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->group;
 }
 
-int CDArg_optional(const CliDoc *self)
+SOEXPORT int CDArg_optional(const CliDoc *self)
 {
     assert(self->type == CT_ARG || self->type == CT_FLAG);
     return ((const CDArg *)self)->optional;
 }
 
-char CDFlag_flag(const CliDoc *self)
+SOEXPORT char CDFlag_flag(const CliDoc *self)
 {
     assert(self->type == CT_FLAG);
     return ((const CDFlag *)self)->flag;
 }
 
-size_t CDList_length(const CliDoc *self)
+SOEXPORT size_t CDList_length(const CliDoc *self)
 {
     assert(self->type == CT_LIST);
-    return ((const CDList *)self)->n;
+    return ((const CDList *)self)->c.n;
 }
 
-const CliDoc *CDList_entry(const CliDoc *self, size_t i)
+SOEXPORT const CliDoc *CDList_entry(const CliDoc *self, size_t i)
 {
     assert(i < CDList_length(self));
-    return ((const CDList *)self)->c[i];
+    return ((const CDList *)self)->c.v[i];
 }
 
-size_t CDDict_length(const CliDoc *self)
+SOEXPORT size_t CDDict_length(const CliDoc *self)
 {
     assert(self->type == CT_DICT);
-    return ((const CDDict *)self)->n;
+    return ((const CDDict *)self)->v.n;
 }
 
-const char *CDDict_key(const CliDoc *self, size_t i)
+SOEXPORT const char *CDDict_keyn(const CliDoc *self, size_t i, size_t *len)
 {
     assert(i < CDDict_length(self));
-    return ((const CDDict *)self)->v[i].key;
+    const CDDict *dict = (const CDDict *)self;
+    if (len) *len = dict->v.v[i].key.len;
+    return dict->v.v[i].key.s;
 }
 
-const CliDoc *CDDict_val(const CliDoc *self, size_t i)
+SOEXPORT const CDSpan *CDDict_keyspans(const CliDoc *self, size_t i, size_t *n)
 {
     assert(i < CDDict_length(self));
-    return ((const CDDict *)self)->v[i].val;
+    const CDDict *dict = (const CDDict *)self;
+    *n = dict->v.v[i].keyspans.n;
+    return dict->v.v[i].keyspans.v;
 }
 
-size_t CDTable_width(const CliDoc *self)
+SOEXPORT const CliDoc *CDDict_val(const CliDoc *self, size_t i)
+{
+    assert(i < CDDict_length(self));
+    return ((const CDDict *)self)->v.v[i].val;
+}
+
+SOEXPORT size_t CDTable_width(const CliDoc *self)
 {
     assert(self->type == CT_TABLE);
     return ((const CDTable *)self)->width;
 }
 
-size_t CDTable_height(const CliDoc *self)
+SOEXPORT size_t CDTable_height(const CliDoc *self)
 {
     assert(self->type == CT_TABLE);
     return ((const CDTable *)self)->height;
 }
 
-const char *CDTable_cell(const CliDoc *self, size_t x, size_t y)
+SOEXPORT const char *CDTable_celln(const CliDoc *self, size_t x, size_t y,
+	size_t *len)
+{
+    assert(x < CDTable_width(self) && y < CDTable_height(self));
+    const CDTable *table = (const CDTable *)self;
+    const CDStr *cell = table->cells.v + table->width * y + x;
+    if (len) *len = cell->len;
+    return cell->s;
+}
+
+SOEXPORT const CDSpan *CDTable_cellspans(const CliDoc *self, size_t x, size_t y,
+	size_t *n)
 {
     assert(x < CDTable_width(self) && y < CDTable_height(self));
     const CDTable *table = (const CDTable *)self;
-    return table->cells[table->width * y + x];
+    const size_t *idx = table->spanidx.v + table->width * y + x;
+    *n = idx[1] - idx[0];
+    return table->spans.v + idx[0];
 }
 
-const char *CDNamed_name(const CliDoc *self)
+SOEXPORT const char *CDNamed_namen(const CliDoc *self, size_t *len)
 {
     assert(self->type == CT_NAMED);
-    return ((const CDNamed *)self)->name;
+    const CDNamed *named = (const CDNamed *)self;
+    if (len) *len = named->name.len;
+    return named->name.s;
 }
 
-const CliDoc *CDNamed_description(const CliDoc *self)
+SOEXPORT const CliDoc *CDNamed_description(const CliDoc *self)
 {
     assert(self->type == CT_NAMED);
     return ((const CDNamed *)self)->description;
 }
 
-const char *CDText_str(const CliDoc *self)
+SOEXPORT const char *CDText_strn(const CliDoc *self, size_t *len)
 {
     assert(self->type == CT_TEXT);
-    return ((const CDText *)self)->text;
+    const CDText *text = (const CDText *)self;
+    if (len) *len = text->text.len;
+    return text->text.s;
 }
 
-time_t CDDate_date(const CliDoc *self)
+SOEXPORT const CDSpan *CDText_spans(const CliDoc *self, size_t *n)
 {
-    assert(self->type == CT_DATE);
-    return ((const CDDate *)self)->date;
+    assert(self->type == CT_TEXT);
+    const CDText *text = (const CDText *)self;
+    *n = text->spans.n;
+    return text->spans.v;
 }
 
-const char *CDMRef_name(const CliDoc *self)
+SOEXPORT time_t CDDate_date(const CliDoc *self)
 {
-    assert(self->type == CT_MREF);
-    return ((const CDMRef *)self)->name;
+    assert(self->type == CT_DATE);
+    return ((const CDDate *)self)->date;
 }
 
-const char *CDMRef_section(const CliDoc *self)
+SOEXPORT const char *CDMRef_namen(const CliDoc *self, size_t *len)
 {
     assert(self->type == CT_MREF);
-    return ((const CDMRef *)self)->section;
-}
-
-static void CDMRef_destroy(CliDoc *self)
-{
-    CDMRef *mref = (CDMRef *)self;
-    free(mref->name);
-}
-
-static void CDText_destroy(CliDoc *self)
-{
-    CDText *text = (CDText *)self;
-    free(text->text);
-}
-
-static void CDNamed_destroy(CliDoc *self)
-{
-    CDNamed *named = (CDNamed *)self;
-    CliDoc_destroy(named->description);
-    free(named->name);
-}
-
-static void CDList_destroy(CliDoc *self)
-{
-    CDList *list = (CDList *)self;
-    for (size_t i = 0; i < list->n; ++i)
-    {
-	CliDoc_destroy(list->c[i]);
-    }
-    free(list->c);
-}
-
-static void CDDict_destroy(CliDoc *self)
-{
-    CDDict *dict = (CDDict *)self;
-    for (size_t i = 0; i < dict->n; ++i)
-    {
-	free(dict->v[i].key);
-	CliDoc_destroy(dict->v[i].val);
-    }
-    free(dict->v);
-}
-
-static void CDTable_destroy(CliDoc *self)
-{
-    CDTable *table = (CDTable *)self;
-    for (size_t i = 0; i < table->width * table->height; ++i)
-    {
-	free(table->cells[i]);
-    }
-    free(table->cells);
-}
-
-static void CDArg_destroy(CliDoc *self)
-{
-    CDArg *arg = (CDArg *)self;
-    CliDoc_destroy(arg->description);
-    CliDoc_destroy(arg->def);
-    CliDoc_destroy(arg->min);
-    CliDoc_destroy(arg->max);
-    free(arg->arg);
+    const CDMRef *mref = (const CDMRef *)self;
+    if (len) *len = mref->name.len;
+    return mref->name.s;
 }
 
-static void CDRoot_destroy(CliDoc *self)
+SOEXPORT const char *CDMRef_sectionn(const CliDoc *self, size_t *len)
 {
-    CDRoot *root = (CDRoot *)self;
-    CliDoc_destroy(root->name);
-    CliDoc_destroy(root->version);
-    CliDoc_destroy(root->comment);
-    CliDoc_destroy(root->author);
-    CliDoc_destroy(root->license);
-    CliDoc_destroy(root->description);
-    CliDoc_destroy(root->date);
-    CliDoc_destroy(root->www);
-    CliDoc_destroy((CliDoc *)root->mrefs);
-    if (root->nflags)
-    {
-	for (size_t i = 0; i < root->nflags; ++i)
-	{
-	    CliDoc_destroy((CliDoc *)root->flags[i]);
-	}
-	free(root->flags);
-    }
-    if (root->nargs)
-    {
-	for (size_t i = 0; i < root->nargs; ++i)
-	{
-	    CliDoc_destroy((CliDoc *)root->args[i]);
-	}
-	free(root->args);
-    }
-    if (root->nfiles)
-    {
-	for (size_t i = 0; i < root->nfiles; ++i)
-	{
-	    CliDoc_destroy((CliDoc *)root->files[i]);
-	}
-	free(root->files);
-    }
-    if (root->nvars)
-    {
-	for (size_t i = 0; i < root->nvars; ++i)
-	{
-	    CliDoc_destroy((CliDoc *)root->vars[i]);
-	}
-	free(root->vars);
-    }
-    if (root->nvars)
-    {
-	for (size_t i = 0; i < root->nvars; ++i)
-	{
-	    CliDoc_destroy((CliDoc *)root->sigs[i]);
-	}
-	free(root->sigs);
-    }
+    assert(self->type == CT_MREF);
+    const CDMRef *mref = (const CDMRef *)self;
+    if (len) *len = mref->section.len;
+    return mref->section.s;
 }
 
-void CliDoc_destroy(CliDoc *self)
+SOEXPORT void CliDoc_destroy(CliDoc *self)
 {
     if (!self) return;
-    switch (self->type)
-    {
-	case CT_ROOT: CDRoot_destroy(self); break;
-	case CT_ARG:
-	case CT_FLAG: CDArg_destroy(self); break;
-	case CT_LIST: CDList_destroy(self); break;
-	case CT_DICT: CDDict_destroy(self); break;
-	case CT_TABLE: CDTable_destroy(self); break;
-	case CT_NAMED: CDNamed_destroy(self); break;
-	case CT_TEXT: CDText_destroy(self); break;
-	case CT_MREF: CDMRef_destroy(self); break;
-	case CT_DATE:
-	default: break;
-    }
-    free(self);
+    assert(self->type == CT_ROOT);
+    CDRoot *root = (CDRoot *)self;
+    char *input = root->input;
+    if (root->ownarena) Arena_destroy(root->arena);
+    free(input);
 }
-
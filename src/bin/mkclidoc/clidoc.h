@@ -3,10 +3,13 @@
 
 #include "decl.h"
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 
 C_CLASS_DECL(CliDoc);
+C_CLASS_DECL(Sink);
 
 typedef enum ContentType
 {
@@ -22,71 +25,220 @@ typedef enum ContentType
     CT_MREF
 } ContentType;
 
-CliDoc *CliDoc_create(FILE *doc);
-ContentType CliDoc_type(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CliDoc_parent(const CliDoc *self) CMETHOD ATTR_PURE;
-
-const CliDoc *CDRoot_name(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_version(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_comment(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_author(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_license(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_description(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_date(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_www(const CliDoc *self) CMETHOD ATTR_PURE;
-size_t CDRoot_nflags(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_flag(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-size_t CDRoot_nargs(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_arg(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-size_t CDRoot_nfiles(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_file(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-size_t CDRoot_nrefs(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_ref(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-size_t CDRoot_nvars(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_var(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-size_t CDRoot_nsigs(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDRoot_sig(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-int CDRoot_defgroup(const CliDoc *self) CMETHOD ATTR_PURE;
-
-const CliDoc *CDArg_description(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDArg_default(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDArg_min(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDArg_max(const CliDoc *self) CMETHOD ATTR_PURE;
-const char *CDArg_arg(const CliDoc *self) CMETHOD ATTR_PURE;
-int CDArg_group(const CliDoc *self) CMETHOD ATTR_PURE;
-int CDArg_optional(const CliDoc *self) CMETHOD ATTR_PURE;
+typedef struct CDStr
+{
+    const char *s;
+    size_t len;
+} CDStr;
+
+typedef enum CDSpanType
+{
+    SP_WORD,
+    SP_PUNCT,
+    SP_NAME,
+    SP_ARG,
+    SP_VAR,
+    SP_FLAG,
+    SP_PATH,
+    SP_ENV,
+    SP_MREF,
+    SP_LITERAL,
+    SP_LINK,
+    SP_MAIL
+} CDSpanType;
+
+#define SF_SPACE 1
+#define SF_ESCAPE 2
+
+typedef struct CDSpan
+{
+    uint32_t off;
+    uint32_t len;
+    uint32_t ref;
+    uint8_t type;
+    uint8_t flags;
+} CDSpan;
+
+typedef enum CDSynType
+{
+    SY_FLAGS,
+    SY_OPTFLAGS,
+    SY_FLAGARG,
+    SY_OPTFLAGARG,
+    SY_SEPARATOR,
+    SY_ARG,
+    SY_OPTARG
+} CDSynType;
+
+typedef struct CDSynItem
+{
+    uint32_t type;
+    uint32_t index;
+    uint32_t len;
+} CDSynItem;
+
+typedef enum CDEventType
+{
+    CE_SECTION,
+    CE_KEY,
+    CE_TEXT,
+    CE_TEXTEND,
+    CE_DICT,
+    CE_DICTITEM,
+    CE_DICTEND,
+    CE_TABLE,
+    CE_TABLEROW,
+    CE_TABLEEND,
+    CE_MREF,
+    CE_INT,
+    CE_DATE,
+    CE_VALUEEND,
+    CE_END
+} CDEventType;
+
+typedef enum CDSection
+{
+    CS_FLAG,
+    CS_ARG,
+    CS_FILE,
+    CS_VAR,
+    CS_SIG
+} CDSection;
+
+typedef enum CDKey
+{
+    CK_NAME,
+    CK_VERSION,
+    CK_COMMENT,
+    CK_AUTHOR,
+    CK_LICENSE,
+    CK_DESCRIPTION,
+    CK_DATE,
+    CK_WWW,
+    CK_MANREFS,
+    CK_DEFGROUP,
+    CK_DEFAULT,
+    CK_MIN,
+    CK_MAX,
+    CK_GROUP,
+    CK_OPTIONAL
+} CDKey;
+
+typedef struct CDEvent
+{
+    CDEventType type;
+    CDSection section;
+    CDKey key;
+    char flag;
+    int intval;
+    int transient;
+    unsigned long line;
+    time_t date;
+    CDStr str;
+    CDStr str2;
+    const CDStr *cells;
+    size_t ncells;
+} CDEvent;
+
+typedef int (*CDEventHandler)(void *ctx, const CDEvent *ev);
+
+DECLEXPORT int CliDoc_parse(const char *buf, size_t len,
+    CDEventHandler handler, void *ctx) ATTR_NONNULL((3));
+
+DECLEXPORT CliDoc *CliDoc_create(FILE *doc);
+DECLEXPORT CliDoc *CliDoc_createFromBuffer(const char *buf, size_t len);
+DECLEXPORT CliDoc *CliDoc_createFromImage(void *buf, size_t len)
+    ATTR_NONNULL((1));
+DECLEXPORT int CliDoc_isImage(const void *buf, size_t len)
+    ATTR_NONNULL((1)) ATTR_PURE;
+DECLEXPORT void CliDoc_writeImage(const CliDoc *self, Sink *out)
+    CMETHOD ATTR_NONNULL((2));
+DECLEXPORT ContentType CliDoc_type(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CliDoc_parent(const CliDoc *self) CMETHOD ATTR_PURE;
+
+DECLEXPORT const CliDoc *CDRoot_name(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_version(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_comment(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_author(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_license(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_description(const CliDoc *self)
+    CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_date(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_www(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nflags(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_flag(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nargs(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_arg(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nfiles(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_file(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nrefs(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_ref(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nvars(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_var(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_nsigs(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDRoot_sig(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
+DECLEXPORT int CDRoot_defgroup(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDRoot_ngroups(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CDSynItem *CDRoot_group(const CliDoc *self, size_t i,
+    size_t *n) CMETHOD ATTR_NONNULL((3));
+DECLEXPORT const char *CDRoot_synflags(const CliDoc *self) CMETHOD ATTR_PURE;
+
+DECLEXPORT const CliDoc *CDArg_description(const CliDoc *self)
+    CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDArg_default(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDArg_min(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDArg_max(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const char *CDArg_argn(const CliDoc *self, size_t *len) CMETHOD;
+DECLEXPORT int CDArg_group(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT int CDArg_optional(const CliDoc *self) CMETHOD ATTR_PURE;
 
 #define CDFlag_description(self) CDArg_description(self)
 #define CDFlag_default(self) CDArg_default(self)
 #define CDFlag_min(self) CDArg_min(self)
 #define CDFlag_max(self) CDArg_max(self)
-#define CDFlag_arg(self) CDArg_arg(self)
+#define CDFlag_argn(self, len) CDArg_argn(self, len)
 #define CDFlag_group(self) CDArg_group(self)
 #define CDFlag_optional(self) CDArg_optional(self)
-char CDFlag_flag(const CliDoc *self) CMETHOD ATTR_PURE;
-
-size_t CDList_length(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDList_entry(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
+DECLEXPORT char CDFlag_flag(const CliDoc *self) CMETHOD ATTR_PURE;
 
-size_t CDDict_length(const CliDoc *self) CMETHOD ATTR_PURE;
-const char *CDDict_key(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
-const CliDoc *CDDict_val(const CliDoc *self, size_t i) CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDList_length(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const CliDoc *CDList_entry(const CliDoc *self, size_t i)
+    CMETHOD ATTR_PURE;
 
-size_t CDTable_width(const CliDoc *self) CMETHOD ATTR_PURE;
-size_t CDTable_height(const CliDoc *self) CMETHOD ATTR_PURE;
-const char *CDTable_cell(const CliDoc *self, size_t x, size_t y)
+DECLEXPORT size_t CDDict_length(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const char *CDDict_keyn(const CliDoc *self, size_t i, size_t *len)
+    CMETHOD;
+DECLEXPORT const CDSpan *CDDict_keyspans(const CliDoc *self, size_t i,
+    size_t *n) CMETHOD ATTR_NONNULL((3));
+DECLEXPORT const CliDoc *CDDict_val(const CliDoc *self, size_t i)
     CMETHOD ATTR_PURE;
 
-const char *CDNamed_name(const CliDoc *self) CMETHOD ATTR_PURE;
-const CliDoc *CDNamed_description(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDTable_width(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT size_t CDTable_height(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const char *CDTable_celln(const CliDoc *self, size_t x, size_t y,
+    size_t *len) CMETHOD;
+DECLEXPORT const CDSpan *CDTable_cellspans(const CliDoc *self, size_t x,
+    size_t y, size_t *n) CMETHOD ATTR_NONNULL((4));
+
+DECLEXPORT const char *CDNamed_namen(const CliDoc *self, size_t *len) CMETHOD;
+DECLEXPORT const CliDoc *CDNamed_description(const CliDoc *self)
+    CMETHOD ATTR_PURE;
 
-const char *CDText_str(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const char *CDText_strn(const CliDoc *self, size_t *len) CMETHOD;
+DECLEXPORT const CDSpan *CDText_spans(const CliDoc *self, size_t *n)
+    CMETHOD ATTR_NONNULL((2));
 
-time_t CDDate_date(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT time_t CDDate_date(const CliDoc *self) CMETHOD ATTR_PURE;
 
-const char *CDMRef_name(const CliDoc *self) CMETHOD ATTR_PURE;
-const char *CDMRef_section(const CliDoc *self) CMETHOD ATTR_PURE;
+DECLEXPORT const char *CDMRef_namen(const CliDoc *self, size_t *len) CMETHOD;
+DECLEXPORT const char *CDMRef_sectionn(const CliDoc *self, size_t *len) CMETHOD;
 
-void CliDoc_destroy(CliDoc *self);
+DECLEXPORT void CliDoc_destroy(CliDoc *self);
 
 #endif
@@ -0,0 +1,313 @@
+#include "daemon.h"
+
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAXREQUEST (1024 * 1024)
+#define NFDS 4
+#define RECVTIMEOUT 10
+
+typedef struct Header
+{
+    uint32_t magic;
+    uint32_t mask;
+    uint32_t argc;
+    uint32_t len;
+} Header;
+
+static const uint32_t magic = 0x63646d01U;
+
+static int setaddr(struct sockaddr_un *addr, const char *path)
+{
+    size_t len = strlen(path);
+    if (len >= sizeof addr->sun_path)
+    {
+	fprintf(stderr, "Socket path too long: %s\n", path);
+	return -1;
+    }
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, len + 1);
+    return 0;
+}
+
+static int readall(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len)
+    {
+	ssize_t rc = read(fd, p, len);
+	if (rc < 0 && errno == EINTR) continue;
+	if (rc <= 0) return -1;
+	p += rc;
+	len -= rc;
+    }
+    return 0;
+}
+
+static int writeall(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len)
+    {
+	ssize_t rc = write(fd, p, len);
+	if (rc < 0 && errno == EINTR) continue;
+	if (rc < 0) return -1;
+	p += rc;
+	len -= rc;
+    }
+    return 0;
+}
+
+static int listensocket(const char *path)
+{
+    struct sockaddr_un addr;
+    if (setaddr(&addr, path) < 0) return -1;
+    struct stat st;
+    if (lstat(path, &st) == 0 && !S_ISSOCK(st.st_mode))
+    {
+	fprintf(stderr, "%s: not a socket\n", path);
+	return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) goto error;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0)
+    {
+	fprintf(stderr, "%s: daemon already running\n", path);
+	close(fd);
+	return -1;
+    }
+    if (errno == ECONNREFUSED && lstat(path, &st) == 0
+	    && S_ISSOCK(st.st_mode)) unlink(path);
+    close(fd);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) goto error;
+    mode_t mask = umask(077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+    umask(mask);
+    if (rc < 0 || listen(fd, SOMAXCONN) < 0) goto error;
+    return fd;
+
+error:
+    diagerror(path);
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static char **recvrequest(int conn, Header *hdr, int *fds)
+{
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(NFDS * sizeof (int))];
+    } ctl;
+    struct iovec iov = { hdr, sizeof *hdr };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof ctl.buf;
+    ssize_t rc;
+    do rc = recvmsg(conn, &msg, MSG_WAITALL);
+    while (rc < 0 && errno == EINTR);
+
+    int nfds = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); rc > 0 && c;
+	    c = CMSG_NXTHDR(&msg, c))
+    {
+	if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+	{
+	    continue;
+	}
+	nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+	if (nfds > NFDS) nfds = NFDS;
+	memcpy(fds, CMSG_DATA(c), nfds * sizeof (int));
+	break;
+    }
+    if (rc != (ssize_t)sizeof *hdr || nfds != NFDS
+	    || (msg.msg_flags & MSG_CTRUNC) || hdr->magic != magic
+	    || !hdr->argc || hdr->argc > hdr->len
+	    || hdr->len > MAXREQUEST) goto error;
+
+    char *args = xmalloc(hdr->len + 1);
+    if (readall(conn, args, hdr->len) < 0)
+    {
+	free(args);
+	goto error;
+    }
+    args[hdr->len] = 0;
+    char **argv = xmalloc((hdr->argc + 1) * sizeof *argv);
+    char *p = args;
+    for (uint32_t i = 0; i < hdr->argc; ++i)
+    {
+	if (p >= args + hdr->len)
+	{
+	    free(argv);
+	    free(args);
+	    goto error;
+	}
+	argv[i] = p;
+	p += strlen(p) + 1;
+    }
+    argv[hdr->argc] = 0;
+    return argv;
+
+error:
+    for (int i = 0; i < nfds; ++i) close(fds[i]);
+    return 0;
+}
+
+static void serve(int conn, RequestHandler handler, const int *saved)
+{
+    Header hdr;
+    int fds[NFDS];
+    char **argv = recvrequest(conn, &hdr, fds);
+    if (!argv) return;
+
+    for (int i = 1; i < NFDS; ++i) dup2(fds[i], i - 1);
+    int rc = fchdir(fds[0]);
+    for (int i = 0; i < NFDS; ++i) close(fds[i]);
+    clearerr(stdin);
+    mode_t mask = umask(hdr.mask & 0777);
+    if (rc < 0)
+    {
+	diagerror("chdir");
+	rc = EXIT_FAILURE;
+    }
+    else rc = handler(hdr.argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+    umask(mask);
+    if (fchdir(saved[0]) < 0) diagerror("chdir");
+    for (int i = 1; i < NFDS; ++i) dup2(saved[i], i - 1);
+    clearerr(stdin);
+
+    int32_t result = rc;
+    writeall(conn, &result, sizeof result);
+    free(*argv);
+    free(argv);
+}
+
+int runDaemon(const char *path, RequestHandler handler)
+{
+    int sock = listensocket(path);
+    if (sock < 0) return EXIT_FAILURE;
+    signal(SIGPIPE, SIG_IGN);
+    int saved[NFDS] = { open(".", O_RDONLY), dup(0), dup(1), dup(2) };
+    for (int i = 0; i < NFDS; ++i)
+    {
+	if (saved[i] < 0)
+	{
+	    diagerror(path);
+	    goto done;
+	}
+	fcntl(saved[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    for (;;)
+    {
+	int conn = accept(sock, 0, 0);
+	if (conn < 0)
+	{
+	    if (errno == EINTR || errno == ECONNABORTED) continue;
+	    diagerror(path);
+	    break;
+	}
+	struct timeval timeout = { RECVTIMEOUT, 0 };
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	serve(conn, handler, saved);
+	close(conn);
+    }
+
+done:
+    for (int i = 0; i < NFDS; ++i)
+    {
+	if (saved[i] >= 0) close(saved[i]);
+    }
+    close(sock);
+    unlink(path);
+    return EXIT_FAILURE;
+}
+
+int runClient(const char *path, int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    if (setaddr(&addr, path) < 0) return EXIT_FAILURE;
+
+    Header hdr = { magic, 0, argc, 0 };
+    for (int i = 0; i < argc; ++i) hdr.len += strlen(argv[i]) + 1;
+    if (hdr.len > MAXREQUEST)
+    {
+	fputs("Request too large\n", stderr);
+	return EXIT_FAILURE;
+    }
+    char *args = xmalloc(hdr.len);
+    char *p = args;
+    for (int i = 0; i < argc; ++i)
+    {
+	size_t len = strlen(argv[i]) + 1;
+	memcpy(p, argv[i], len);
+	p += len;
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    hdr.mask = mask;
+
+    int rc = EXIT_FAILURE;
+    int fds[NFDS] = { open(".", O_RDONLY), 0, 1, 2 };
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fds[0] < 0 || fd < 0
+	    || connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0)
+    {
+	diagerror(path);
+	goto done;
+    }
+
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(NFDS * sizeof (int))];
+    } ctl;
+    memset(&ctl, 0, sizeof ctl);
+    struct iovec iov = { &hdr, sizeof hdr };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof ctl.buf;
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(NFDS * sizeof (int));
+    memcpy(CMSG_DATA(c), fds, NFDS * sizeof (int));
+
+    ssize_t sent;
+    do sent = sendmsg(fd, &msg, 0);
+    while (sent < 0 && errno == EINTR);
+    int32_t result;
+    if (sent != (ssize_t)sizeof hdr || writeall(fd, args, hdr.len) < 0
+	    || readall(fd, &result, sizeof result) < 0)
+    {
+	fprintf(stderr, "%s: lost connection to daemon\n", path);
+	goto done;
+    }
+    rc = result;
+
+done:
+    if (fd >= 0) close(fd);
+    if (fds[0] >= 0) close(fds[0]);
+    free(args);
+    return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef MKCLIDOC_DAEMON_H
+#define MKCLIDOC_DAEMON_H
+
+#include "decl.h"
+
+typedef int (*RequestHandler)(int argc, char **argv);
+
+int runDaemon(const char *path, RequestHandler handler) ATTR_NONNULL((1, 2));
+int runClient(const char *path, int argc, char **argv) ATTR_NONNULL((1, 3));
+
+#endif
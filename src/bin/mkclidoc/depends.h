@@ -0,0 +1,9 @@
+#ifndef MKCLIDOC_DEPENDS_H
+#define MKCLIDOC_DEPENDS_H
+
+#include "decl.h"
+
+char *dependsHtml(const char *args) ATTR_MALLOC ATTR_NONNULL((1));
+char *dependsSh(const char *args) ATTR_MALLOC ATTR_NONNULL((1));
+
+#endif
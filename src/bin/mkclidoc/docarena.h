@@ -0,0 +1,14 @@
+#ifndef MKCLIDOC_DOCARENA_H
+#define MKCLIDOC_DOCARENA_H
+
+#include "clidoc.h"
+
+C_CLASS_DECL(Arena);
+
+CliDoc *CliDoc_createInArena(FILE *doc, Arena *arena) ATTR_NONNULL((2));
+CliDoc *CliDoc_createFromBufferInArena(const char *buf, size_t len,
+    Arena *arena) ATTR_NONNULL((3));
+int CliDoc_parseInArena(const char *buf, size_t len,
+    CDEventHandler handler, void *ctx, Arena *arena) ATTR_NONNULL((5));
+
+#endif
@@ -0,0 +1,236 @@
+#include "filecache.h"
+
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct CachedFile
+{
+    FileCache *cache;
+    FileUnloader unload;
+    CachedFile *newer;
+    CachedFile *older;
+    char *path;
+    size_t hash;
+    size_t cost;
+    void *obj;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    size_t refs;
+};
+
+struct FileCache
+{
+    FileLoader load;
+    FileUnloader unload;
+    CachedFile **slots;
+    CachedFile *newest;
+    CachedFile *oldest;
+    size_t mask;
+    size_t n;
+    size_t size;
+    size_t maxsize;
+    pthread_mutex_t lock;
+};
+
+static size_t strhash(const char *str)
+{
+    size_t h = 2166136261U;
+    for (; *str; ++str) h = (h ^ (unsigned char)*str) * 16777619U;
+    return h;
+}
+
+static int uptodate(const CachedFile *e, const struct stat *st)
+{
+    return e->dev == st->st_dev && e->ino == st->st_ino
+	&& e->size == st->st_size
+	&& e->mtime.tv_sec == st->st_mtim.tv_sec
+	&& e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void unref(CachedFile *e)
+{
+    if (--e->refs) return;
+    e->unload(e->obj);
+    free(e->path);
+    free(e);
+}
+
+static CachedFile **findslot(CachedFile **slots, size_t mask,
+	const char *path, size_t hash)
+{
+    size_t h = hash & mask;
+    while (slots[h] && strcmp(slots[h]->path, path)) h = (h + 1) & mask;
+    return slots + h;
+}
+
+static void lrupush(FileCache *self, CachedFile *e)
+{
+    e->newer = 0;
+    e->older = self->newest;
+    if (self->newest) self->newest->newer = e;
+    else self->oldest = e;
+    self->newest = e;
+    self->size += e->cost;
+}
+
+static void lruremove(FileCache *self, CachedFile *e)
+{
+    if (e->newer) e->newer->older = e->older;
+    else self->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else self->oldest = e->newer;
+    self->size -= e->cost;
+}
+
+static void evict(FileCache *self, CachedFile *e)
+{
+    size_t i = findslot(self->slots, self->mask, e->path, e->hash)
+	- self->slots;
+    self->slots[i] = 0;
+    for (size_t j = (i + 1) & self->mask; self->slots[j];
+	    j = (j + 1) & self->mask)
+    {
+	CachedFile *m = self->slots[j];
+	if (((j - m->hash) & self->mask) >= ((j - i) & self->mask))
+	{
+	    self->slots[i] = m;
+	    self->slots[j] = 0;
+	    i = j;
+	}
+    }
+    --self->n;
+    lruremove(self, e);
+    unref(e);
+}
+
+static void grow(FileCache *self)
+{
+    size_t size = 2 * (self->mask + 1);
+    CachedFile **slots = xmalloc(size * sizeof *slots);
+    memset(slots, 0, size * sizeof *slots);
+    for (size_t i = 0; i <= self->mask; ++i)
+    {
+	CachedFile *e = self->slots[i];
+	if (e) *findslot(slots, size - 1, e->path, e->hash) = e;
+    }
+    free(self->slots);
+    self->slots = slots;
+    self->mask = size - 1;
+}
+
+FileCache *FileCache_create(size_t maxsize, FileLoader load,
+	FileUnloader unload)
+{
+    FileCache *self = xmalloc(sizeof *self);
+    self->load = load;
+    self->unload = unload;
+    self->mask = 63;
+    self->slots = xmalloc((self->mask + 1) * sizeof *self->slots);
+    memset(self->slots, 0, (self->mask + 1) * sizeof *self->slots);
+    self->newest = 0;
+    self->oldest = 0;
+    self->n = 0;
+    self->size = 0;
+    self->maxsize = maxsize;
+    pthread_mutex_init(&self->lock, 0);
+    return self;
+}
+
+CachedFile *FileCache_get(FileCache *self, const char *path, int fd,
+	const struct stat *st)
+{
+    size_t hash = strhash(path);
+    pthread_mutex_lock(&self->lock);
+    CachedFile *e = *findslot(self->slots, self->mask, path, hash);
+    if (e && uptodate(e, st))
+    {
+	++e->refs;
+	lruremove(self, e);
+	lrupush(self, e);
+    }
+    else e = 0;
+    pthread_mutex_unlock(&self->lock);
+    if (e) return e;
+
+    e = CachedFile_load(self->load, self->unload, path, fd, st);
+    if (!e || !S_ISREG(st->st_mode) || e->cost > self->maxsize) return e;
+    e->cache = self;
+    e->hash = hash;
+    e->refs = 2;
+
+    pthread_mutex_lock(&self->lock);
+    CachedFile **slot = findslot(self->slots, self->mask, path, hash);
+    if (*slot)
+    {
+	lruremove(self, *slot);
+	unref(*slot);
+    }
+    else if (2 * ++self->n > self->mask)
+    {
+	grow(self);
+	slot = findslot(self->slots, self->mask, path, hash);
+    }
+    *slot = e;
+    lrupush(self, e);
+    while (self->size > self->maxsize) evict(self, self->oldest);
+    pthread_mutex_unlock(&self->lock);
+    return e;
+}
+
+void FileCache_destroy(FileCache *self)
+{
+    if (!self) return;
+    for (size_t i = 0; i <= self->mask; ++i)
+    {
+	if (self->slots[i]) unref(self->slots[i]);
+    }
+    free(self->slots);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+CachedFile *CachedFile_load(FileLoader load, FileUnloader unload,
+	const char *path, int fd, const struct stat *st)
+{
+    void *obj = load(path, fd, st);
+    if (!obj) return 0;
+    CachedFile *self = xmalloc(sizeof *self);
+    self->cache = 0;
+    self->unload = unload;
+    self->newer = 0;
+    self->older = 0;
+    self->path = copystr(path);
+    self->hash = 0;
+    self->cost = S_ISREG(st->st_mode) ? (size_t)st->st_size : 0;
+    self->obj = obj;
+    self->dev = st->st_dev;
+    self->ino = st->st_ino;
+    self->size = st->st_size;
+    self->mtime = st->st_mtim;
+    self->refs = 1;
+    return self;
+}
+
+void *CachedFile_obj(const CachedFile *self)
+{
+    return self->obj;
+}
+
+void CachedFile_release(CachedFile *self)
+{
+    if (!self) return;
+    FileCache *cache = self->cache;
+    if (!cache)
+    {
+	unref(self);
+	return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    unref(self);
+    pthread_mutex_unlock(&cache->lock);
+}
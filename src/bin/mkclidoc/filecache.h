@@ -0,0 +1,28 @@
+#ifndef MKCLIDOC_FILECACHE_H
+#define MKCLIDOC_FILECACHE_H
+
+#include "decl.h"
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+C_CLASS_DECL(CachedFile);
+C_CLASS_DECL(FileCache);
+
+typedef void *(*FileLoader)(const char *path, int fd, const struct stat *st);
+typedef void (*FileUnloader)(void *obj);
+
+FileCache *FileCache_create(size_t maxsize, FileLoader load,
+	FileUnloader unload) ATTR_RETNONNULL ATTR_NONNULL((2))
+    ATTR_NONNULL((3));
+CachedFile *FileCache_get(FileCache *self, const char *path, int fd,
+	const struct stat *st) CMETHOD ATTR_NONNULL((2)) ATTR_NONNULL((4));
+void FileCache_destroy(FileCache *self);
+
+CachedFile *CachedFile_load(FileLoader load, FileUnloader unload,
+	const char *path, int fd, const struct stat *st)
+    ATTR_NONNULL((1)) ATTR_NONNULL((2)) ATTR_NONNULL((3)) ATTR_NONNULL((5));
+void *CachedFile_obj(const CachedFile *self) CMETHOD ATTR_PURE;
+void CachedFile_release(CachedFile *self);
+
+#endif
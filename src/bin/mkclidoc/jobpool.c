@@ -0,0 +1,203 @@
+#include "jobpool.h"
+
+#include "jobserver.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct Job
+{
+    JobFunc func;
+    void *arg;
+} Job;
+
+typedef struct Worker
+{
+    JobPool *pool;
+    Job *jobs;
+    size_t head;
+    size_t tail;
+    size_t capa;
+    pthread_t thread;
+} Worker;
+
+struct JobPool
+{
+    Worker *workers;
+    Jobserver *jobserver;
+    int wake[2];
+    unsigned nworkers;
+    unsigned next;
+    size_t outstanding;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static _Thread_local Worker *current;
+
+static void push(Worker *w, JobFunc func, void *arg)
+{
+    if (w->head == w->tail) w->head = w->tail = 0;
+    if (w->tail == w->capa)
+    {
+	w->capa = w->capa ? 2 * w->capa : 64;
+	w->jobs = xrealloc(w->jobs, w->capa * sizeof *w->jobs);
+    }
+    w->jobs[w->tail].func = func;
+    w->jobs[w->tail++].arg = arg;
+}
+
+static int take(JobPool *self, Worker *w, Job *job)
+{
+    if (w->head < w->tail)
+    {
+	*job = w->jobs[--w->tail];
+	return 1;
+    }
+    unsigned idx = w - self->workers;
+    for (unsigned i = 1; i < self->nworkers; ++i)
+    {
+	Worker *victim = self->workers + (idx + i) % self->nworkers;
+	if (victim->head < victim->tail)
+	{
+	    *job = victim->jobs[victim->head++];
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static int queued(const JobPool *self)
+{
+    for (unsigned i = 0; i < self->nworkers; ++i)
+    {
+	if (self->workers[i].head < self->workers[i].tail) return 1;
+    }
+    return 0;
+}
+
+static void wakeall(JobPool *self)
+{
+    while (write(self->wake[1], "", 1) < 0)
+    {
+	if (errno != EINTR) break;
+    }
+}
+
+static void *work(void *arg)
+{
+    Worker *w = arg;
+    JobPool *self = w->pool;
+    current = w;
+    int needtoken = self->jobserver && w != self->workers;
+    int token = -1;
+    Job job;
+    pthread_mutex_lock(&self->lock);
+    while (self->outstanding)
+    {
+	if (needtoken && token < 0)
+	{
+	    if (!queued(self))
+	    {
+		pthread_cond_wait(&self->cond, &self->lock);
+		continue;
+	    }
+	    pthread_mutex_unlock(&self->lock);
+	    token = Jobserver_acquire(self->jobserver, self->wake[0]);
+	    pthread_mutex_lock(&self->lock);
+	    if (token < -1) break;
+	    continue;
+	}
+	if (!take(self, w, &job))
+	{
+	    if (token >= 0)
+	    {
+		Jobserver_release(self->jobserver, token);
+		token = -1;
+	    }
+	    pthread_cond_wait(&self->cond, &self->lock);
+	    continue;
+	}
+	pthread_mutex_unlock(&self->lock);
+	job.func(self, job.arg);
+	pthread_mutex_lock(&self->lock);
+	if (!--self->outstanding)
+	{
+	    pthread_cond_broadcast(&self->cond);
+	    if (self->jobserver) wakeall(self);
+	}
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (token >= 0) Jobserver_release(self->jobserver, token);
+    current = 0;
+    return 0;
+}
+
+JobPool *JobPool_create(unsigned nthreads, Jobserver *jobserver)
+{
+    JobPool *self = xmalloc(sizeof *self);
+    if (!nthreads) nthreads = 1;
+    self->workers = xmalloc(nthreads * sizeof *self->workers);
+    for (unsigned i = 0; i < nthreads; ++i)
+    {
+	self->workers[i].pool = self;
+	self->workers[i].jobs = 0;
+	self->workers[i].head = 0;
+	self->workers[i].tail = 0;
+	self->workers[i].capa = 0;
+    }
+    self->jobserver = jobserver;
+    if (jobserver && pipe(self->wake) < 0) self->jobserver = 0;
+    self->nworkers = nthreads;
+    self->next = 0;
+    self->outstanding = 0;
+    pthread_mutex_init(&self->lock, 0);
+    pthread_cond_init(&self->cond, 0);
+    return self;
+}
+
+void JobPool_add(JobPool *self, JobFunc func, void *arg)
+{
+    pthread_mutex_lock(&self->lock);
+    Worker *w = current && current->pool == self ? current
+	: self->workers + self->next++ % self->nworkers;
+    push(w, func, arg);
+    ++self->outstanding;
+    if (self->jobserver) pthread_cond_broadcast(&self->cond);
+    else pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+}
+
+void JobPool_run(JobPool *self)
+{
+    unsigned started = 1;
+    while (started < self->nworkers && !pthread_create(
+		&self->workers[started].thread, 0, work,
+		self->workers + started)) ++started;
+    work(self->workers);
+    for (unsigned i = 1; i < started; ++i)
+    {
+	pthread_join(self->workers[i].thread, 0);
+    }
+}
+
+void JobPool_destroy(JobPool *self)
+{
+    if (!self) return;
+    for (unsigned i = 0; i < self->nworkers; ++i)
+    {
+	free(self->workers[i].jobs);
+    }
+    free(self->workers);
+    if (self->jobserver)
+    {
+	close(self->wake[0]);
+	close(self->wake[1]);
+    }
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->cond);
+    free(self);
+}
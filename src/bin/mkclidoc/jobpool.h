@@ -0,0 +1,18 @@
+#ifndef MKCLIDOC_JOBPOOL_H
+#define MKCLIDOC_JOBPOOL_H
+
+#include "decl.h"
+
+C_CLASS_DECL(JobPool);
+C_CLASS_DECL(Jobserver);
+
+typedef void (*JobFunc)(JobPool *pool, void *arg);
+
+JobPool *JobPool_create(unsigned nthreads, Jobserver *jobserver)
+    ATTR_RETNONNULL;
+void JobPool_add(JobPool *self, JobFunc func, void *arg)
+    CMETHOD ATTR_NONNULL((2));
+void JobPool_run(JobPool *self) CMETHOD;
+void JobPool_destroy(JobPool *self);
+
+#endif
@@ -0,0 +1,141 @@
+#include "jobserver.h"
+
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct Jobserver
+{
+    int rfd;
+    int wfd;
+};
+
+static const char *const authopts[] = {
+    "--jobserver-auth=",
+    "--jobserver-fds="
+};
+
+static const char *findauth(const char *flags, size_t *len)
+{
+    const char *auth = 0;
+    while (*flags)
+    {
+	while (*flags == ' ') ++flags;
+	size_t wlen = strcspn(flags, " ");
+	if (wlen == 2 && !strncmp(flags, "--", 2)) break;
+	for (size_t i = 0; i < sizeof authopts / sizeof *authopts; ++i)
+	{
+	    size_t olen = strlen(authopts[i]);
+	    if (wlen > olen && !strncmp(flags, authopts[i], olen))
+	    {
+		auth = flags + olen;
+		*len = wlen - olen;
+	    }
+	}
+	flags += wlen;
+    }
+    return auth;
+}
+
+static int openfifo(const char *path, size_t len, int *rfd, int *wfd)
+{
+    char *name = xmalloc(len + 1);
+    memcpy(name, path, len);
+    name[len] = 0;
+    *rfd = open(name, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    *wfd = *rfd < 0 ? -1 : open(name, O_WRONLY|O_CLOEXEC);
+    free(name);
+    return *wfd < 0 ? -1 : 0;
+}
+
+static int openpipe(const char *fds, int *rfd, int *wfd)
+{
+    char *endp;
+    long r = strtol(fds, &endp, 10);
+    if (endp == fds || *endp != ',') return -1;
+    fds = endp + 1;
+    long w = strtol(fds, &endp, 10);
+    if (endp == fds || (*endp && *endp != ' ')) return -1;
+    if (r < 0 || w < 0 || fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0)
+    {
+	return -1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof path, "/proc/self/fd/%ld", r);
+    if ((*rfd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0) return -1;
+    *wfd = fcntl(w, F_DUPFD_CLOEXEC, 0);
+    return *wfd < 0 ? -1 : 0;
+}
+
+Jobserver *Jobserver_create(void)
+{
+    const char *flags = getenv("MAKEFLAGS");
+    if (!flags) return 0;
+    size_t len;
+    const char *auth = findauth(flags, &len);
+    if (!auth) return 0;
+
+    int rfd = -1;
+    int wfd = -1;
+    int rc = len > 5 && !strncmp(auth, "fifo:", 5)
+	? openfifo(auth + 5, len - 5, &rfd, &wfd)
+	: openpipe(auth, &rfd, &wfd);
+    if (rc < 0)
+    {
+	if (rfd >= 0) close(rfd);
+	return 0;
+    }
+    Jobserver *self = xmalloc(sizeof *self);
+    self->rfd = rfd;
+    self->wfd = wfd;
+    return self;
+}
+
+int Jobserver_acquire(Jobserver *self, int wakefd)
+{
+    struct pollfd fds[2] = {
+	{ .fd = self->rfd, .events = POLLIN },
+	{ .fd = wakefd, .events = POLLIN }
+    };
+    for (;;)
+    {
+	if (poll(fds, 2, -1) < 0)
+	{
+	    if (errno == EINTR) continue;
+	    return -2;
+	}
+	if (fds[1].revents) return -1;
+	if (!fds[0].revents) continue;
+	unsigned char token;
+	ssize_t rc = read(self->rfd, &token, 1);
+	if (rc == 1) return token;
+	if (!rc || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+	    return -2;
+	}
+    }
+}
+
+void Jobserver_release(Jobserver *self, int token)
+{
+    unsigned char c = token;
+    while (write(self->wfd, &c, 1) < 0)
+    {
+	if (errno != EINTR) break;
+    }
+}
+
+void Jobserver_destroy(Jobserver *self)
+{
+    if (!self) return;
+    close(self->rfd);
+    close(self->wfd);
+    free(self);
+}
@@ -0,0 +1,13 @@
+#ifndef MKCLIDOC_JOBSERVER_H
+#define MKCLIDOC_JOBSERVER_H
+
+#include "decl.h"
+
+C_CLASS_DECL(Jobserver);
+
+Jobserver *Jobserver_create(void);
+int Jobserver_acquire(Jobserver *self, int wakefd) CMETHOD;
+void Jobserver_release(Jobserver *self, int token) CMETHOD;
+void Jobserver_destroy(Jobserver *self);
+
+#endif
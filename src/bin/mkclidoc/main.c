@@ -1,37 +1,962 @@
+#include "arena.h"
 #include "clidoc.h"
+#include "daemon.h"
+#include "depends.h"
+#include "docarena.h"
+#include "filecache.h"
+#include "jobpool.h"
+#include "jobserver.h"
 #include "manwriter.h"
+#include "render.h"
+#include "sink.h"
 #include "srcwriter.h"
+#include "util.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-typedef int (*writer)(FILE *out, const CliDoc *root, const char *args);
+#define DOCCACHESZ (64 * 1024 * 1024)
+#define RESCACHESZ (16 * 1024 * 1024)
+
+typedef char *(*depender)(const char *args);
 
 static const struct {
     const char *name;
-    writer writefunc;
-} writers[] = {
-    { "cpp", writeCpp },
-    { "html", writeHtml },
-    { "man", writeMan },
-    { "mdoc", writeMdoc },
-    { "sh", writeSh }
+    depender dependfunc;
+} dependers[] = {
+    { "html", dependsHtml },
+    { "sh", dependsSh }
 };
 
-static writer currentWriter = writeMan;
-char *writerArgs = 0;
-const char *infilename = 0;
-const char *outfilename = 0;
-static FILE *infile = 0;
-static FILE *outfile = 0;
+typedef struct Output
+{
+    CliDocWriter writefunc;
+    depender dependfunc;
+    char *args;
+    char *depends;
+    const char *filename;
+    Sink *sink;
+    const CliDoc *root;
+    pthread_t thread;
+    int hasformat;
+    int threaded;
+    int rc;
+} Output;
 
-int main(int argc, char **argv)
+typedef struct Input
+{
+    const char *filename;
+    Output *outputs;
+    size_t noutputs;
+    size_t line;
+    Sink *deps;
+} Input;
+
+typedef struct LoadedDoc
+{
+    void *map;
+    size_t mapsz;
+    Arena *arena;
+    CliDoc *doc;
+} LoadedDoc;
+
+typedef struct Diag
+{
+    char *buf;
+    size_t len;
+} Diag;
+
+C_CLASS_DECL(Task);
+
+typedef struct Render
+{
+    Task *task;
+    size_t index;
+} Render;
+
+struct Task
+{
+    Input run;
+    const Input *input;
+    FILE *infile;
+    void *map;
+    size_t mapsz;
+    CliDoc *doc;
+    CachedFile *cached;
+    Arena *arena;
+    Diag *diags;
+    Render *renders;
+    size_t pending;
+    int rc;
+    int done;
+};
+
+static Output *outputs = 0;
+static size_t noutputs = 0;
+static const char *infilename = 0;
+static const char *manifestname = 0;
+static int multidoc = 0;
+static int parallel = 0;
+static unsigned jobs = 0;
+static Jobserver *jobserver = 0;
+static FileCache *doccache = 0;
+static CliDocCache *rescache = 0;
+static Task *tasks = 0;
+static size_t ntasks = 0;
+static size_t nextreport = 0;
+static int failed = 0;
+static pthread_mutex_t tasklock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reportlock = PTHREAD_MUTEX_INITIALIZER;
+static mode_t filemode = 0666;
+static const char *depfilename = 0;
+static Sink *deps = 0;
+
+static const char *const makeesc[256] = {
+    ['\t'] = "\\\t",
+    [' '] = "\\ ",
+    ['#'] = "\\#",
+    ['$'] = "$$"
+};
+
+static int setformat(Output *o, char *arg)
+{
+    o->dependfunc = 0;
+    o->args = strchr(arg, ',');
+    if (o->args)
+    {
+	*o->args++ = 0;
+	if (!*o->args) o->args = 0;
+    }
+    if (!(o->writefunc = CliDoc_writer(arg))) return -1;
+    for (unsigned i = 0; i < sizeof dependers / sizeof *dependers; ++i)
+    {
+	if (!strcmp(arg, dependers[i].name))
+	{
+	    o->dependfunc = dependers[i].dependfunc;
+	}
+    }
+    return 0;
+}
+
+static Output *nextoutput(int forfile)
+{
+    Output *o = outputs + noutputs - 1;
+    if (!noutputs || (forfile ? !!o->filename : o->hasformat))
+    {
+	o = outputs + noutputs++;
+	memset(o, 0, sizeof *o);
+	o->writefunc = writeMan;
+    }
+    return o;
+}
+
+static size_t doclen(const char *doc, const char *end, size_t *seplen)
+{
+    const char *line = doc;
+    while (line < end)
+    {
+	const char *eol = memchr(line, '\n', end - line);
+	if (!eol) eol = end;
+	const char *nul = memchr(line, 0, eol - line);
+	if (nul)
+	{
+	    *seplen = 1;
+	    return nul - doc;
+	}
+	if (eol - line == 3 && !memcmp(line, "---", 3))
+	{
+	    *seplen = eol < end ? 4 : 3;
+	    return line - doc;
+	}
+	line = eol < end ? eol + 1 : end;
+    }
+    *seplen = 0;
+    return end - doc;
+}
+
+static int isemptydoc(const char *doc, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+	if (!strchr(" \t\r\n", doc[i])) return 0;
+    }
+    return 1;
+}
+
+static char *docfilename(const char *pattern, const CliDoc *doc)
+{
+    const CliDoc *node = CDRoot_name(doc);
+    if (!node || CliDoc_type(node) != CT_TEXT)
+    {
+	fputs("Cannot name output file: missing name\n", diagout());
+	return 0;
+    }
+    size_t namelen;
+    const char *name = CDText_strn(node, &namelen);
+    if ((namelen == 1 && *name == '.')
+	    || (namelen == 2 && !memcmp(name, "..", 2))
+	    || memchr(name, '/', namelen))
+    {
+	fprintf(diagout(), "Cannot name output file: invalid name `%.*s'\n",
+		(int)namelen, name);
+	return 0;
+    }
+    size_t len = 0;
+    char *filename = xmalloc(strlen(pattern) * (namelen + 1) + 1);
+    for (const char *p = pattern; *p; ++p)
+    {
+	if (*p == '%' && p[1] == 'n')
+	{
+	    memcpy(filename + len, name, namelen);
+	    len += namelen;
+	    ++p;
+	}
+	else
+	{
+	    if (*p == '%' && p[1] == '%') ++p;
+	    filename[len++] = *p;
+	}
+    }
+    filename[len] = 0;
+    return filename;
+}
+
+static int haspattern(const char *pattern)
+{
+    for (const char *p = pattern; *p; ++p)
+    {
+	if (*p == '%' && p[1] == 'n') return 1;
+	if (*p == '%' && p[1] == '%') ++p;
+    }
+    return 0;
+}
+
+static void writedeps(const Input *in, const char *target, const Output *o)
+{
+    Sink *out = in->deps;
+    Sink_escape(out, target, strlen(target), makeesc);
+    Sink_putc(out, ':');
+    if (in->filename)
+    {
+	Sink_putc(out, ' ');
+	Sink_escape(out, in->filename, strlen(in->filename), makeesc);
+    }
+    if (!o->depends)
+    {
+	Sink_putc(out, '\n');
+	return;
+    }
+    Sink_putc(out, ' ');
+    Sink_escape(out, o->depends, strlen(o->depends), makeesc);
+    Sink_putc(out, '\n');
+    Sink_escape(out, o->depends, strlen(o->depends), makeesc);
+    Sink_puts(out, ":\n");
+}
+
+static int writeall(int fd, const char *name, const char *data, size_t len)
+{
+    Sink *sink = Sink_createFd(fd);
+    Sink_write(sink, data, len);
+    if (Sink_destroy(sink) < 0)
+    {
+	fprintf(diagout(), "Error writing %s\n", name);
+	return -1;
+    }
+    return 0;
+}
+
+static char *resolvelink(const char *path)
+{
+    char *res = copystr(path);
+    for (int i = 0; i < 32; ++i)
+    {
+	struct stat st;
+	if (lstat(res, &st) < 0) goto error;
+	if (!S_ISLNK(st.st_mode)) return res;
+	const char *base = strrchr(res, '/');
+	size_t dirlen = base ? (size_t)(base - res) + 1 : 0;
+	size_t size = dirlen + st.st_size + 1;
+	char *target = xmalloc(size);
+	ssize_t len = readlink(res, target + dirlen, size - dirlen);
+	if (len < 0 || (size_t)len >= size - dirlen)
+	{
+	    if (len >= 0) errno = ENAMETOOLONG;
+	    free(target);
+	    goto error;
+	}
+	if (target[dirlen] == '/')
+	{
+	    memmove(target, target + dirlen, len);
+	    target[len] = 0;
+	}
+	else
+	{
+	    memcpy(target, res, dirlen);
+	    target[dirlen + len] = 0;
+	}
+	free(res);
+	res = target;
+    }
+    errno = ELOOP;
+error:
+    free(res);
+    return 0;
+}
+
+static int samecontent(int fd, const char *data, size_t len)
+{
+    if (!len) return 1;
+    void *map = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    int same = !memcmp(map, data, len);
+    munmap(map, len);
+    return same;
+}
+
+static int replacefile(const char *filename, Sink *content)
+{
+    size_t len;
+    const char *data = Sink_data(content, &len);
+    struct stat st;
+    int fd;
+    int rc = -1;
+    char *resolved = 0;
+    char *tmpname = 0;
+    const char *path = filename;
+    int exists = lstat(path, &st) == 0;
+    if (exists && S_ISLNK(st.st_mode))
+    {
+	if (!(resolved = resolvelink(path)) || lstat(resolved, &st) < 0)
+	{
+	    diagerror(filename);
+	    goto done;
+	}
+	path = resolved;
+    }
+    if (exists && !S_ISREG(st.st_mode))
+    {
+	if ((fd = open(path, O_WRONLY|O_TRUNC)) < 0)
+	{
+	    diagerror(filename);
+	    goto done;
+	}
+	rc = writeall(fd, filename, data, len);
+	close(fd);
+	goto done;
+    }
+    if (exists && (size_t)st.st_size == len
+	    && (fd = open(path, O_RDONLY)) >= 0)
+    {
+	int same = samecontent(fd, data, len);
+	close(fd);
+	if (same)
+	{
+	    rc = 0;
+	    goto done;
+	}
+    }
+
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t dirlen = base - path;
+    tmpname = xmalloc(strlen(path) + sizeof "..XXXXXX");
+    memcpy(tmpname, path, dirlen);
+    sprintf(tmpname + dirlen, ".%s.XXXXXX", base);
+    if ((fd = mkstemp(tmpname)) < 0)
+    {
+	diagerror(filename);
+	goto done;
+    }
+    fchmod(fd, exists ? st.st_mode & 07777 : filemode);
+    rc = writeall(fd, filename, data, len);
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0 && rename(tmpname, path) != 0)
+    {
+	diagerror(filename);
+	rc = -1;
+    }
+    if (rc < 0) unlink(tmpname);
+
+done:
+    free(tmpname);
+    free(resolved);
+    return rc;
+}
+
+static int writeoutput(Output *o)
+{
+    CliDocCache_use(rescache);
+    if (o->sink) return o->writefunc(o->sink, o->root, o->args);
+    int rc;
+    if (!o->filename)
+    {
+	Sink *sink = Sink_createFd(STDOUT_FILENO);
+	rc = o->writefunc(sink, o->root, o->args);
+	if (Sink_destroy(sink) < 0)
+	{
+	    fputs("Error writing standard output\n", diagout());
+	    rc = -1;
+	}
+	return rc;
+    }
+    char *filename = docfilename(o->filename, o->root);
+    if (!filename) return -1;
+    Sink *sink = Sink_createMem();
+    rc = o->writefunc(sink, o->root, o->args);
+    if (rc == 0) rc = replacefile(filename, sink);
+    Sink_destroy(sink);
+    free(filename);
+    return rc;
+}
+
+static void *writethread(void *arg)
+{
+    Output *o = arg;
+    o->rc = writeoutput(o);
+    return 0;
+}
+
+static int renderdoc(const Input *in, const CliDoc *root)
+{
+    int rc = 0;
+    for (size_t i = 0; i < in->noutputs; ++i)
+    {
+	Output *o = in->outputs + i;
+	o->root = root;
+	o->threaded = parallel && o->filename
+	    && !pthread_create(&o->thread, 0, writethread, o);
+    }
+    for (size_t i = 0; i < in->noutputs && rc == 0; ++i)
+    {
+	if (!in->outputs[i].threaded) rc = writeoutput(in->outputs + i);
+    }
+    for (size_t i = 0; i < in->noutputs; ++i)
+    {
+	if (!in->outputs[i].threaded) continue;
+	pthread_join(in->outputs[i].thread, 0);
+	if (in->outputs[i].rc < 0) rc = -1;
+    }
+    return rc;
+}
+
+static int writedocdeps(const Input *in, const CliDoc *root)
+{
+    for (size_t i = 0; in->deps && i < in->noutputs; ++i)
+    {
+	Output *o = in->outputs + i;
+	if (!o->filename || o->sink) continue;
+	char *filename = docfilename(o->filename, root);
+	if (!filename) return -1;
+	writedeps(in, filename, o);
+	free(filename);
+    }
+    return 0;
+}
+
+static int writedocs(const Input *in, const char *buf, size_t len,
+	Arena *arena)
+{
+    const char *end = buf + len;
+    const char *doc = buf;
+    size_t ndoc = 0;
+    while (doc < end)
+    {
+	size_t seplen;
+	size_t dlen = doclen(doc, end, &seplen);
+	++ndoc;
+	if (!isemptydoc(doc, dlen))
+	{
+	    ArenaMark mark = Arena_mark(arena);
+	    CliDoc *root = CliDoc_createFromBufferInArena(doc, dlen, arena);
+	    if (!root)
+	    {
+		unsigned long line = 1;
+		for (const char *p = buf; p < doc; ++p)
+		{
+		    if (*p == '\n') ++line;
+		}
+		fprintf(diagout(), "in document %zu starting at line %lu\n",
+			ndoc, line);
+		return -1;
+	    }
+	    int wrc = renderdoc(in, root);
+	    if (wrc == 0) wrc = writedocdeps(in, root);
+	    CliDoc_destroy(root);
+	    Arena_rollback(arena, mark);
+	    if (wrc < 0) return -1;
+	}
+	doc += dlen + seplen;
+    }
+    return 0;
+}
+
+static void *loaddoc(const char *path, int fd, const struct stat *st)
+{
+    LoadedDoc *ld = xmalloc(sizeof *ld);
+    ld->mapsz = st->st_size;
+    ld->map = mmap(0, ld->mapsz, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ld->arena = 0;
+    if (ld->map == MAP_FAILED)
+    {
+	diagerror(path);
+	free(ld);
+	return 0;
+    }
+    if (CliDoc_isImage(ld->map, ld->mapsz))
+    {
+	ld->doc = CliDoc_createFromImage(ld->map, ld->mapsz);
+    }
+    else
+    {
+	ld->arena = Arena_create();
+	ld->doc = CliDoc_createFromBufferInArena(ld->map, ld->mapsz,
+		ld->arena);
+    }
+    if (ld->doc) return ld;
+    Arena_destroy(ld->arena);
+    munmap(ld->map, ld->mapsz);
+    free(ld);
+    return 0;
+}
+
+static void unloaddoc(void *obj)
+{
+    LoadedDoc *ld = obj;
+    CliDoc_destroy(ld->doc);
+    Arena_destroy(ld->arena);
+    munmap(ld->map, ld->mapsz);
+    free(ld);
+}
+
+static int opentask(Task *t)
+{
+    Input *run = &t->run;
+    const Output *outs = run->outputs;
+    run->outputs = xmalloc(run->noutputs * sizeof *run->outputs);
+    memcpy(run->outputs, outs, run->noutputs * sizeof *run->outputs);
+    for (size_t i = 0; i < run->noutputs; ++i)
+    {
+	Output *o = run->outputs + i;
+	if (o->filename ? !(multidoc || manifestname)
+		|| !haspattern(o->filename) : !!jobs)
+	{
+	    o->sink = Sink_createMem();
+	}
+	if (run->deps && o->args && o->dependfunc)
+	{
+	    o->depends = o->dependfunc(o->args);
+	}
+    }
+
+    FILE *in = stdin;
+    if (run->filename)
+    {
+	int fd = open(run->filename, O_RDONLY);
+	if (fd < 0)
+	{
+	    diagerror(run->filename);
+	    return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+	    if (doccache && !multidoc)
+	    {
+		t->cached = FileCache_get(doccache, run->filename, fd, &st);
+		close(fd);
+		if (!t->cached) return -1;
+		t->doc = ((LoadedDoc *)CachedFile_obj(t->cached))->doc;
+		return 0;
+	    }
+	    t->mapsz = st.st_size;
+	    t->map = mmap(0, t->mapsz, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	    if (t->map == MAP_FAILED) t->map = 0;
+	}
+	if (t->map) close(fd);
+	else if (!(t->infile = fdopen(fd, "r")))
+	{
+	    close(fd);
+	    return -1;
+	}
+	else in = t->infile;
+    }
+
+    if (multidoc)
+    {
+	size_t len = t->mapsz;
+	char *buf = t->map ? t->map : readfile(in, &len);
+	if (!buf) return -1;
+	int rc = writedocs(run, buf, len, t->arena);
+	if (!t->map) free(buf);
+	return rc;
+    }
+    if (t->map && CliDoc_isImage(t->map, t->mapsz))
+    {
+	t->doc = CliDoc_createFromImage(t->map, t->mapsz);
+    }
+    else if (t->map)
+    {
+	t->doc = CliDoc_createFromBufferInArena(t->map, t->mapsz, t->arena);
+    }
+    else t->doc = CliDoc_createInArena(in, t->arena);
+    return t->doc ? 0 : -1;
+}
+
+static int committask(Task *t)
+{
+    int rc = 0;
+    if (t->doc && writedocdeps(&t->run, t->doc) < 0) rc = -1;
+    for (size_t i = 0; i < t->run.noutputs; ++i)
+    {
+	Output *o = t->run.outputs + i;
+	if (!o->sink || !o->filename) continue;
+	if (replacefile(o->filename, o->sink) < 0) rc = -1;
+	else if (t->run.deps) writedeps(&t->run, o->filename, o);
+    }
+    return rc;
+}
+
+static void closetask(Task *t)
+{
+    if (t->cached) CachedFile_release(t->cached);
+    else CliDoc_destroy(t->doc);
+    t->cached = 0;
+    t->doc = 0;
+    if (t->map) munmap(t->map, t->mapsz);
+    t->map = 0;
+    if (t->infile) fclose(t->infile);
+    t->infile = 0;
+}
+
+static void freeoutputs(Task *t)
+{
+    for (size_t i = 0; i < t->run.noutputs; ++i)
+    {
+	Sink_destroy(t->run.outputs[i].sink);
+	free(t->run.outputs[i].depends);
+    }
+    free(t->run.outputs);
+}
+
+static int processinput(const Input *input, Arena *arena)
+{
+    Task t;
+    memset(&t, 0, sizeof t);
+    t.run = *input;
+    t.run.deps = deps;
+    t.arena = arena;
+    ArenaMark mark = Arena_mark(arena);
+    int rc = opentask(&t);
+    if (rc == 0 && t.doc) rc = renderdoc(&t.run, t.doc);
+    if (rc == 0) rc = committask(&t);
+    closetask(&t);
+    freeoutputs(&t);
+    Arena_rollback(arena, mark);
+    return rc;
+}
+
+static FILE *begindiag(Diag *diag)
+{
+    FILE *file = open_memstream(&diag->buf, &diag->len);
+    setdiagout(file);
+    return file;
+}
+
+static void enddiag(FILE *file)
+{
+    setdiagout(0);
+    if (file) fclose(file);
+}
+
+static void reporttask(Task *t)
+{
+    for (size_t i = 0; i < t->run.noutputs + 2; ++i)
+    {
+	if (t->diags[i].len)
+	{
+	    fwrite(t->diags[i].buf, 1, t->diags[i].len, stderr);
+	}
+	free(t->diags[i].buf);
+    }
+    free(t->diags);
+    if (t->rc < 0)
+    {
+	if (manifestname) fprintf(stderr, "%s:%zu: cannot render %s\n",
+		manifestname, t->input->line, t->input->filename);
+	failed = 1;
+    }
+    for (size_t i = 0; i < t->run.noutputs; ++i)
+    {
+	Output *o = t->run.outputs + i;
+	if (o->filename || !o->sink) continue;
+	size_t len;
+	const char *data = Sink_data(o->sink, &len);
+	if (writeall(STDOUT_FILENO, "standard output", data, len) < 0)
+	{
+	    failed = 1;
+	}
+    }
+    if (t->rc == 0 && deps)
+    {
+	size_t len;
+	const char *data = Sink_data(t->run.deps, &len);
+	Sink_write(deps, data, len);
+    }
+    Sink_destroy(t->run.deps);
+    freeoutputs(t);
+}
+
+static void finishtask(Task *t)
+{
+    FILE *diag = begindiag(t->diags + t->run.noutputs + 1);
+    if (t->rc == 0) t->rc = committask(t);
+    enddiag(diag);
+    closetask(t);
+    Arena_destroy(t->arena);
+    t->arena = 0;
+    free(t->renders);
+    t->renders = 0;
+    pthread_mutex_lock(&reportlock);
+    t->done = 1;
+    while (nextreport < ntasks && tasks[nextreport].done)
+    {
+	reporttask(tasks + nextreport++);
+    }
+    pthread_mutex_unlock(&reportlock);
+}
+
+static void renderjob(JobPool *pool, void *arg)
+{
+    (void)pool;
+    Render *r = arg;
+    Task *t = r->task;
+    Output *o = t->run.outputs + r->index;
+    FILE *diag = begindiag(t->diags + r->index + 1);
+    o->root = t->doc;
+    int rc = writeoutput(o);
+    enddiag(diag);
+    pthread_mutex_lock(&tasklock);
+    if (rc < 0) t->rc = -1;
+    int last = !--t->pending;
+    pthread_mutex_unlock(&tasklock);
+    if (last) finishtask(t);
+}
+
+static void parsejob(JobPool *pool, void *arg)
+{
+    Task *t = arg;
+    t->run.deps = deps ? Sink_createMem() : 0;
+    t->arena = Arena_create();
+    t->diags = xmalloc((t->run.noutputs + 2) * sizeof *t->diags);
+    memset(t->diags, 0, (t->run.noutputs + 2) * sizeof *t->diags);
+    t->renders = xmalloc(t->run.noutputs * sizeof *t->renders);
+    for (size_t i = 0; i < t->run.noutputs; ++i)
+    {
+	t->renders[i].task = t;
+	t->renders[i].index = i;
+    }
+    t->pending = t->run.noutputs;
+    FILE *diag = begindiag(t->diags);
+    t->rc = opentask(t);
+    enddiag(diag);
+    if (t->rc < 0 || !t->doc)
+    {
+	finishtask(t);
+	return;
+    }
+    for (size_t i = 0; i < t->run.noutputs; ++i)
+    {
+	JobPool_add(pool, renderjob, t->renders + i);
+    }
+}
+
+static int runjobs(const Input *inputs, size_t ninputs)
+{
+    tasks = xmalloc(ninputs * sizeof *tasks);
+    ntasks = ninputs;
+    JobPool *pool = JobPool_create(jobs, jobserver);
+    for (size_t i = 0; i < ninputs; ++i)
+    {
+	Task *t = tasks + i;
+	memset(t, 0, sizeof *t);
+	t->run = inputs[i];
+	t->input = inputs + i;
+	JobPool_add(pool, parsejob, t);
+    }
+    JobPool_run(pool);
+    JobPool_destroy(pool);
+    free(tasks);
+    return failed ? -1 : 0;
+}
+
+static Input *readmanifest(char *buf, size_t len,
+	Output **outpool, size_t *ninputs, int *skipped)
+{
+    size_t nrecs = 1;
+    for (size_t i = 0; i < len; ++i)
+    {
+	if (buf[i] == '\n' || !buf[i]) ++nrecs;
+    }
+    Input *inputs = xmalloc(nrecs * sizeof *inputs);
+    Output *pool = xmalloc(nrecs * sizeof *pool);
+    size_t npool = 0;
+    size_t n = 0;
+    size_t line = 0;
+    *skipped = 0;
+    char *end = buf + len;
+    char *rec = buf;
+    while (rec < end)
+    {
+	char *eor = rec;
+	while (eor < end && *eor != '\n' && *eor) ++eor;
+	char *next = eor + 1;
+	++line;
+	if (eor > rec && eor[-1] == '\r') --eor;
+	*eor = 0;
+	if (eor == rec) goto nextrec;
+
+	char *fields[4] = {rec, 0, 0, 0};
+	size_t nfields = 1;
+	for (char *p = rec; p < eor && nfields < 4; ++p)
+	{
+	    if (*p == '\t')
+	    {
+		*p = 0;
+		fields[nfields++] = p + 1;
+	    }
+	}
+	if (nfields == 1)
+	{
+	    inputs[n].filename = rec;
+	    inputs[n].outputs = outputs;
+	    inputs[n].noutputs = noutputs;
+	    inputs[n].line = line;
+	    inputs[n++].deps = 0;
+	    goto nextrec;
+	}
+	if (nfields != 3 || !*fields[2])
+	{
+	    fprintf(diagout(), "%s:%zu: expected input, format and output "
+		    "separated by tabs\n", manifestname, line);
+	    goto error;
+	}
+	Output *o = pool + npool++;
+	memset(o, 0, sizeof *o);
+	o->hasformat = 1;
+	o->filename = fields[2];
+	if (setformat(o, fields[1]) < 0)
+	{
+	    fprintf(diagout(), "%s:%zu: unknown format `%s'\n",
+		    manifestname, line, fields[1]);
+	    --npool;
+	    *skipped = 1;
+	    goto nextrec;
+	}
+	if (n && inputs[n-1].outputs + inputs[n-1].noutputs == o
+		&& !strcmp(inputs[n-1].filename, rec))
+	{
+	    ++inputs[n-1].noutputs;
+	}
+	else
+	{
+	    inputs[n].filename = rec;
+	    inputs[n].outputs = o;
+	    inputs[n].noutputs = 1;
+	    inputs[n].line = line;
+	    inputs[n++].deps = 0;
+	}
+nextrec:
+	rec = next;
+    }
+    *outpool = pool;
+    *ninputs = n;
+    return inputs;
+
+error:
+    free(pool);
+    free(inputs);
+    return 0;
+}
+
+static int processmanifest(Arena *arena)
+{
+    FILE *mf = stdin;
+    if (strcmp(manifestname, "-") && !(mf = fopen(manifestname, "r")))
+    {
+	diagerror(manifestname);
+	return -1;
+    }
+    size_t len;
+    char *buf = readfile(mf, &len);
+    if (mf != stdin) fclose(mf);
+    if (!buf) return -1;
+    buf = xrealloc(buf, len + 1);
+    buf[len] = 0;
+    int rc = -1;
+    Output *pool;
+    size_t ninputs;
+    int skipped;
+    Input *inputs = readmanifest(buf, len, &pool, &ninputs, &skipped);
+    if (!inputs) goto done;
+    rc = 0;
+    if (jobs) rc = runjobs(inputs, ninputs);
+    else for (size_t i = 0; i < ninputs; ++i)
+    {
+	if (processinput(inputs + i, arena) < 0)
+	{
+	    fprintf(diagout(), "%s:%zu: cannot render %s\n",
+		    manifestname, inputs[i].line, inputs[i].filename);
+	    rc = -1;
+	}
+    }
+    if (skipped) rc = -1;
+    free(pool);
+    free(inputs);
+
+done:
+    free(buf);
+    return rc;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-C socket] "
+	    "[-mp] [-B manifest] [-j jobs] [-M depfile]\n"
+	    "\t\t[[-f <bin|cpp|html|man|mdoc|sh>[,args[:args...]]]\n"
+	    "\t\t[-o outfile]] ... [infile]\n"
+	    "       %s -D socket\n", name, name);
+    return EXIT_FAILURE;
+}
+
+static int run(int argc, char **argv)
 {
     int flags = 1;
     char *name = argv[0];
-    const char *arg;
+    char *arg;
+    char *endp;
+    Output *o;
     if (!name) name = "mkclidoc";
+    outputs = xmalloc((argc + 1) * sizeof *outputs);
+    noutputs = 0;
+    infilename = 0;
+    manifestname = 0;
+    multidoc = 0;
+    parallel = 0;
+    jobs = 0;
+    jobserver = 0;
+    nextreport = 0;
+    failed = 0;
+    filemode = 0666;
+    depfilename = 0;
+    deps = 0;
 
     for (++argv, --argc; argc ; ++argv, --argc)
     {
@@ -46,33 +971,57 @@ int main(int argc, char **argv)
 	    case 'f':
 		if (!(*argv)[2])
 		{
-		    if (!argc--) goto usage;
+		    if (!--argc) goto usage;
 		    arg = *++argv;
 		} else arg = *argv + 2;
-		currentWriter = 0;
-		writerArgs = strchr(arg, ',');
-		if (writerArgs)
+		o = nextoutput(0);
+		o->hasformat = 1;
+		if (setformat(o, arg) < 0) goto usage;
+		break;
+
+	    case 'B':
+		if (!(*argv)[2])
 		{
-		    *writerArgs++ = 0;
-		    if (!*writerArgs) writerArgs = 0;
-		}
-		for (unsigned i = 0; i < sizeof writers / sizeof *writers; ++i)
+		    if (!--argc) goto usage;
+		    manifestname = *++argv;
+		} else manifestname = *argv + 2;
+		break;
+
+	    case 'j':
+		if (!(*argv)[2])
 		{
-		    if (!strcmp(arg, writers[i].name))
-		    {
-			currentWriter = writers[i].writefunc;
-			break;
-		    }
-		}
-		if (!currentWriter) goto usage;
+		    if (!--argc) goto usage;
+		    arg = *++argv;
+		} else arg = *argv + 2;
+		jobs = strtoul(arg, &endp, 10);
+		if (*endp || !jobs || jobs > 1024) goto usage;
+		break;
+
+	    case 'm':
+		if ((*argv)[2]) goto usage;
+		multidoc = 1;
+		break;
+
+	    case 'M':
+		if (!(*argv)[2])
+		{
+		    if (!--argc) goto usage;
+		    depfilename = *++argv;
+		} else depfilename = *argv + 2;
+		break;
+
+	    case 'p':
+		if ((*argv)[2]) goto usage;
+		parallel = 1;
 		break;
 
 	    case 'o':
 		if (!(*argv)[2])
 		{
-		    if (!argc--) goto usage;
-		    outfilename = *++argv;
-		} else outfilename = *argv + 2;
+		    if (!--argc) goto usage;
+		    arg = *++argv;
+		} else arg = *argv + 2;
+		nextoutput(1)->filename = arg;
 		break;
 
 	    default:
@@ -85,35 +1034,89 @@ int main(int argc, char **argv)
 	}
     }
 
-    int rc = EXIT_FAILURE;
-    FILE *in = stdin;
-    CliDoc *doc = 0;
-
-    if (infilename)
+    if (manifestname && infilename) goto usage;
+    if (!noutputs) nextoutput(0);
+    for (size_t i = 0; i < noutputs; ++i)
     {
-	if (!(infile = fopen(infilename, "r"))) goto done;
-	in = infile;
+	o = outputs + i;
+	if (manifestname && o->filename && !haspattern(o->filename))
+	{
+	    fprintf(stderr, "Output file %s must contain %%n with -B\n",
+		    o->filename);
+	    free(outputs);
+	    return EXIT_FAILURE;
+	}
     }
-    FILE *out = stdout;
-    if (outfilename)
+    if (!doccache && (manifestname || jobs)) jobserver = Jobserver_create();
+    if (jobserver && !jobs)
     {
-	if (!(outfile = fopen(outfilename, "w"))) goto done;
-	out = outfile;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	jobs = ncpu < 1 ? 1 : ncpu > 1024 ? 1024 : ncpu;
     }
+    if (jobs) parallel = 0;
+    if (depfilename) deps = Sink_createMem();
+    mode_t mask = umask(0);
+    umask(mask);
+    filemode &= ~mask;
 
-    if (!(doc = CliDoc_create(in))) goto done;
-    if (currentWriter(out, doc, writerArgs) < 0) goto done;
-    rc = EXIT_SUCCESS;
-
-done:
-    CliDoc_destroy(doc);
-    if (infile) fclose(infile);
-    if (outfile) fclose(outfile);
+    int rc = EXIT_SUCCESS;
+    Arena *arena = Arena_create();
+    if (manifestname)
+    {
+	if (processmanifest(arena) < 0) rc = EXIT_FAILURE;
+    }
+    else
+    {
+	Input input = { infilename, outputs, noutputs, 0, 0 };
+	if (jobs) rc = runjobs(&input, 1) < 0 ? EXIT_FAILURE : rc;
+	else if (processinput(&input, arena) < 0) rc = EXIT_FAILURE;
+    }
+    if (rc == EXIT_SUCCESS && deps && replacefile(depfilename, deps) < 0)
+    {
+	rc = EXIT_FAILURE;
+    }
+    Arena_destroy(arena);
+    Sink_destroy(deps);
+    Jobserver_destroy(jobserver);
+    free(outputs);
     return rc;
 
 usage:
-    fprintf(stderr, "Usage: %s [-f <cpp|html|man|mdoc|sh>[,args[:args...]]]\n"
-	    "\t\t[-o outfile] [infile]\n", name);
-    return EXIT_FAILURE;
+    free(outputs);
+    return usage(name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = argv[0] ? argv[0] : "mkclidoc";
+    if (argc < 2 || argv[1][0] != '-'
+	    || (argv[1][1] != 'C' && argv[1][1] != 'D'))
+    {
+	rescache = CliDocCache_create(RESCACHESZ);
+	int rc = run(argc, argv);
+	CliDocCache_destroy(rescache);
+	return rc;
+    }
+
+    int mode = argv[1][1];
+    const char *sockname = argv[1] + 2;
+    int skip = 1;
+    if (!*sockname)
+    {
+	if (argc < 3) return usage(name);
+	sockname = argv[++skip];
+    }
+    if (mode == 'C')
+    {
+	argv[skip] = argv[0];
+	return runClient(sockname, argc - skip, argv + skip);
+    }
+    if (argc > skip + 1) return usage(name);
+    doccache = FileCache_create(DOCCACHESZ, loaddoc, unloaddoc);
+    rescache = CliDocCache_create(RESCACHESZ);
+    int rc = runDaemon(sockname, run);
+    CliDocCache_destroy(rescache);
+    FileCache_destroy(doccache);
+    return rc;
 }
 
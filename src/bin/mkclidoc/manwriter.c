@@ -1,7 +1,11 @@
 #include "manwriter.h"
 
 #include "clidoc.h"
+#include "depends.h"
+#include "filecache.h"
 #include "htmlhdr.h"
+#include "rescache.h"
+#include "sink.h"
 #include "util.h"
 
 #include <assert.h>
@@ -41,6 +45,9 @@ typedef struct Ctx
     const char *name;
     const char *arg;
     const char *var;
+    size_t namelen;
+    size_t arglen;
+    size_t varlen;
     size_t nflags;
     size_t nargs;
     int separators;
@@ -48,200 +55,176 @@ typedef struct Ctx
     Fmt fmt;
 } Ctx;
 #define Ctx_init(root, fmt, opts) { \
-    (opts), (root), 0, 0, 0, 0, 0, 0, 0, (fmt)}
+    (opts), (root), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, (fmt)}
 
 #define err(m) do { \
-    fprintf(stderr, "Cannot write man: %s\n", (m)); goto error; } while (0)
+    fprintf(diagout(), "Cannot write man: %s\n", (m)); goto error; } while (0)
 #define istext(m) ((m) && CliDoc_type(m) == CT_TEXT)
-#define ismpunct(c) (ispunct(c) && (c) != '\\' && (c) != '%' \
-	&& (c) != '`' && (c) != '<' && (c) != '>')
-#define istpunct(s) (ismpunct(*(s)) && \
-	(!(s)[1] || (s)[1] == ' ' || (s)[1] == '\t'))
 #define isodelim(c) ((c) == '(' || (c) == '[')
 #define iscdelim(c) ((c) == '.' || (c) == ',' || (c) == ':' || (c) == ';' \
 	|| (c) == ')' || (c) == ']' || (c) == '?' || (c) == '!')
 
-static char strbuf[8192];
-static char escbuf[8192];
-
-static char *strToUpper(const char *str)
+static const char *const roffesc[256] = {
+    ['\\'] = "\\e"
+};
+
+static const char *const htmlesc[256] = {
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['&'] = "&amp;",
+    ['"'] = "&dquot;"
+};
+
+static const char *const mdocargesc[256] = {
+    ['('] = "\\&(",
+    ['['] = "\\&[",
+    ['.'] = "\\&.",
+    [','] = "\\&,",
+    [':'] = "\\&:",
+    [';'] = "\\&;",
+    [')'] = "\\&)",
+    [']'] = "\\&]",
+    ['?'] = "\\&?",
+    ['!'] = "\\&!"
+};
+
+static const char *const mdocesc[256] = {
+    ['('] = "\\&(",
+    ['['] = "\\&[",
+    ['.'] = "\\&.",
+    [','] = "\\&,",
+    [':'] = "\\&:",
+    [';'] = "\\&;",
+    [')'] = "\\&)",
+    [']'] = "\\&]",
+    ['?'] = "\\&?",
+    ['!'] = "\\&!",
+    ['\\'] = "\\e"
+};
+
+static void writeUpper(Sink *out, const char *str, size_t len,
+	const char *const *esc)
 {
-    size_t len = strlen(str);
-    if (len + 1 > sizeof strbuf) len = sizeof strbuf - 1;
-    for (size_t i = 0; i < len; ++i)
+    for (const char *end = str + len; str < end; ++str)
     {
-	strbuf[i] = toupper(str[i]);
+	unsigned char c = toupper((unsigned char)*str);
+	if (esc && esc[c]) Sink_puts(out, esc[c]);
+	else Sink_putc(out, c);
     }
-    strbuf[len] = 0;
-    return strbuf;
 }
 
-static char *htmlnescape(const char *str, size_t n)
+static char *htmlstr(const char *str, size_t len, int upper)
 {
-    size_t outlen = 0;
-    size_t inpos = 0;
-    while (str[inpos] && (!n || inpos < n) &&  outlen < 8150)
-    {
-	switch (str[inpos])
-	{
-	    case '<':
-		strcpy(escbuf+outlen, "&lt;");
-		outlen += 4;
-		++inpos;
-		break;
-	    case '>':
-		strcpy(escbuf+outlen, "&gt;");
-		outlen += 4;
-		++inpos;
-		break;
-	    case '&':
-		strcpy(escbuf+outlen, "&amp;");
-		outlen += 5;
-		++inpos;
-		break;
-	    case '"':
-		strcpy(escbuf+outlen, "&dquot;");
-		outlen += 7;
-		++inpos;
-		break;
-	    default:
-		escbuf[outlen++] = str[inpos++];
-	}
-    }
-    escbuf[outlen] = 0;
-    return escbuf;
+    Sink *buf = Sink_createMem();
+    if (upper) writeUpper(buf, str, len, htmlesc);
+    else Sink_escape(buf, str, len, htmlesc);
+    return Sink_detach(buf, 0);
 }
 
-static char *htmlescape(const char *str)
+static void writeDate(Sink *out, const struct tm *tm)
 {
-    return htmlnescape(str, 0);
+    char month[64];
+    if (!strftime(month, sizeof month, "%B", tm)) month[0] = 0;
+    Sink_printf(out, "%s %d, %d", month, tm->tm_mday, tm->tm_year + 1900);
 }
 
-static char *mdocargescape(const char *str)
+static void writeEsc(Sink *out, const Ctx *ctx, const char *str, size_t len)
 {
-    size_t outlen = 0;
-    for (; *str && outlen < 8150; ++str)
-    {
-	if (isodelim(*str) || iscdelim(*str))
-	{
-	    escbuf[outlen++] = '\\';
-	    escbuf[outlen++] = '&';
-	}
-	escbuf[outlen++] = *str;
-    }
-    escbuf[outlen] = 0;
-    return escbuf;
+    Sink_escape(out, str, len, ctx->fmt == F_HTML ? htmlesc : roffesc);
 }
 
-static int isenvname(const char *str)
+static size_t spanWidth(const Ctx *ctx, const char *str, const CDSpan *span)
 {
-    int haveupper = 0;
-    for (;*str; ++str)
+    size_t width = span->len;
+    if (ctx->fmt != F_HTML && (span->flags & SF_ESCAPE))
     {
-	if (isupper(*str))
+	for (uint32_t i = 0; i < span->len; ++i)
 	{
-	    ++haveupper;
-	    continue;
+	    if (str[span->off + i] == '\\') ++width;
 	}
-	if (haveupper && isdigit(*str)) continue;
-	if (*str != '_') return 0;
     }
-    return haveupper > 1;
+    return width;
 }
 
-static char *fetchManTextWord(const char **s, const Ctx *ctx)
+static void endManItem(Sink *out, const Ctx *ctx, const char *str,
+	const CDSpan *next, const CDSpan *end, int *nl, int *oneword)
 {
-    size_t wordlen = 0;
-    int quote = 0;
-    if (**s == '`') quote = 1;
-    while (**s && **s != ' ' && **s != '\t'
-	    && !istpunct(*s) && wordlen < 4096)
+    if (next == end) return;
+    int space = next->flags & SF_SPACE;
+    if (ctx->fmt == F_MDOC)
     {
-	if (**s == '%')
+	if (!space && next->len == 1 && iscdelim(str[next->off])
+		&& (next + 1 == end || (next[1].flags & SF_SPACE)))
 	{
-	    if (!strcmp(*s, "%%name%%"))
-	    {
-		if (wordlen) break;
-		strcpy(strbuf, "%%name%%");
-		*s += sizeof "%%name%%" - 1;
-		return strbuf;
-	    }
-	    if (!strcmp(*s, "%%arg%%"))
-	    {
-		if (wordlen) break;
-		strcpy(strbuf, "%%arg%%");
-		*s += sizeof "%%arg%%" - 1;
-		return strbuf;
-	    }
-	    if (!strcmp(*s, "%%var%%"))
-	    {
-		if (wordlen) break;
-		strcpy(strbuf, "%%var%%");
-		*s += sizeof "%%var%%" - 1;
-		return strbuf;
-	    }
+	    Sink_putc(out, ' ');
+	    *oneword = 1;
+	}
+	else if (space) *nl = 1;
+	else
+	{
+	    Sink_puts(out, " Ns ");
+	    *oneword = 1;
 	}
-	strbuf[wordlen++] = **s;
-	if (ctx->fmt != F_HTML && **s == '\\') strbuf[wordlen++] = 'e';
-	(*s)++;
-	if (quote && wordlen > 2 && (*s)[-1] == '`') break;
     }
-    if (!wordlen) return 0;
-    strbuf[wordlen] = 0;
-    return strbuf;
+    else if (ctx->fmt == F_MAN)
+    {
+	if (space) *nl = 1;
+	else *oneword = 1;
+    }
 }
 
-static void writeManText(FILE *out, Ctx *ctx, const char *str)
+static void writeManText(Sink *out, Ctx *ctx, const char *str,
+	const CDSpan *spans, size_t nspans)
 {
+    const CDSpan *end = spans + nspans;
     size_t col = 0;
     int oneword = 0;
     int nl = 0;
-    while (*str)
+    for (const CDSpan *sp = spans; sp < end; ++sp)
     {
-	int space = 0;
+	const char *s = str + sp->off;
+	int space = sp->flags & SF_SPACE;
 	char odelim = 0;
-	while (*str && (*str == ' ' || *str == '\t')) ++str, space = 1;
-	if (!*str) break;
 
-	if (!ctx->tblcell && ctx->fmt != F_HTML && *str == '.' &&
-		(!str[1] || str[1] == ' ' || str[1] == '\t'))
-	{
-	    if (nl) fputc(' ', out);
-	    fputc(*str++, out);
-	    nl = 1;
-	    continue;
-	}
-	if (ismpunct(*str))
+	if (sp->type == SP_PUNCT)
 	{
+	    if (!ctx->tblcell && ctx->fmt != F_HTML && sp->len == 1
+		    && *s == '.'
+		    && (sp + 1 == end || (sp[1].flags & SF_SPACE)))
+	    {
+		if (nl) Sink_putc(out, ' ');
+		Sink_putc(out, '.');
+		nl = 1;
+		continue;
+	    }
 	    if (nl && !ctx->tblcell)
 	    {
-		fputc('\n', out);
+		Sink_putc(out, '\n');
 		col = 0;
 		nl = 0;
 	    }
-	    size_t punctlen = 1;
-	    while (ismpunct(str[punctlen]) && str[punctlen] != '.') ++punctlen;
 	    if (!ctx->tblcell && ctx->fmt != F_HTML
-		    && col && col + punctlen > 78)
+		    && col && col + sp->len > 78)
 	    {
-		fputc('\n', out);
+		Sink_putc(out, '\n');
 		col = 0;
 	    }
-	    if (ctx->fmt == F_MDOC && punctlen == 1 && isodelim(*str)
-		    && (str[1] && str[1] != ' ' && str[1] != '\t'))
+	    if (ctx->fmt == F_MDOC && sp->len == 1 && isodelim(*s)
+		    && sp + 1 < end && !(sp[1].flags & SF_SPACE)
+		    && sp[1].type != SP_PUNCT)
 	    {
-		odelim = *str++;
+		odelim = *s;
+		s = str + (++sp)->off;
 	    }
 	    else
 	    {
 		if ((col || ctx->tblcell || ctx->fmt == F_HTML) && space)
 		{
-		    fputc(' ', out);
+		    Sink_putc(out, ' ');
 		    ++col;
 		}
-		fwrite(str, 1, punctlen, out);
-		str += punctlen;
-		col += punctlen;
+		Sink_write(out, s, sp->len);
+		col += sp->len;
 		if (oneword)
 		{
 		    oneword = 0;
@@ -251,323 +234,261 @@ static void writeManText(FILE *out, Ctx *ctx, const char *str)
 	    }
 	}
 
-	char *word = fetchManTextWord(&str, ctx);
-	if (!word) break;
-	int writename = !strcmp(word, "%%name%%");
-	int writearg = !strcmp(word, "%%arg%%") && ctx->arg;
-	int writevar = !strcmp(word, "%%var%%") && ctx->var;
+	int writename = sp->type == SP_NAME;
+	int writearg = sp->type == SP_ARG && ctx->arg;
+	int writevar = sp->type == SP_VAR && ctx->var;
 	if (writename || writearg || writevar)
 	{
 	    if (col && !ctx->tblcell && ctx->fmt != F_HTML)
 	    {
-		fputc('\n', out);
+		Sink_putc(out, '\n');
 		col = 0;
 	    }
-	    if (space && (ctx->fmt == F_HTML || ctx->tblcell)) fputc(' ', out);
+	    if (space && (ctx->fmt == F_HTML || ctx->tblcell))
+	    {
+		Sink_putc(out, ' ');
+	    }
 	    if (writename)
 	    {
 		if (ctx->fmt == F_HTML)
 		{
-		    fprintf(out, "<span class=\"name\">%s</span>", ctx->name);
+		    Sink_printf(out, "<span class=\"name\">%.*s</span>",
+			    (int)ctx->namelen, ctx->name);
 		}
 		else if (ctx->fmt == F_MDOC)
 		{
 		    if (odelim)
 		    {
-			fprintf(out, ".Nm %c %s", odelim,
-				mdocargescape(ctx->name));
+			Sink_printf(out, ".Nm %c ", odelim);
+			Sink_escape(out, ctx->name, ctx->namelen, mdocargesc);
 			odelim = 0;
 		    }
-		    else fputs(".Nm", out);
+		    else Sink_puts(out, ".Nm");
 		}
-		else fprintf(out, "\\fB%s\\fR", ctx->name);
+		else Sink_printf(out, "\\fB%.*s\\fR",
+			(int)ctx->namelen, ctx->name);
 	    }
 	    else if (writearg)
 	    {
 		if (ctx->fmt == F_HTML)
 		{
-		    fprintf(out, "<span class=\"arg\">%s</span>", ctx->arg);
+		    Sink_printf(out, "<span class=\"arg\">%.*s</span>",
+			    (int)ctx->arglen, ctx->arg);
 		}
 		else if (ctx->fmt == F_MDOC)
 		{
 		    if (odelim)
 		    {
-			fprintf(out, &".Ar %c %s"[ctx->tblcell],
-				odelim, mdocargescape(ctx->arg));
+			Sink_printf(out, &".Ar %c "[ctx->tblcell], odelim);
+			Sink_escape(out, ctx->arg, ctx->arglen, mdocargesc);
 			odelim = 0;
 		    }
-		    else fprintf(out, &".Ar %s"[ctx->tblcell],
-			    mdocargescape(ctx->arg));
+		    else
+		    {
+			Sink_puts(out, &".Ar "[ctx->tblcell]);
+			Sink_escape(out, ctx->arg, ctx->arglen, mdocargesc);
+		    }
 		}
-		else fprintf(out, "\\fI%s\\fR", ctx->arg);
+		else Sink_printf(out, "\\fI%.*s\\fR",
+			(int)ctx->arglen, ctx->arg);
 	    }
 	    else if (writevar)
 	    {
 		if (ctx->fmt == F_HTML)
 		{
-		    fprintf(out, "<span class=\"name\">%s</span>", ctx->var);
+		    Sink_printf(out, "<span class=\"name\">%.*s</span>",
+			    (int)ctx->varlen, ctx->var);
 		}
 		else if (ctx->fmt == F_MDOC)
 		{
 		    if (odelim)
 		    {
-			fprintf(out, &".Ev %c %s"[ctx->tblcell],
-				odelim, mdocargescape(ctx->var));
+			Sink_printf(out, &".Ev %c "[ctx->tblcell], odelim);
+			Sink_escape(out, ctx->var, ctx->varlen, mdocargesc);
 			odelim = 0;
 		    }
-		    else fprintf(out, &".Ev %s"[ctx->tblcell],
-			    mdocargescape(ctx->var));
-		}
-		else fprintf(out, "\\fB%s\\fR", ctx->var);
-	    }
-	    if (ctx->fmt == F_MDOC)
-	    {
-		if (iscdelim(*str) &&
-			(!str[1] || str[1] == ' ' || str[1] == '\t'))
-		{
-		    fputc(' ', out);
-		    oneword = 1;
-		}
-		else if (*str == ' ' || *str == '\t') nl = 1;
-		else if (*str)
-		{
-		    fputs(" Ns ", out);
-		    oneword = 1;
+		    else
+		    {
+			Sink_puts(out, &".Ev "[ctx->tblcell]);
+			Sink_escape(out, ctx->var, ctx->varlen, mdocargesc);
+		    }
 		}
+		else Sink_printf(out, "\\fB%.*s\\fR",
+			(int)ctx->varlen, ctx->var);
 	    }
-	    else if (ctx->fmt == F_MAN)
-	    {
-		if (*str == ' ' || *str == '\t') nl = 1;
-		else if (*str) oneword = 1;
-	    }
+	    endManItem(out, ctx, str, sp + 1, end, &nl, &oneword);
 	    continue;
 	}
-	size_t wordlen = strlen(word);
-	if (word[0] == '`' && word[wordlen-1] == '`')
+	if (sp->type >= SP_FLAG && sp->type <= SP_LITERAL)
 	{
-	    word[wordlen-1] = 0;
+	    const char *word = s + 1;
+	    size_t wordlen = sp->len - 2;
 	    if (col && !ctx->tblcell && ctx->fmt != F_HTML)
 	    {
-		fputc('\n', out);
+		Sink_putc(out, '\n');
 		col = 0;
 	    }
-	    if (space && (ctx->fmt == F_HTML || ctx->tblcell)) fputc(' ', out);
-	    if (wordlen == 4 && word[1] == '-')
-	    {
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "<span class=\"flag\">%s</span>", word+1);
-		}
-		else if (ctx->fmt == F_MDOC)
-		{
-		    if (odelim)
-		    {
-			fprintf(out, &".Fl %c %c"[ctx->tblcell],
-				odelim, word[2]);
-			odelim = 0;
-		    }
-		    else fprintf(out, &".Fl %c"[ctx->tblcell], word[2]);
-		}
-		else fprintf(out, "\\fB\\-%c\\fR", word[2]);
-	    }
-	    else if (word[1] == '/' ||
-		    (word[1] == '~' && word[2] == '/') ||
-		    (word[1] == '.' && (word[2] == '/' ||
-			    (word[2] == '.' && word[3] == '/'))))
-	    {
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "<span class=\"file\">%s</span>", word+1);
-		}
-		else if (ctx->fmt == F_MDOC)
-		{
-		    if (odelim)
-		    {
-			fprintf(out, &".Pa %c %s"[ctx->tblcell],
-				odelim, mdocargescape(word+1));
-			odelim = 0;
-		    }
-		    else fprintf(out, &".Pa %s"[ctx->tblcell],
-			    mdocargescape(word+1));
-		}
-		else fprintf(out, "\\fI%s\\fR", word+1);
-	    }
-	    else if (isenvname(word+1))
+	    if (space && (ctx->fmt == F_HTML || ctx->tblcell))
 	    {
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "<span class=\"name\">%s</span>", word+1);
-		}
-		else if (ctx->fmt == F_MDOC)
-		{
-		    if (odelim)
-		    {
-			fprintf(out, &".Ev %c %s"[ctx->tblcell],
-				odelim, mdocargescape(word+1));
-			odelim = 0;
-		    }
-		    else fprintf(out, &".Ev %s"[ctx->tblcell],
-			    mdocargescape(word+1));
-		}
-		else fprintf(out, "\\fB%s\\fR", word+1);
+		Sink_putc(out, ' ');
 	    }
-	    else
+	    const char *html = "<span class=\"name\">%.*s</span>";
+	    const char *mdoc = ".Cm ";
+	    const char *man = "\\fB";
+	    switch (sp->type)
 	    {
-		const CliDoc *ref = 0;
-		const char *refname = 0;
-		for (size_t i = 0; i < CDRoot_nrefs(ctx->root); ++i)
-		{
-		    const CliDoc *r = CDRoot_ref(ctx->root, i);
-		    refname = CDMRef_name(r);
-		    if (*refname == '&') ++refname;
-		    if (!strncmp(refname, word+1, wordlen-2))
-		    {
-			ref = r;
-			break;
-		    }
-		}
-		if (ref)
-		{
+		case SP_FLAG:
 		    if (ctx->fmt == F_HTML)
 		    {
-			fprintf(out, "<span class=\"name\">%s</span>(%s)",
-				refname, CDMRef_section(ref));
+			Sink_printf(out, "<span class=\"flag\">%.*s</span>",
+				(int)wordlen, word);
 		    }
 		    else if (ctx->fmt == F_MDOC)
 		    {
 			if (odelim)
 			{
-			    fprintf(out, &".Xr %c %s %s"[ctx->tblcell],
-				    odelim, mdocargescape(refname),
-				    CDMRef_section(ref));
+			    Sink_printf(out, &".Fl %c %c"[ctx->tblcell],
+				    odelim, word[1]);
 			    odelim = 0;
 			}
-			else fprintf(out, &".Xr %s %s"[ctx->tblcell],
-				mdocargescape(refname), CDMRef_section(ref));
-		    }
-		    else fprintf(out, "\\fB%s\\fP(%s)\\fR",
-			    refname, CDMRef_section(ref));
-		}
-		else
-		{
-		    refname = 0;
-		    if (ctx->fmt == F_HTML)
-		    {
-			fprintf(out, "<span class=\"name\">%s</span>",
-				word+1);
+			else Sink_printf(out, &".Fl %c"[ctx->tblcell],
+				word[1]);
 		    }
-		    else if (ctx->fmt == F_MDOC)
+		    else Sink_printf(out, "\\fB\\-%c\\fR", word[1]);
+		    html = 0;
+		    break;
+
+		case SP_PATH:
+		    html = "<span class=\"file\">%.*s</span>";
+		    mdoc = ".Pa ";
+		    man = "\\fI";
+		    break;
+
+		case SP_ENV:
+		    mdoc = ".Ev ";
+		    break;
+
+		case SP_MREF:
 		    {
-			if (odelim)
+			const CliDoc *ref = CDRoot_ref(ctx->root, sp->ref);
+			size_t reflen;
+			const char *refname = CDMRef_namen(ref, &reflen);
+			if (reflen && *refname == '&') ++refname, --reflen;
+			size_t sectlen;
+			const char *sect = CDMRef_sectionn(ref, &sectlen);
+			if (ctx->fmt == F_HTML)
 			{
-			    fprintf(out, &".Cm %c %s"[ctx->tblcell],
-				    odelim, mdocargescape(word+1));
-			    odelim = 0;
+			    Sink_printf(out, "<span class=\"name\">%.*s</span>"
+				    "(%.*s)", (int)reflen, refname,
+				    (int)sectlen, sect);
+			}
+			else if (ctx->fmt == F_MDOC)
+			{
+			    if (odelim)
+			    {
+				Sink_printf(out, &".Xr %c "[ctx->tblcell],
+					odelim);
+				odelim = 0;
+			    }
+			    else Sink_puts(out, &".Xr "[ctx->tblcell]);
+			    Sink_escape(out, refname, reflen, mdocargesc);
+			    Sink_printf(out, " %.*s", (int)sectlen, sect);
 			}
-			else fprintf(out, &".Cm %s"[ctx->tblcell],
-				mdocargescape(word+1));
+			else Sink_printf(out, "\\fB%.*s\\fP(%.*s)\\fR",
+				(int)reflen, refname, (int)sectlen, sect);
 		    }
-		    else fprintf(out, "\\fB%s\\fR", word+1);
-		}
-	    }
-	    if (ctx->fmt == F_MDOC)
-	    {
-		if (iscdelim(*str) &&
-			(!str[1] || str[1] == ' ' || str[1] == '\t'))
-		{
-		    fputc(' ', out);
-		    oneword = 1;
-		}
-		else if (*str == ' ' || *str == '\t') nl = 1;
-		else if (*str)
-		{
-		    fputs(" Ns ", out);
-		    oneword = 1;
-		}
-	    }
-	    else if (ctx->fmt == F_MAN)
-	    {
-		if (*str == ' ' || *str == '\t') nl = 1;
-		else if (*str) oneword = 1;
+		    html = 0;
+		    break;
+
+		default:
+		    break;
 	    }
-	    continue;
-	}
-	else if (word[0] == '<' && word[wordlen-1] == '>')
-	{
-	    int islink = !!strstr(word+1, "://");
-	    int isemail = !islink && !!strchr(word+1, '@');
-	    if (islink || isemail)
+	    if (html)
 	    {
-		word[wordlen-1] = 0;
-		++word;
-		if (col && !ctx->tblcell && ctx->fmt != F_HTML)
-		{
-		    fputc('\n', out);
-		    col = 0;
-		}
-		if (space && (ctx->fmt == F_HTML || ctx->tblcell))
-		{
-		    fputc(' ', out);
-		}
 		if (ctx->fmt == F_HTML)
 		{
-		    char *email = htmlescape(word);
-		    fprintf(out, isemail ? "<a href=\"mailto:%s\">%s</a>"
-			    : "<a href=\"%s\">%s</a>",
-			    email, email);
+		    Sink_printf(out, html, (int)wordlen, word);
 		}
 		else if (ctx->fmt == F_MDOC)
 		{
 		    if (odelim)
 		    {
-			fprintf(out, &(isemail ? ".Aq %c Mt %s"
-				    : ".Lk %c %s")[ctx->tblcell],
-				odelim, word);
+			Sink_printf(out, "%s%c ", mdoc + ctx->tblcell, odelim);
 			odelim = 0;
 		    }
-		    else fprintf(out, &(isemail ? ".Aq Mt %s"
-				: ".Lk %s")[ctx->tblcell], word);
+		    else Sink_puts(out, mdoc + ctx->tblcell);
+		    Sink_escape(out, word, wordlen, mdocesc);
+		}
+		else
+		{
+		    Sink_puts(out, man);
+		    writeEsc(out, ctx, word, wordlen);
+		    Sink_puts(out, "\\fR");
 		}
-		else fprintf(out, isemail ?
-			"<\\fI%s\\fR>" : "\\fB%s\\fR", word);
+	    }
+	    endManItem(out, ctx, str, sp + 1, end, &nl, &oneword);
+	    continue;
+	}
+	if (sp->type == SP_LINK || sp->type == SP_MAIL)
+	{
+	    int isemail = sp->type == SP_MAIL;
+	    const char *word = s + 1;
+	    size_t wordlen = sp->len - 2;
+	    if (col && !ctx->tblcell && ctx->fmt != F_HTML)
+	    {
+		Sink_putc(out, '\n');
+		col = 0;
+	    }
+	    if (space && (ctx->fmt == F_HTML || ctx->tblcell))
+	    {
+		Sink_putc(out, ' ');
+	    }
+	    if (ctx->fmt == F_HTML)
+	    {
+		Sink_puts(out, isemail ? "<a href=\"mailto:" : "<a href=\"");
+		writeEsc(out, ctx, word, wordlen);
+		Sink_puts(out, "\">");
+		writeEsc(out, ctx, word, wordlen);
+		Sink_puts(out, "</a>");
+	    }
+	    else
+	    {
 		if (ctx->fmt == F_MDOC)
 		{
-		    if (iscdelim(*str) &&
-			    (!str[1] || str[1] == ' ' || str[1] == '\t'))
-		    {
-			fputc(' ', out);
-			oneword = 1;
-		    }
-		    else if (*str == ' ' || *str == '\t') nl = 1;
-		    else if (*str)
+		    if (odelim)
 		    {
-			fputs(" Ns ", out);
-			oneword = 1;
+			Sink_printf(out, &(isemail ? ".Aq %c Mt "
+				    : ".Lk %c ")[ctx->tblcell], odelim);
+			odelim = 0;
 		    }
+		    else Sink_puts(out, &(isemail ? ".Aq Mt "
+				: ".Lk ")[ctx->tblcell]);
 		}
-		else if (ctx->fmt == F_MAN)
+		else Sink_puts(out, isemail ? "<\\fI" : "\\fB");
+		writeEsc(out, ctx, word, wordlen);
+		if (ctx->fmt == F_MAN)
 		{
-		    if (*str == ' ' || *str == '\t') nl = 1;
-		    else if (*str) oneword = 1;
+		    Sink_puts(out, isemail ? "\\fR>" : "\\fR");
 		}
-		continue;
 	    }
+	    endManItem(out, ctx, str, sp + 1, end, &nl, &oneword);
+	    continue;
 	}
+	size_t wordlen = spanWidth(ctx, str, sp);
 	if (nl || (ctx->fmt != F_HTML && col + !!col + wordlen > 78))
 	{
 	    if (nl && ctx->tblcell)
 	    {
-		if (ctx->fmt == F_MDOC) fputs(" No ", out);
-		else fputc(' ', out);
+		if (ctx->fmt == F_MDOC) Sink_puts(out, " No ");
+		else Sink_putc(out, ' ');
 	    }
-	    else fputc('\n', out);
+	    else Sink_putc(out, '\n');
 	    col = 0;
 	    nl = 0;
 	}
-	if ((col || ctx->fmt == F_HTML) && space) ++col, fputc(' ', out);
-	if (odelim) fputc(odelim, out), ++col;
-	if (ctx->fmt == F_HTML) fputs(htmlescape(word), out);
-	else fputs(word, out);
+	if ((col || ctx->fmt == F_HTML) && space) ++col, Sink_putc(out, ' ');
+	if (odelim) Sink_putc(out, odelim), ++col;
+	writeEsc(out, ctx, s, sp->len);
 	if (oneword)
 	{
 	    oneword = 0;
@@ -577,192 +498,167 @@ static void writeManText(FILE *out, Ctx *ctx, const char *str)
     }
 }
 
-static int writeManSynopsis(FILE *out, Ctx *ctx, const CliDoc *root)
+static void writeManTextNode(Sink *out, Ctx *ctx, const CliDoc *text)
+{
+    size_t nspans;
+    const CDSpan *spans = CDText_spans(text, &nspans);
+    writeManText(out, ctx, CDText_strn(text, 0), spans, nspans);
+}
+
+static int writeManSynopsis(Sink *out, Ctx *ctx, const CliDoc *root)
 {
     switch (ctx->fmt)
     {
-	case F_MAN: fputs("\n.SH \"SYNOPSIS\"\n.PD 0", out); break;
-	case F_MDOC: fputs("\n.Sh SYNOPSIS", out); break;
-	case F_HTML: fputs("<h2>SYNOPSIS</h2>\n<dl class=\"synopsis\">\n",
-			     out); break;
+	case F_MAN: Sink_puts(out, "\n.SH \"SYNOPSIS\"\n.PD 0"); break;
+	case F_MDOC: Sink_puts(out, "\n.Sh SYNOPSIS"); break;
+	case F_HTML:
+	    Sink_puts(out, "<h2>SYNOPSIS</h2>\n<dl class=\"synopsis\">\n");
+	    break;
     }
     ctx->nflags = CDRoot_nflags(root);
     ctx->nargs = CDRoot_nargs(root);
 
     if (ctx->nflags + ctx->nargs == 0)
     {
-	if (ctx->fmt == F_HTML) fprintf(out,
-		"<dt>%s</dt><dd>&nbsp;</dd>", ctx->name);
-	else if (ctx->fmt == F_MDOC) fputs("\n.Nm", out);
-	else fprintf(out, "\n.HP 9n\n\\fB%s\\fR", ctx->name);
+	if (ctx->fmt == F_HTML) Sink_printf(out,
+		"<dt>%.*s</dt><dd>&nbsp;</dd>", (int)ctx->namelen, ctx->name);
+	else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.Nm");
+	else Sink_printf(out, "\n.HP 9n\n\\fB%.*s\\fR",
+		(int)ctx->namelen, ctx->name);
     }
     else
     {
-	int defgroup = CDRoot_defgroup(root);
-	for (int i = 0, n = 0; i <= defgroup || n; ++i, n = 0)
+	const char *synflags = CDRoot_synflags(root);
+	size_t ngroups = CDRoot_ngroups(root);
+	for (size_t i = 0; i < ngroups; ++i)
 	{
 	    if (ctx->fmt == F_HTML)
 	    {
-		fprintf(out, "<dt>%s</dt>\n<dd>\n", ctx->name);
+		Sink_printf(out, "<dt>%.*s</dt>\n<dd>\n",
+			(int)ctx->namelen, ctx->name);
 	    }
 	    else if (ctx->fmt == F_MDOC)
 	    {
-		fputs("\n.Nm", out);
+		Sink_puts(out, "\n.Nm");
 	    }
 	    else
 	    {
-		if (i) fputs("\n.br", out);
-		fprintf(out, "\n.HP 9n\n\\fB%s\\fR", ctx->name);
-	    }
-	    char noarg[128] = {0};
-	    char rnoarg[128] = {0};
-	    int nalen = 0;
-	    int rnalen = 0;
-	    for (size_t j = 0; j < ctx->nflags; ++j)
-	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		if (CDFlag_arg(flag)) continue;
-		if (CDFlag_flag(flag) == '-') continue;
-		if (CDFlag_optional(flag) == 0)
-		{
-		    rnoarg[rnalen++] = CDFlag_flag(flag);
-		    if (rnalen == sizeof rnoarg) err("too many flags");
-		}
-		else
-		{
-		    noarg[nalen++] = CDFlag_flag(flag);
-		    if (nalen == sizeof noarg) err("too many flags");
-		}
-	    }
-	    if (rnalen)
-	    {
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "<span class=\"flag\">-%s</span>\n",
-			    rnoarg);
-		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Fl %s"
-			: "\n\\fB\\-%s\\fR", rnoarg);
-		++n;
+		if (i) Sink_puts(out, "\n.br");
+		Sink_printf(out, "\n.HP 9n\n\\fB%.*s\\fR",
+			(int)ctx->namelen, ctx->name);
 	    }
-	    if (nalen)
+	    size_t nitems;
+	    const CDSynItem *item = CDRoot_group(root, i, &nitems);
+	    for (const CDSynItem *end = item + nitems; item < end; ++item)
 	    {
-		if (ctx->fmt == F_HTML)
+		const CliDoc *flag = 0;
+		const char *arg = 0;
+		size_t arglen = 0;
+		if (item->type >= SY_ARG)
 		{
-		    fprintf(out, "[<span class=\"flag\">-%s</span>]\n",
-			    noarg);
+		    arg = CDArg_argn(CDRoot_arg(root, item->index), &arglen);
 		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Op Fl %s"
-			: "\n[\\fB\\-%s\\fR]", noarg);
-		++n;
-	    }
-	    for (size_t j = 0; j < ctx->nflags; ++j)
-	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		if (CDFlag_optional(flag)) continue;
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *arg = CDFlag_arg(flag);
-		if (!arg) continue;
-		if (ctx->fmt == F_HTML)
+		else if (item->type >= SY_FLAGARG)
 		{
-		    fprintf(out, "<span class=\"flag\">-%c</span>"
-			    "&nbsp;<span class=\"arg\">%s</span>\n",
-			    CDFlag_flag(flag), arg);
+		    flag = CDRoot_flag(root, item->index);
+		    arg = CDFlag_argn(flag, &arglen);
 		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Fl %c Ar %s"
-			: "\n\\fB\\-%c\\fR\\ \\fI%s\\fR",
-			CDFlag_flag(flag), arg);
-		++n;
-	    }
-	    for (size_t j = 0; j < ctx->nflags; ++j)
-	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		if (!CDFlag_optional(flag)) continue;
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *arg = CDFlag_arg(flag);
-		if (!arg)
+		switch (item->type)
 		{
-		    if (CDFlag_flag(flag) == '-')
-		    {
+		    case SY_FLAGS:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out, "<span class=\"flag\">-%.*s"
+				    "</span>\n", (int)item->len,
+				    synflags + item->index);
+			}
+			else Sink_printf(out, ctx->fmt == F_MDOC
+				? "\n.Fl %.*s" : "\n\\fB\\-%.*s\\fR",
+				(int)item->len, synflags + item->index);
+			break;
+
+		    case SY_OPTFLAGS:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out, "[<span class=\"flag\">-%.*s"
+				    "</span>]\n", (int)item->len,
+				    synflags + item->index);
+			}
+			else Sink_printf(out, ctx->fmt == F_MDOC
+				? "\n.Op Fl %.*s" : "\n[\\fB\\-%.*s\\fR]",
+				(int)item->len, synflags + item->index);
+			break;
+
+		    case SY_FLAGARG:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out, "<span class=\"flag\">-%c</span>"
+				    "&nbsp;<span class=\"arg\">%.*s</span>\n",
+				    CDFlag_flag(flag), (int)arglen, arg);
+			}
+			else Sink_printf(out, ctx->fmt == F_MDOC
+				? "\n.Fl %c Ar %.*s"
+				: "\n\\fB\\-%c\\fR\\ \\fI%.*s\\fR",
+				CDFlag_flag(flag), (int)arglen, arg);
+			break;
+
+		    case SY_OPTFLAGARG:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out, "[<span class=\"flag\">-%c</span>"
+				    "&nbsp;<span class=\"arg\">%.*s</span>]\n",
+				    CDFlag_flag(flag), (int)arglen, arg);
+			}
+			else Sink_printf(out, ctx->fmt == F_MDOC
+				? "\n.Op Fl %c Ar %.*s"
+				: "\n[\\fB\\-%c\\fR\\ \\fI%.*s\\fR]",
+				CDFlag_flag(flag), (int)arglen, arg);
+			break;
+
+		    case SY_SEPARATOR:
 			++ctx->separators;
-			fputs(ctx->fmt == F_HTML ?
-				"[<span class=\"flag\">"
-				"--</span>]\n" :
+			Sink_puts(out, ctx->fmt == F_HTML ?
+				"[<span class=\"flag\">--</span>]\n" :
 				ctx->fmt == F_MDOC ?
-				"\n.Op Fl -" : "\n[\\fB\\-\\-\\fR]", out);
-		    }
-		    continue;
-		}
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "[<span class=\"flag\">-%c</span>"
-			    "&nbsp;<span class=\"arg\">%s</span>]\n",
-			    CDFlag_flag(flag), arg);
-		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Op Fl %c Ar %s"
-			: "\n[\\fB\\-%c\\fR\\ \\fI%s\\fR]",
-			CDFlag_flag(flag), arg);
-		++n;
-	    }
-	    for (size_t j = 0; j < ctx->nargs; ++j)
-	    {
-		const CliDoc *arg = CDRoot_arg(root, j);
-		if (CDArg_optional(arg)) continue;
-		int group = CDArg_group(arg);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "<span class=\"arg\">%s</span>\n",
-			    CDArg_arg(arg));
-		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Ar %s"
-			: "\n\\fI%s\\fR", CDArg_arg(arg));
-		++n;
-	    }
-	    for (size_t j = 0; j < ctx->nargs; ++j)
-	    {
-		const CliDoc *arg = CDRoot_arg(root, j);
-		if (!CDArg_optional(arg)) continue;
-		int group = CDArg_group(arg);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		if (ctx->fmt == F_HTML)
-		{
-		    fprintf(out, "[<span class=\"arg\">%s</span>]\n",
-			    CDArg_arg(arg));
+				"\n.Op Fl -" : "\n[\\fB\\-\\-\\fR]");
+			break;
+
+		    case SY_ARG:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out,
+				    "<span class=\"arg\">%.*s</span>\n",
+				    (int)arglen, arg);
+			}
+			else Sink_printf(out, ctx->fmt == F_MDOC ? "\n.Ar %.*s"
+				: "\n\\fI%.*s\\fR", (int)arglen, arg);
+			break;
+
+		    case SY_OPTARG:
+			if (ctx->fmt == F_HTML)
+			{
+			    Sink_printf(out,
+				    "[<span class=\"arg\">%.*s</span>]\n",
+				    (int)arglen, arg);
+			}
+			else Sink_printf(out,
+				ctx->fmt == F_MDOC ? "\n.Op Ar %.*s"
+				: "\n[\\fI%.*s\\fR]", (int)arglen, arg);
+			break;
 		}
-		else fprintf(out, ctx->fmt == F_MDOC ? "\n.Op Ar %s"
-			: "\n[\\fI%s\\fR]", CDArg_arg(arg));
-		++n;
 	    }
-	    if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
     }
-    if (ctx->fmt == F_MAN) fputs("\n.PD", out);
-    else if (ctx->fmt == F_HTML) fputs("</dl>\n", out);
+    if (ctx->fmt == F_MAN) Sink_puts(out, "\n.PD");
+    else if (ctx->fmt == F_HTML) Sink_puts(out, "</dl>\n");
     return 0;
-
-error:
-    return -1;
 }
 
-static int writeManDescription(FILE *out, Ctx *ctx,
+static int writeManDescription(Sink *out, Ctx *ctx,
 	const CliDoc *desc, int idx);
 
-static int writeManList(FILE *out, Ctx *ctx, const CliDoc *list)
+static int writeManList(Sink *out, Ctx *ctx, const CliDoc *list)
 {
     size_t len = CDList_length(list);
     for (size_t i = 0; i < len; ++i)
@@ -777,35 +673,18 @@ error:
 }
 
 static void updateMdocCellWidth(size_t *len, char *str, const Ctx *ctx,
-	const char *cell)
+	const CDSpan *spans, size_t nspans, size_t celllen)
 {
-    size_t cellwidth = 0;
-    Ctx fakeCtx = Ctx_init(0, F_HTML, 0);
-    while (*cell == ' ' || *cell == '\t') ++cell;
-    while (*cell)
+    if (!nspans) return;
+    size_t cellwidth = celllen - spans->off;
+    for (const CDSpan *sp = spans; sp < spans + nspans; ++sp)
     {
-	while (*cell == ' ' || *cell == '\t' || ismpunct(*cell))
-	{
-	    ++cell;
-	    ++cellwidth;
-	}
-	char *word = fetchManTextWord(&cell, &fakeCtx);
-	if (!word) break;
-	size_t wordlen = strlen(word);
-	if (!strcmp(word, "%%name%%")) wordlen = strlen(ctx->name);
-	else if (ctx->arg && !strcmp(word, "%%arg%%"))
-	{
-	    wordlen = strlen(ctx->arg);
-	}
-	else if (ctx->var && !strcmp(word, "%%var%%"))
-	{
-	    wordlen = strlen(ctx->var);
-	}
-	else if (word[0] == '`' && word[wordlen-1] == '`')
-	{
-	    wordlen -= 2;
-	}
-	cellwidth += wordlen;
+	size_t wordlen = sp->len;
+	if (sp->type == SP_NAME) wordlen = ctx->namelen;
+	else if (sp->type == SP_ARG && ctx->arg) wordlen = ctx->arglen;
+	else if (sp->type == SP_VAR && ctx->var) wordlen = ctx->varlen;
+	else if (sp->type >= SP_FLAG && sp->type <= SP_LITERAL) wordlen -= 2;
+	cellwidth = cellwidth - sp->len + wordlen;
     }
     if (cellwidth > 31) cellwidth = 31;
     if (--cellwidth > *len)
@@ -816,11 +695,11 @@ static void updateMdocCellWidth(size_t *len, char *str, const Ctx *ctx,
     }
 }
 
-static void writeManTable(FILE *out, Ctx *ctx, const CliDoc *table)
+static void writeManTable(Sink *out, Ctx *ctx, const CliDoc *table)
 {
     size_t width = CDTable_width(table);
     size_t height = CDTable_height(table);
-    if (ctx->fmt == F_HTML) fputs("<table>\n", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "<table>\n");
     else if (ctx->fmt == F_MDOC)
     {
 	struct {
@@ -833,97 +712,108 @@ static void writeManTable(FILE *out, Ctx *ctx, const CliDoc *table)
 	{
 	    for (size_t x = 0; x < width; ++x)
 	    {
-		const char *c = CDTable_cell(table, x, y);
-		updateMdocCellWidth(&wspec[x].len, wspec[x].str, ctx, c);
+		size_t clen;
+		size_t nspans;
+		CDTable_celln(table, x, y, &clen);
+		const CDSpan *spans = CDTable_cellspans(table, x, y, &nspans);
+		updateMdocCellWidth(&wspec[x].len, wspec[x].str, ctx,
+			spans, nspans, clen);
 	    }
 	}
-	fputs("\n.Bl -column -compact", out);
+	Sink_puts(out, "\n.Bl -column -compact");
 	for (size_t x = 0; x < width; ++x)
 	{
-	    fprintf(out, " %s", wspec[x].str);
+	    Sink_printf(out, " %s", wspec[x].str);
 	}
 	free(wspec);
     }
     else
     {
-	fputs("\n.TS", out);
+	Sink_puts(out, "\n.TS");
 	for (size_t x = 0; x < width; ++x)
 	{
-	    fputc(x ? ' ' : '\n', out);
-	    fputc('l', out);
+	    Sink_putc(out, x ? ' ' : '\n');
+	    Sink_putc(out, 'l');
 	}
-	fputc('.', out);
+	Sink_putc(out, '.');
     }
     ctx->tblcell = 1;
     for (size_t y = 0; y < height; ++y)
     {
-	if (ctx->fmt == F_HTML) fputs("<tr>\n", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "<tr>\n");
 	for (size_t x = 0; x < width; ++x)
 	{
-	    if (ctx->fmt == F_HTML) fputs("<td>\n", out);
-	    else if (ctx->fmt == F_MDOC) fputs(x ? " Ta " : "\n.It ", out);
-	    else fputc(x ? '\t' : '\n', out);
-	    writeManText(out, ctx, CDTable_cell(table, x, y));
-	    if (ctx->fmt == F_HTML) fputs("</td>\n", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "<td>\n");
+	    else if (ctx->fmt == F_MDOC) Sink_puts(out, x ? " Ta " : "\n.It ");
+	    else Sink_putc(out, x ? '\t' : '\n');
+	    size_t nspans;
+	    const CDSpan *spans = CDTable_cellspans(table, x, y, &nspans);
+	    writeManText(out, ctx, CDTable_celln(table, x, y, 0),
+		    spans, nspans);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</td>\n");
 	}
-	if (ctx->fmt == F_HTML) fputs("</tr>\n", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "</tr>\n");
     }
     ctx->tblcell = 0;
-    if (ctx->fmt == F_HTML) fputs("</table>\n", out);
-    else if (ctx->fmt == F_MDOC) fputs("\n.El", out);
-    else fputs("\n.TE", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "</table>\n");
+    else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.El");
+    else Sink_puts(out, "\n.TE");
 }
 
-static int writeManDict(FILE *out, Ctx *ctx, const CliDoc *dict)
+static int writeManDict(Sink *out, Ctx *ctx, const CliDoc *dict)
 {
-    if (ctx->fmt == F_HTML) fputs("<dl class=\"description\">\n", out);
-    else if (ctx->fmt == F_MDOC) fputs("\n.Bl -tag -width Ds -compact", out);
-    else fputs("\n.PD 0\n.RS 8n", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "<dl class=\"description\">\n");
+    else if (ctx->fmt == F_MDOC)
+    {
+	Sink_puts(out, "\n.Bl -tag -width Ds -compact");
+    }
+    else Sink_puts(out, "\n.PD 0\n.RS 8n");
     size_t len = CDDict_length(dict);
     for (size_t i = 0; i < len; ++i)
     {
-	const char *key = CDDict_key(dict, i);
+	size_t nspans;
+	const CDSpan *spans = CDDict_keyspans(dict, i, &nspans);
 	const CliDoc *val = CDDict_val(dict, i);
-	if (ctx->fmt == F_HTML) fputs("<dt>", out);
-	else if (ctx->fmt == F_MDOC) fputs("\n.It ", out);
-	else fputs("\n.TP 8n\n", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "<dt>");
+	else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.It ");
+	else Sink_puts(out, "\n.TP 8n\n");
 	ctx->tblcell = 1;
-	writeManText(out, ctx, key);
+	writeManText(out, ctx, CDDict_keyn(dict, i, 0), spans, nspans);
 	ctx->tblcell = 0;
-	if (ctx->fmt == F_HTML) fputs("</dt>\n<dd>", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "</dt>\n<dd>");
 	if (writeManDescription(out, ctx, val, 0) < 0) return -1;
-	if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
     }
-    if (ctx->fmt == F_HTML) fputs("</dl>\n", out);
-    else if (ctx->fmt == F_MDOC) fputs("\n.El", out);
-    else fputs("\n.PD\n.RE", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "</dl>\n");
+    else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.El");
+    else Sink_puts(out, "\n.PD\n.RE");
     return 0;
 }
 
-static int writeManDescription(FILE *out, Ctx *ctx,
+static int writeManDescription(Sink *out, Ctx *ctx,
 	const CliDoc *desc, int idx)
 {
     if (!desc) return 0;
     switch (CliDoc_type(desc))
     {
 	case CT_TEXT:
-	    if (ctx->fmt == F_HTML) fputs("<p>", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "<p>");
 	    else
 	    {
-		if (idx) fputs("\n.sp", out);
-		fputc('\n', out);
+		if (idx) Sink_puts(out, "\n.sp");
+		Sink_putc(out, '\n');
 	    }
-	    writeManText(out, ctx, CDText_str(desc));
-	    if (ctx->fmt == F_HTML) fputs("</p>\n", out);
+	    writeManTextNode(out, ctx, desc);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</p>\n");
 	    break;
 	
 	case CT_DICT:
-	    if (idx && ctx->fmt != F_HTML) fputs("\n.sp", out);
+	    if (idx && ctx->fmt != F_HTML) Sink_puts(out, "\n.sp");
 	    if (writeManDict(out, ctx, desc) < 0) goto error;
 	    break;
 
 	case CT_TABLE:
-	    if (idx && ctx->fmt == F_MDOC) fputs("\n.sp", out);
+	    if (idx && ctx->fmt == F_MDOC) Sink_puts(out, "\n.sp");
 	    writeManTable(out, ctx, desc);
 	    break;
 
@@ -940,9 +830,9 @@ error:
     return -1;
 }
 
-static int writeManArgDesc(FILE *out, Ctx *ctx, const CliDoc *arg)
+static int writeManArgDesc(Sink *out, Ctx *ctx, const CliDoc *arg)
 {
-    if (ctx->fmt == F_HTML) fputs("<dd>\n", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "<dd>\n");
     if (writeManDescription(out, ctx,
 		CDArg_description(arg), 0) < 0) return -1;
     const CliDoc *min = CDArg_min(arg);
@@ -950,43 +840,45 @@ static int writeManArgDesc(FILE *out, Ctx *ctx, const CliDoc *arg)
     const CliDoc *def = CDArg_default(arg);
     if (min || max || def)
     {
-	if (ctx->fmt == F_HTML) fputs("<dl class=\"meta\">\n", out);
-	else if (ctx->fmt == F_MDOC) fputs(
-		"\n.sp\n.Bl -tag -width default: -compact", out);
-	else fputs("\n.sp\n.PD 0\n.RS 8n", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "<dl class=\"meta\">\n");
+	else if (ctx->fmt == F_MDOC)
+	{
+	    Sink_puts(out, "\n.sp\n.Bl -tag -width default: -compact");
+	}
+	else Sink_puts(out, "\n.sp\n.PD 0\n.RS 8n");
 	if (min)
 	{
-	    if (ctx->fmt == F_HTML) fputs("<dt>min:</dt><dd>", out);
-	    else if (ctx->fmt == F_MDOC) fputs("\n.It min:", out);
-	    else fputs("\n.TP 10n\nmin:", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "<dt>min:</dt><dd>");
+	    else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.It min:");
+	    else Sink_puts(out, "\n.TP 10n\nmin:");
 	    if (writeManDescription(out, ctx, min, 0) < 0) return -1;
-	    if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
 	if (max)
 	{
-	    if (ctx->fmt == F_HTML) fputs("<dt>max:</dt><dd>", out);
-	    else if (ctx->fmt == F_MDOC) fputs("\n.It max:", out);
-	    else fputs("\n.TP 10n\nmax:", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "<dt>max:</dt><dd>");
+	    else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.It max:");
+	    else Sink_puts(out, "\n.TP 10n\nmax:");
 	    if (writeManDescription(out, ctx, max, 0) < 0) return -1;
-	    if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
 	if (def)
 	{
-	    if (ctx->fmt == F_HTML) fputs("<dt>default:</dt><dd>", out);
-	    else if (ctx->fmt == F_MDOC) fputs("\n.It default:", out);
-	    else fputs("\n.TP 10n\ndefault:", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "<dt>default:</dt><dd>");
+	    else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.It default:");
+	    else Sink_puts(out, "\n.TP 10n\ndefault:");
 	    if (writeManDescription(out, ctx, def, 0) < 0) return -1;
-	    if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+	    if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
-	if (ctx->fmt == F_HTML) fputs("</dl>\n", out);
-	else if (ctx->fmt == F_MDOC) fputs("\n.El", out);
-	else fputs("\n.PD\n.RE", out);
+	if (ctx->fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	else if (ctx->fmt == F_MDOC) Sink_puts(out, "\n.El");
+	else Sink_puts(out, "\n.PD\n.RE");
     }
-    if (ctx->fmt == F_HTML) fputs("</dd>\n", out);
+    if (ctx->fmt == F_HTML) Sink_puts(out, "</dd>\n");
     return 0;
 }
 
-static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
+static int write(Sink *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
 {
     assert(CliDoc_type(root) == CT_ROOT);
     
@@ -996,124 +888,141 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
     if (!date || CliDoc_type(date) != CT_DATE) err("missing date");
     const CliDoc *name = CDRoot_name(root);
     if (!istext(name)) err("missing name");
-    ctx.name = CDText_str(name);
+    ctx.name = CDText_strn(name, &ctx.namelen);
     const CliDoc *version = CDRoot_version(root);
+    const char *verstr = 0;
+    size_t verlen = 0;
+    if (istext(version)) verstr = CDText_strn(version, &verlen);
     const CliDoc *comment = CDRoot_comment(root);
     if (!istext(comment)) err("missing comment");
+    size_t commentlen;
+    const char *commentstr = CDText_strn(comment, &commentlen);
     const char *sect = opts->sect;
     if (!sect) sect = "1";
 
     time_t dv = CDDate_date(date);
-    struct tm *tm = localtime(&dv);
+    struct tm tmbuf;
+    struct tm *tm = localtime_r(&dv, &tmbuf);
     if (fmt == F_HTML)
     {
-	char *sectname = copystr(htmlescape(opts->sectname ?
-		    opts->sectname : "General Commands Manual"));
-	const char *title = strToUpper(htmlescape(ctx.name));
-	if (opts->style) fprintf(out, HTML_HEADER_STYLE(opts->style,
-		    title, sect, sectname));
-	else if (opts->styleuri) fprintf(out,
-		HTML_HEADER_STYLEURI(htmlescape(opts->styleuri),
+	const char *sn = opts->sectname ?
+	    opts->sectname : "General Commands Manual";
+	char *sectname = htmlstr(sn, strlen(sn), 0);
+	char *title = htmlstr(ctx.name, ctx.namelen, 1);
+	if (opts->style) Sink_printf(out, HTML_HEADER_STYLE(opts->style,
 		    title, sect, sectname));
-	else fprintf(out, HTML_HEADER_STYLE(HTML_DEFAULT_STYLE,
+	else if (opts->styleuri)
+	{
+	    char *uri = htmlstr(opts->styleuri, strlen(opts->styleuri), 0);
+	    Sink_printf(out, HTML_HEADER_STYLEURI(uri, title, sect, sectname));
+	    free(uri);
+	}
+	else Sink_printf(out, HTML_HEADER_STYLE(HTML_DEFAULT_STYLE,
 		    title, sect, sectname));
-	fprintf(out, "<h2>NAME</h2>\n<dl class=\"name\">\n"
-		"<dt><span class=\"name\">%s</span> &ndash;</dt>\n"
-		"<dd>", htmlescape(ctx.name));
-	writeManText(out, &ctx, CDText_str(comment));
-	fputs("</dd>\n</dl>\n", out);
+	Sink_puts(out, "<h2>NAME</h2>\n<dl class=\"name\">\n"
+		"<dt><span class=\"name\">");
+	Sink_escape(out, ctx.name, ctx.namelen, htmlesc);
+	Sink_puts(out, "</span> &ndash;</dt>\n<dd>");
+	writeManTextNode(out, &ctx, comment);
+	Sink_puts(out, "</dd>\n</dl>\n");
+	free(title);
 	free(sectname);
     }
     else if (fmt == F_MDOC)
     {
-	size_t mlen = strftime(strbuf, sizeof strbuf, "%B", tm);
-	snprintf(strbuf + mlen, sizeof strbuf - mlen,
-		" %d, %d", tm->tm_mday, tm->tm_year + 1900);
-	fprintf(out, ".Dd %s", strbuf);
-	fprintf(out, "\n.Dt %s %s\n.Os", strToUpper(ctx.name), sect);
+	Sink_puts(out, ".Dd ");
+	writeDate(out, tm);
+	Sink_puts(out, "\n.Dt ");
+	writeUpper(out, ctx.name, ctx.namelen, 0);
+	Sink_printf(out, " %s\n.Os", sect);
 	if (opts->os)
 	{
-	    fprintf(out, " %s", ctx.name);
-	    if (istext(version)) fprintf(out, " %s", CDText_str(version));
+	    Sink_printf(out, " %.*s", (int)ctx.namelen, ctx.name);
+	    if (verstr) Sink_printf(out, " %.*s", (int)verlen, verstr);
 	}
-	fprintf(out, "\n.Sh NAME\n.Nm %s\n.Nd %s",
-		ctx.name, CDText_str(comment));
+	Sink_printf(out, "\n.Sh NAME\n.Nm %.*s\n.Nd %.*s",
+		(int)ctx.namelen, ctx.name, (int)commentlen, commentstr);
     }
     else
     {
-	fprintf(out, ".TH \"%s\" \"%s\" ", strToUpper(ctx.name), sect);
-	size_t mlen = strftime(strbuf, sizeof strbuf, "%B", tm);
-	snprintf(strbuf + mlen, sizeof strbuf - mlen,
-		" %d, %d", tm->tm_mday, tm->tm_year + 1900);
-	fprintf(out, "\"%s\" \"%s", strbuf, ctx.name);
-	if (istext(version)) fprintf(out, " %s", CDText_str(version));
-	fputs("\"\n.nh\n.if n .ad l\n.SH \"NAME\"", out);
-	fprintf(out, "\n\\fB%s\\fR\n\\- %s", ctx.name, CDText_str(comment));
+	Sink_puts(out, ".TH \"");
+	writeUpper(out, ctx.name, ctx.namelen, 0);
+	Sink_printf(out, "\" \"%s\" \"", sect);
+	writeDate(out, tm);
+	Sink_printf(out, "\" \"%.*s", (int)ctx.namelen, ctx.name);
+	if (verstr) Sink_printf(out, " %.*s", (int)verlen, verstr);
+	Sink_puts(out, "\"\n.nh\n.if n .ad l\n.SH \"NAME\"");
+	Sink_printf(out, "\n\\fB%.*s\\fR\n\\- %.*s",
+		(int)ctx.namelen, ctx.name, (int)commentlen, commentstr);
     }
 
     if (writeManSynopsis(out, &ctx, root) < 0) goto error;
 
-    if (fmt == F_HTML) fputs("<h2>DESCRIPTION</h2>\n", out);
-    else if (fmt == F_MDOC) fputs("\n.Sh DESCRIPTION", out);
-    else fputs("\n.SH \"DESCRIPTION\"", out);
+    if (fmt == F_HTML) Sink_puts(out, "<h2>DESCRIPTION</h2>\n");
+    else if (fmt == F_MDOC) Sink_puts(out, "\n.Sh DESCRIPTION");
+    else Sink_puts(out, "\n.SH \"DESCRIPTION\"");
     if (writeManDescription(out, &ctx,
 		CDRoot_description(root), 0) < 0) goto error;
 
     if (ctx.nflags + ctx.nargs - ctx.separators > 0)
     {
-	fputs(fmt == F_HTML ? "<p>The options are as follows:</p>\n"
-		: "\n.sp\nThe options are as follows:", out);
-	if (fmt == F_HTML) fputs("<dl class=\"description\">\n", out);
-	if (fmt == F_MDOC) fputs("\n.Bl -tag -width Ds", out);
+	Sink_puts(out, fmt == F_HTML ? "<p>The options are as follows:</p>\n"
+		: "\n.sp\nThe options are as follows:");
+	if (fmt == F_HTML) Sink_puts(out, "<dl class=\"description\">\n");
+	if (fmt == F_MDOC) Sink_puts(out, "\n.Bl -tag -width Ds");
 	for (size_t i = 0; i < ctx.nflags; ++i)
 	{
 	    const CliDoc *flag = CDRoot_flag(root, i);
 	    if (CDFlag_flag(flag) == '-') continue;
-	    if (fmt == F_MAN) fputs("\n.TP 8n", out);
-	    const char *arg = CDFlag_arg(flag);
+	    if (fmt == F_MAN) Sink_puts(out, "\n.TP 8n");
+	    size_t arglen;
+	    const char *arg = CDFlag_argn(flag, &arglen);
 	    if (arg)
 	    {
 		ctx.arg = arg;
+		ctx.arglen = arglen;
 		if (fmt == F_HTML)
 		{
-		    fprintf(out, "<dt><span class=\"flag\">-%c</span>"
-			    "&nbsp;<span class=\"arg\">%s</span></dt>\n",
-			    CDFlag_flag(flag), htmlescape(arg));
+		    Sink_printf(out, "<dt><span class=\"flag\">-%c</span>"
+			    "&nbsp;<span class=\"arg\">", CDFlag_flag(flag));
+		    Sink_escape(out, arg, arglen, htmlesc);
+		    Sink_puts(out, "</span></dt>\n");
 		}
-		else fprintf(out, fmt == F_MDOC ? "\n.It Fl %c Ar %s"
-			: "\n\\fB\\-%c\\fR \\fI%s\\fR\\ ",
-			CDFlag_flag(flag), arg);
+		else Sink_printf(out, fmt == F_MDOC ? "\n.It Fl %c Ar %.*s"
+			: "\n\\fB\\-%c\\fR \\fI%.*s\\fR\\ ",
+			CDFlag_flag(flag), (int)arglen, arg);
 	    }
 	    else
 	    {
 		ctx.arg = 0;
 		if (fmt == F_HTML)
 		{
-		    fprintf(out,
+		    Sink_printf(out,
 			    "<dt><span class=\"flag\">-%c</span></dt>\n",
 			    CDFlag_flag(flag));
 		}
-		else fprintf(out, fmt == F_MDOC ? "\n.It Fl %c"
+		else Sink_printf(out, fmt == F_MDOC ? "\n.It Fl %c"
 			: "\n\\fB\\-%c\\fR\\ ", CDFlag_flag(flag));
 	    }
 	    if (writeManArgDesc(out, &ctx, flag) < 0) goto error;
 	}
 	for (size_t i = 0; i < ctx.nargs; ++i)
 	{
-	    if (fmt == F_MAN) fputs("\n.TP 8n", out);
+	    if (fmt == F_MAN) Sink_puts(out, "\n.TP 8n");
 	    const CliDoc *arg = CDRoot_arg(root, i);
-	    ctx.arg = CDArg_arg(arg);
+	    ctx.arg = CDArg_argn(arg, &ctx.arglen);
 	    if (fmt == F_HTML)
 	    {
-		fprintf(out, "<dt><span class=\"arg\">%s</span></dt>\n",
-			htmlescape(ctx.arg));
+		Sink_puts(out, "<dt><span class=\"arg\">");
+		Sink_escape(out, ctx.arg, ctx.arglen, htmlesc);
+		Sink_puts(out, "</span></dt>\n");
 	    }
-	    else fprintf(out, fmt == F_MDOC ?
-		    "\n.It Ar %s" : "\n\\fI%s\\fR\\ ", ctx.arg);
+	    else Sink_printf(out, fmt == F_MDOC ? "\n.It Ar %.*s"
+		    : "\n\\fI%.*s\\fR\\ ", (int)ctx.arglen, ctx.arg);
 	    if (writeManArgDesc(out, &ctx, arg) < 0) goto error;
 	}
-	if (fmt == F_HTML) fputs("</dl>\n", out);
-	if (fmt == F_MDOC) fputs("\n.El", out);
+	if (fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	if (fmt == F_MDOC) Sink_puts(out, "\n.El");
     }
 
     const CliDoc *license = CDRoot_license(root);
@@ -1122,49 +1031,58 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
     {
 	if (fmt == F_HTML)
 	{
-	    fputs("<h3>Additional information</h3>\n<dl class=\"meta\">\n",
-		    out);
+	    Sink_puts(out, "<h3>Additional information</h3>\n"
+		    "<dl class=\"meta\">\n");
 	}
-	else if (fmt == F_MDOC) fputs("\n.Ss Additional information\n"
-		".Bl -tag -width Version: -compact", out);
-	else fputs("\n.SS \"Additional information\"\n.PD 0", out);
+	else if (fmt == F_MDOC) Sink_puts(out, "\n.Ss Additional information\n"
+		".Bl -tag -width Version: -compact");
+	else Sink_puts(out, "\n.SS \"Additional information\"\n.PD 0");
 	if (istext(version))
 	{
-	    if (fmt == F_HTML) fprintf(out, "<dt>Version:</dt>\n"
-		    "<dd><span class=\"name\">%s</span> %s</dd>\n",
-		    ctx.name, htmlescape(CDText_str(version)));
-	    else if (fmt == F_MDOC) fprintf(out, "\n.It Version:\n.Nm\n%s",
-		    CDText_str(version));
-	    else fprintf(out, "\n.TP 10n\nVersion:\n\\fB%s\\fR\n%s",
-		    ctx.name, CDText_str(version));
+	    if (fmt == F_HTML)
+	    {
+		Sink_printf(out, "<dt>Version:</dt>\n"
+			"<dd><span class=\"name\">%.*s</span> ",
+			(int)ctx.namelen, ctx.name);
+		Sink_escape(out, verstr, verlen, htmlesc);
+		Sink_puts(out, "</dd>\n");
+	    }
+	    else if (fmt == F_MDOC) Sink_printf(out,
+		    "\n.It Version:\n.Nm\n%.*s", (int)verlen, verstr);
+	    else Sink_printf(out, "\n.TP 10n\nVersion:\n\\fB%.*s\\fR\n%.*s",
+		    (int)ctx.namelen, ctx.name, (int)verlen, verstr);
 	}
 	if (istext(license))
 	{
-	    if (fmt == F_HTML) fputs("<dt>License:</dt><dd>", out);
-	    else if (fmt == F_MDOC) fputs("\n.It License:\n", out);
-	    else fputs("\n.TP 10n\nLicense:\n", out);
-	    writeManText(out, &ctx, CDText_str(license));
-	    if (fmt == F_HTML) fputs("</dd>\n", out);
+	    if (fmt == F_HTML) Sink_puts(out, "<dt>License:</dt><dd>");
+	    else if (fmt == F_MDOC) Sink_puts(out, "\n.It License:\n");
+	    else Sink_puts(out, "\n.TP 10n\nLicense:\n");
+	    writeManTextNode(out, &ctx, license);
+	    if (fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
 	if (istext(www))
 	{
+	    size_t wwwlen;
+	    const char *wwwstr = CDText_strn(www, &wwwlen);
 	    if (fmt == F_HTML)
 	    {
-		char *escaped = htmlescape(CDText_str(www));
-		fprintf(out, "<dt>WWW:</dt><dd><a href=\"%s\">%s</a></dd>\n",
-			escaped, escaped);
+		Sink_puts(out, "<dt>WWW:</dt><dd><a href=\"");
+		Sink_escape(out, wwwstr, wwwlen, htmlesc);
+		Sink_puts(out, "\">");
+		Sink_escape(out, wwwstr, wwwlen, htmlesc);
+		Sink_puts(out, "</a></dd>\n");
 	    }
 	    else
 	    {
-		if (fmt == F_MDOC) fputs("\n.It WWW:\n.Lk ", out);
-		else fputs("\n.TP 10n\nWWW:\n\\fB", out);
-		writeManText(out, &ctx, CDText_str(www));
-		if (fmt == F_MAN) fputs("\\fR", out);
+		if (fmt == F_MDOC) Sink_puts(out, "\n.It WWW:\n.Lk ");
+		else Sink_puts(out, "\n.TP 10n\nWWW:\n\\fB");
+		writeManTextNode(out, &ctx, www);
+		if (fmt == F_MAN) Sink_puts(out, "\\fR");
 	    }
 	}
-	if (fmt == F_HTML) fputs("</dl>\n", out);
-	else if (fmt == F_MDOC) fputs("\n.El", out);
-	else fputs("\n.PD", out);
+	if (fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	else if (fmt == F_MDOC) Sink_puts(out, "\n.El");
+	else Sink_puts(out, "\n.PD");
     }
 
     size_t nvars = CDRoot_nvars(root);
@@ -1172,19 +1090,21 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
     {
 	struct {
 	    const char *tag;
+	    size_t taglen;
 	    size_t tagwidth;
-	} wspec = {0, 0};
+	} wspec = {0, 0, 0};
 
 	if (fmt != F_HTML)
 	{
 	    for (size_t i = 0; i < nvars; ++i)
 	    {
 		const CliDoc *var = CDRoot_var(root, i);
-		const char *vname = CDNamed_name(var);
-		size_t namelen = strlen(vname);
+		size_t namelen;
+		const char *vname = CDNamed_namen(var, &namelen);
 		if (namelen > wspec.tagwidth)
 		{
 		    wspec.tag = vname;
+		    wspec.taglen = namelen;
 		    wspec.tagwidth = namelen;
 		}
 	    }
@@ -1193,35 +1113,40 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
 
 	if (fmt == F_HTML)
 	{
-	    fputs("<h2>ENVIRONMENT</h2>\n<dl class=\"environment\">\n", out);
+	    Sink_puts(out, "<h2>ENVIRONMENT</h2>\n"
+		    "<dl class=\"environment\">\n");
 	}
 	else if (fmt == F_MDOC)
 	{
-	    fprintf(out, "\n.Sh ENVIRONMENT\n.Bl -tag -width \"%s\"",
-		    wspec.tag);
+	    Sink_printf(out, "\n.Sh ENVIRONMENT\n.Bl -tag -width \"%.*s\"",
+		    (int)wspec.taglen, wspec.tag);
 	}
-	else fputs("\n.SH \"ENVIRONMENT\"", out);
+	else Sink_puts(out, "\n.SH \"ENVIRONMENT\"");
 	for (size_t i = 0; i < nvars; ++i)
 	{
-	    if (fmt == F_MAN) fprintf(out, "\n.TP %un",
-		    (unsigned)wspec.tagwidth);
+	    if (fmt == F_MAN)
+	    {
+		Sink_puts(out, "\n.TP ");
+		Sink_putuint(out, wspec.tagwidth);
+		Sink_putc(out, 'n');
+	    }
 	    const CliDoc *var = CDRoot_var(root, i);
-	    ctx.var = CDNamed_name(var);
+	    ctx.var = CDNamed_namen(var, &ctx.varlen);
 	    if (fmt == F_HTML)
 	    {
-		fprintf(out,
-			"<dt><span class=\"name\">%s</span></dt>\n<dd>\n",
-			htmlescape(ctx.var));
+		Sink_puts(out, "<dt><span class=\"name\">");
+		Sink_escape(out, ctx.var, ctx.varlen, htmlesc);
+		Sink_puts(out, "</span></dt>\n<dd>\n");
 	    }
-	    else fprintf(out, fmt == F_MDOC ? "\n.It Ev %s" : "\n\\fB%s\\fR",
-		    ctx.var);
+	    else Sink_printf(out, fmt == F_MDOC ? "\n.It Ev %.*s"
+		    : "\n\\fB%.*s\\fR", (int)ctx.varlen, ctx.var);
 	    if (writeManDescription(out, &ctx,
 			CDNamed_description(var), 0) < 0) goto error;
-	    if (fmt == F_HTML) fputs("</dd>\n", out);
+	    if (fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
 	ctx.var = 0;
-	if (fmt == F_HTML) fputs("</dl>\n", out);
-	if (fmt == F_MDOC) fputs("\n.El", out);
+	if (fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	if (fmt == F_MDOC) Sink_puts(out, "\n.El");
     }
 
     size_t nsigs = CDRoot_nsigs(root);
@@ -1229,20 +1154,22 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
     {
 	struct {
 	    const char *tag;
+	    size_t taglen;
 	    size_t tagwidth;
-	} wspec = {0, 0};
+	} wspec = {0, 0, 0};
 
 	if (fmt != F_HTML)
 	{
 	    for (size_t i = 0; i < nsigs; ++i)
 	    {
 		const CliDoc *sig = CDRoot_sig(root, i);
-		const char *vname = CDNamed_name(sig);
-		size_t namelen = strlen(vname) + 3;
-		if (namelen > wspec.tagwidth)
+		size_t namelen;
+		const char *vname = CDNamed_namen(sig, &namelen);
+		if (namelen + 3 > wspec.tagwidth)
 		{
 		    wspec.tag = vname;
-		    wspec.tagwidth = namelen;
+		    wspec.taglen = namelen;
+		    wspec.tagwidth = namelen + 3;
 		}
 	    }
 	    wspec.tagwidth += 2;
@@ -1250,33 +1177,39 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
 
 	if (fmt == F_HTML)
 	{
-	    fputs("<h2>SIGNALS</h2>\n<dl class=\"environment\">\n", out);
+	    Sink_puts(out, "<h2>SIGNALS</h2>\n<dl class=\"environment\">\n");
 	}
 	else if (fmt == F_MDOC)
 	{
-	    fprintf(out, "\n.Sh SIGNALS\n.Bl -tag -width \"SIG%s\"",
-		    wspec.tag);
+	    Sink_printf(out, "\n.Sh SIGNALS\n.Bl -tag -width \"SIG%.*s\"",
+		    (int)wspec.taglen, wspec.tag);
 	}
-	else fputs("\n.SH \"SIGNALS\"", out);
+	else Sink_puts(out, "\n.SH \"SIGNALS\"");
 	for (size_t i = 0; i < nsigs; ++i)
 	{
-	    if (fmt == F_MAN) fprintf(out, "\n.TP %un",
-		    (unsigned)wspec.tagwidth);
+	    if (fmt == F_MAN)
+	    {
+		Sink_puts(out, "\n.TP ");
+		Sink_putuint(out, wspec.tagwidth);
+		Sink_putc(out, 'n');
+	    }
 	    const CliDoc *sig = CDRoot_sig(root, i);
+	    size_t namelen;
+	    const char *signame = CDNamed_namen(sig, &namelen);
 	    if (fmt == F_HTML)
 	    {
-		fprintf(out,
-			"<dt><span class=\"name\">SIG%s</span></dt>\n<dd>\n",
-			htmlescape(CDNamed_name(sig)));
+		Sink_puts(out, "<dt><span class=\"name\">SIG");
+		Sink_escape(out, signame, namelen, htmlesc);
+		Sink_puts(out, "</span></dt>\n<dd>\n");
 	    }
-	    else fprintf(out, fmt == F_MDOC ? "\n.It Ev SIG%s"
-		    : "\n\\fBSIG%s\\fR", CDNamed_name(sig));
+	    else Sink_printf(out, fmt == F_MDOC ? "\n.It Ev SIG%.*s"
+		    : "\n\\fBSIG%.*s\\fR", (int)namelen, signame);
 	    if (writeManDescription(out, &ctx,
 			CDNamed_description(sig), 0) < 0) goto error;
-	    if (fmt == F_HTML) fputs("</dd>\n", out);
+	    if (fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
-	if (fmt == F_HTML) fputs("</dl>\n", out);
-	if (fmt == F_MDOC) fputs("\n.El", out);
+	if (fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	if (fmt == F_MDOC) Sink_puts(out, "\n.El");
     }
 
     size_t nfiles = CDRoot_nfiles(root);
@@ -1284,31 +1217,33 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
     {
 	if (fmt == F_HTML)
 	{
-	    fputs("<h2>FILES</h2>\n<dl class=\"description\">\n", out);
+	    Sink_puts(out, "<h2>FILES</h2>\n<dl class=\"description\">\n");
 	}
 	else if (fmt == F_MDOC)
 	{
-	    fputs("\n.Sh FILES\n.Bl -tag -width Ds", out);
+	    Sink_puts(out, "\n.Sh FILES\n.Bl -tag -width Ds");
 	}
-	else fputs("\n.SH \"FILES\"", out);
+	else Sink_puts(out, "\n.SH \"FILES\"");
 	for (size_t i = 0; i < nfiles; ++i)
 	{
-	    if (fmt == F_MAN) fputs("\n.TP 8n", out);
+	    if (fmt == F_MAN) Sink_puts(out, "\n.TP 8n");
 	    const CliDoc *file = CDRoot_file(root, i);
+	    size_t namelen;
+	    const char *filename = CDNamed_namen(file, &namelen);
 	    if (fmt == F_HTML)
 	    {
-		fprintf(out,
-			"<dt><span class=\"file\">%s</span></dt>\n<dd>\n",
-			htmlescape(CDNamed_name(file)));
+		Sink_puts(out, "<dt><span class=\"file\">");
+		Sink_escape(out, filename, namelen, htmlesc);
+		Sink_puts(out, "</span></dt>\n<dd>\n");
 	    }
-	    else fprintf(out, fmt == F_MDOC ? "\n.It Pa %s" : "\n\\fI%s\\fR",
-		    CDNamed_name(file));
+	    else Sink_printf(out, fmt == F_MDOC ? "\n.It Pa %.*s"
+		    : "\n\\fI%.*s\\fR", (int)namelen, filename);
 	    if (writeManDescription(out, &ctx,
 			CDNamed_description(file), 0) < 0) goto error;
-	    if (fmt == F_HTML) fputs("</dd>\n", out);
+	    if (fmt == F_HTML) Sink_puts(out, "</dd>\n");
 	}
-	if (fmt == F_HTML) fputs("</dl>\n", out);
-	if (fmt == F_MDOC) fputs("\n.El", out);
+	if (fmt == F_HTML) Sink_puts(out, "</dl>\n");
+	if (fmt == F_MDOC) Sink_puts(out, "\n.El");
     }
 
     size_t nrefs = CDRoot_nrefs(root);
@@ -1317,7 +1252,9 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
 	int haverefs = 0;
 	for (size_t i = 0; i < nrefs; ++i)
 	{
-	    if (*CDMRef_name(CDRoot_ref(root, i)) != '&')
+	    size_t reflen;
+	    const char *refname = CDMRef_namen(CDRoot_ref(root, i), &reflen);
+	    if (!reflen || *refname != '&')
 	    {
 		haverefs = 1;
 		break;
@@ -1325,78 +1262,88 @@ static int write(FILE *out, const CliDoc *root, Fmt fmt, const FmtOpts *opts)
 	}
 	if (haverefs)
 	{
-	    if (fmt == F_HTML) fputs("<h2>SEE ALSO</h2>\n<p>", out);
-	    else if (fmt == F_MDOC) fputs("\n.Sh SEE ALSO", out);
-	    else fputs("\n.SH \"SEE ALSO\"", out);
+	    if (fmt == F_HTML) Sink_puts(out, "<h2>SEE ALSO</h2>\n<p>");
+	    else if (fmt == F_MDOC) Sink_puts(out, "\n.Sh SEE ALSO");
+	    else Sink_puts(out, "\n.SH \"SEE ALSO\"");
 	    for (size_t i = 0; i < nrefs; ++i)
 	    {
 		const CliDoc *ref = CDRoot_ref(root, i);
-		if (*CDMRef_name(ref) == '&') continue;
+		size_t reflen, sectlen;
+		const char *refname = CDMRef_namen(ref, &reflen);
+		const char *refsect = CDMRef_sectionn(ref, &sectlen);
+		if (reflen && *refname == '&') continue;
 		if (fmt == F_HTML)
 		{
-		    if (i) fputs(", ", out);
-		    fprintf(out, "<span class=\"name\">%s</span>",
-			htmlescape(CDMRef_name(ref)));
-		    fprintf(out, "(%s)", htmlescape(CDMRef_section(ref)));
+		    if (i) Sink_puts(out, ", ");
+		    Sink_puts(out, "<span class=\"name\">");
+		    Sink_escape(out, refname, reflen, htmlesc);
+		    Sink_puts(out, "</span>(");
+		    Sink_escape(out, refsect, sectlen, htmlesc);
+		    Sink_putc(out, ')');
 		}
-		else fprintf(out, fmt == F_MDOC
-			? (i ? " ,\n.Xr %s %s" : "\n.Xr %s %s")
-			: (i ? "\\fR,\n\\fB%s\\fP(%s)" : "\n\\fB%s\\fP(%s)"),
-			CDMRef_name(ref), CDMRef_section(ref));
+		else Sink_printf(out, fmt == F_MDOC
+			? (i ? " ,\n.Xr %.*s %.*s" : "\n.Xr %.*s %.*s")
+			: (i ? "\\fR,\n\\fB%.*s\\fP(%.*s)"
+			    : "\n\\fB%.*s\\fP(%.*s)"),
+			(int)reflen, refname, (int)sectlen, refsect);
 	    }
-	    if (fmt == F_HTML) fputs("</p>\n", out);
+	    if (fmt == F_HTML) Sink_puts(out, "</p>\n");
 	}
     }
 
     const CliDoc *author = CDRoot_author(root);
     if (istext(author))
     {
-	if (fmt == F_HTML) fputs("<h2>AUTHORS</h2>\n", out);
-	else if (fmt == F_MDOC) fputs("\n.Sh AUTHORS\n.An ", out);
-	else fputs("\n.SH \"AUTHORS\"\n", out);
-	const char *astr = CDText_str(author);
-	const char *es = strchr(astr, '<');
-	const char *ea = strchr(astr, '@');
-	const char *ee = strchr(astr, '>');
+	if (fmt == F_HTML) Sink_puts(out, "<h2>AUTHORS</h2>\n");
+	else if (fmt == F_MDOC) Sink_puts(out, "\n.Sh AUTHORS\n.An ");
+	else Sink_puts(out, "\n.SH \"AUTHORS\"\n");
+	size_t alen;
+	const char *astr = CDText_strn(author, &alen);
+	const char *es = memchr(astr, '<', alen);
+	const char *ea = memchr(astr, '@', alen);
+	const char *ee = memchr(astr, '>', alen);
 	if (es && ea && ee && es < ea && ea < ee)
 	{
 	    if (fmt == F_HTML)
 	    {
-		fputs(htmlnescape(astr, es-astr), out);
-		char *email = htmlnescape(es+1, ee-es-1);
-		fprintf(out, " &lt;<a href=\"mailto:%s\">%s</a>&gt;\n",
-			email, email);
+		Sink_escape(out, astr, es-astr, htmlesc);
+		Sink_puts(out, " &lt;<a href=\"mailto:");
+		Sink_escape(out, es+1, ee-es-1, htmlesc);
+		Sink_puts(out, "\">");
+		Sink_escape(out, es+1, ee-es-1, htmlesc);
+		Sink_puts(out, "</a>&gt;\n");
 	    }
 	    else
 	    {
-		fwrite(astr, 1, es-astr, out);
-		if (fmt == F_MDOC) fputs(" Aq Mt ", out);
-		else fputs("<\\fI", out);
-		fwrite(es+1, 1, ee-es-1, out);
-		if (fmt == F_MAN) fputs("\\fR>", out);
+		Sink_write(out, astr, es-astr);
+		if (fmt == F_MDOC) Sink_puts(out, " Aq Mt ");
+		else Sink_puts(out, "<\\fI");
+		Sink_write(out, es+1, ee-es-1);
+		if (fmt == F_MAN) Sink_puts(out, "\\fR>");
 	    }
 	}
-	else fputs(fmt == F_HTML ? htmlescape(astr) : astr, out);
+	else if (fmt == F_HTML) Sink_escape(out, astr, alen, htmlesc);
+	else Sink_write(out, astr, alen);
     }
 
     if (fmt == F_HTML)
     {
-	fprintf(out, "<dl class=\"footer\">\n<dt>Origin:</dt>\n<dd>%s",
-		htmlescape(ctx.name));
-	if (istext(version))
+	Sink_puts(out, "<dl class=\"footer\">\n<dt>Origin:</dt>\n<dd>");
+	Sink_escape(out, ctx.name, ctx.namelen, htmlesc);
+	if (verstr)
 	{
-	    fprintf(out, " %s", htmlescape(CDText_str(version)));
+	    Sink_putc(out, ' ');
+	    Sink_escape(out, verstr, verlen, htmlesc);
 	}
-	size_t mlen = strftime(strbuf, sizeof strbuf, "%B", tm);
-	snprintf(strbuf + mlen, sizeof strbuf - mlen,
-		" %d, %d", tm->tm_mday, tm->tm_year + 1900);
-	fprintf(out, "</dd>\n<dt>Date:</dt>\n<dd>%s</dd>\n", strbuf);
-	fprintf(out, "<dt>Title:</dt>\n<dd>%s(1)</dd>\n",
-		strToUpper(ctx.name));
-	fputs("</dl>\n</body>\n</html>", out);
+	Sink_puts(out, "</dd>\n<dt>Date:</dt>\n<dd>");
+	writeDate(out, tm);
+	Sink_puts(out, "</dd>\n<dt>Title:</dt>\n<dd>");
+	writeUpper(out, ctx.name, ctx.namelen, htmlesc);
+	Sink_puts(out, "(1)</dd>\n");
+	Sink_puts(out, "</dl>\n</body>\n</html>");
     }
 
-    fputc('\n', out);
+    Sink_putc(out, '\n');
     return 0;
 
 error:
@@ -1434,7 +1381,7 @@ static size_t parseOpt(char *buf, const char *argp, char **valp, char **nextp)
     return n;
 }
 
-int writeMan(FILE *out, const CliDoc *root, const char *args)
+SOEXPORT int writeMan(Sink *out, const CliDoc *root, const char *args)
 {
     FmtOpts opts;
     memset(&opts, 0, sizeof opts);
@@ -1464,15 +1411,15 @@ int writeMan(FILE *out, const CliDoc *root, const char *args)
     goto done;
 
 error:
-    fprintf(stderr, "Invalid arguments for man: %s\n", args);
-    fputs("Supported:  sect=mansection\n", stderr);
+    fprintf(diagout(), "Invalid arguments for man: %s\n", args);
+    fputs("Supported:  sect=mansection\n", diagout());
 
 done:
     free(optstr);
     return rc;
 }
 
-int writeMdoc(FILE *out, const CliDoc *root, const char *args)
+SOEXPORT int writeMdoc(Sink *out, const CliDoc *root, const char *args)
 {
     FmtOpts opts;
     memset(&opts, 0, sizeof opts);
@@ -1510,22 +1457,44 @@ int writeMdoc(FILE *out, const CliDoc *root, const char *args)
     goto done;
 
 error:
-    fprintf(stderr, "Invalid arguments for mdoc: %s\n", args);
+    fprintf(diagout(), "Invalid arguments for mdoc: %s\n", args);
     fputs("Supported:  sect=mansection, os [Override operating system with "
-	    "tool name and version]\n", stderr);
+	    "tool name and version]\n", diagout());
 
 done:
     free(optstr);
     return rc;
 }
 
-int writeHtml(FILE *out, const CliDoc *root, const char *args)
+char *dependsHtml(const char *args)
+{
+    char *optstr = xmalloc(strlen(args) + 1);
+    char *style = 0;
+    const char *argp = args;
+    char *buf = optstr;
+    char *valp;
+    char *nextp;
+    size_t len;
+    while (buf && (len = parseOpt(buf, argp, &valp, &nextp)))
+    {
+	if (valp && !strcmp(buf, "style"))
+	{
+	    free(style);
+	    style = copystr(valp);
+	}
+	buf = nextp;
+	argp += len;
+    }
+    free(optstr);
+    return style;
+}
+
+SOEXPORT int writeHtml(Sink *out, const CliDoc *root, const char *args)
 {
     FmtOpts opts;
     memset(&opts, 0, sizeof opts);
     char *optstr = 0;
-    char *style = 0;
-    FILE *css = 0;
+    CachedFile *css = 0;
     int rc = -1;
     char *valp;
     char *nextp;
@@ -1544,21 +1513,10 @@ int writeHtml(FILE *out, const CliDoc *root, const char *args)
 	    else if (!strcmp(buf, "sectname")) opts.sectname = valp;
 	    else if (!strcmp(buf, "style"))
 	    {
-		css = fopen(valp, "r");
-		if (!css) goto styleerr;
-		size_t stylesz = 0;
-		for (;;)
-		{
-		    style = xrealloc(style, stylesz + 1024);
-		    size_t chunk = fread(style + stylesz, 1, 1024, css);
-		    stylesz += chunk;
-		    if (chunk < 1024) break;
-		}
-		if (ferror(css)) goto styleerr;
-		fclose(css);
-		css = 0;
-		style[stylesz] = 0;
-		opts.style = style;
+		CachedFile_release(css);
+		if (!(css = getResource(valp))) goto styleerr;
+		size_t stylesz;
+		opts.style = resourceData(css, &stylesz);
 	    }
 	    else if (!strcmp(buf, "styleuri")) opts.styleuri = valp;
 	    else goto error;
@@ -1571,16 +1529,15 @@ int writeHtml(FILE *out, const CliDoc *root, const char *args)
     goto done;
 
 styleerr:
-    fprintf(stderr, "Error reading %s\n", valp);
+    fprintf(diagout(), "Error reading %s\n", valp);
     goto done;
 
 error:
-    fprintf(stderr, "Invalid arguments for html: %s\n", args);
+    fprintf(diagout(), "Invalid arguments for html: %s\n", args);
     fputs("Supported:  sect=mansection, sectname=name, style=file, "
-	    "styleuri=uri\n", stderr);
+	    "styleuri=uri\n", diagout());
 done:
-    if (css) fclose(css);
-    free(style);
+    CachedFile_release(css);
     free(optstr);
     return rc;
 }
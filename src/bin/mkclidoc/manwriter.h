@@ -3,15 +3,14 @@
 
 #include "decl.h"
 
-#include <stdio.h>
-
 C_CLASS_DECL(CliDoc);
+C_CLASS_DECL(Sink);
 
-int writeHtml(FILE *out, const CliDoc *root, const char *args)
+DECLEXPORT int writeHtml(Sink *out, const CliDoc *root, const char *args)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
-int writeMan(FILE *out, const CliDoc *root, const char *args)
+DECLEXPORT int writeMan(Sink *out, const CliDoc *root, const char *args)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
-int writeMdoc(FILE *out, const CliDoc *root, const char *args)
+DECLEXPORT int writeMdoc(Sink *out, const CliDoc *root, const char *args)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
 
 #endif
@@ -1,7 +1,49 @@
-mkclidoc_MODULES:=	clidoc \
+clidoc_MODULES:=	arena \
+			binwriter \
+			clidoc \
+			filecache \
+			manwriter \
+			parser \
+			render \
+			rescache \
+			sink \
+			srcwriter \
+			strindex \
+			util
+clidoc_HEADERS_INSTALL:=	binwriter \
+				clidoc \
+				decl \
+				manwriter \
+				render \
+				sink \
+				srcwriter
+clidoc_HEADERTGTDIR:=	$(includedir)$(PSEP)mkclidoc
+clidoc_DEFINES:=	-D_POSIX_C_SOURCE=200809L
+clidoc_CFLAGS:=		-fvisibility=hidden
+clidoc_LIBS:=		pthread
+clidoc_V_MAJ:=		1
+clidoc_V_MIN:=		0
+clidoc_V_REV:=		0
+
+$(call librules,clidoc)
+
+mkclidoc_MODULES:=	arena \
+			binwriter \
+			clidoc \
+			daemon \
+			filecache \
+			jobpool \
+			jobserver \
 			main \
 			manwriter \
+			parser \
+			render \
+			rescache \
+			sink \
 			srcwriter \
+			strindex \
 			util
+mkclidoc_DEFINES:=	-D_POSIX_C_SOURCE=200809L
+mkclidoc_LIBS:=		pthread
 
 $(call binrules,mkclidoc)
@@ -0,0 +1,688 @@
+#include "clidoc.h"
+
+#include "arena.h"
+#include "docarena.h"
+#include "strindex.h"
+#include "util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+C_CLASS_DECL(Parser);
+
+typedef struct Keyword
+{
+    const char *name;
+    size_t len;
+    CDKey key;
+    int (*handler)(Parser *p);
+} Keyword;
+
+typedef struct Tag
+{
+    const char *name;
+    size_t len;
+    int (*handler)(Parser *p);
+} Tag;
+
+struct Parser
+{
+    CDEventHandler handler;
+    void *ctx;
+    Arena *arena;
+    StrIndex *idx;
+    const char *pos;
+    const char *end;
+    const char *line;
+    const char *eol;
+    CDStr *cells;
+    size_t cellscapa;
+    char *buf;
+    size_t bufcapa;
+    unsigned long lineno;
+};
+
+static int parsetable(Parser *p);
+static int parsedict(Parser *p);
+static int parseval(Parser *p);
+static int parsemref(Parser *p, const char *end);
+static int parsemrefs(Parser *p);
+static int parseint(Parser *p);
+static int parsedate(Parser *p);
+static int parsevals(Parser *p, const Keyword *keys);
+static int parseflag(Parser *p);
+static int parsearg(Parser *p);
+static int parsefile(Parser *p);
+static int parsevar(Parser *p);
+static int parsesig(Parser *p);
+
+#define isws(c) (c == ' ' || c == '\t')
+#define skipws(p) while(isws(*(p))) ++(p)
+#define skipwsb(p) while(isws(*(p-1))) --(p)
+#define err(s) do { \
+    fprintf(diagout(), "parse error in line %lu: %s\n", p->lineno, (s)); \
+    goto error; } while (0)
+#define emit(ev) do { \
+    (ev).line = p->lineno; \
+    if (p->handler(p->ctx, &(ev)) < 0) goto error; } while (0)
+#define linechr(s, c) (p->eol ? StrIndex_chr(p->idx, (s), p->eol, (c)) : 0)
+#define isdict(t) (*p->line == '-' && p->line[1] == ' ' && p->line[2] == '[' \
+	&& ((t)=linechr(p->line, ']')) && (t)[1] == ':')
+#define istable(t) (*p->line == '|' && ((t)=linechr(p->line+1, '|')) \
+	&& linechr((t)+1, '|'))
+
+#define KEY(n, k, h) { n, sizeof n - 1, k, h }
+
+static const Keyword rootkeys[] = {
+    KEY("name", CK_NAME, parseval),
+    KEY("version", CK_VERSION, parseval),
+    KEY("comment", CK_COMMENT, parseval),
+    KEY("author", CK_AUTHOR, parseval),
+    KEY("license", CK_LICENSE, parseval),
+    KEY("description", CK_DESCRIPTION, parseval),
+    KEY("date", CK_DATE, parsedate),
+    KEY("www", CK_WWW, parseval),
+    KEY("manrefs", CK_MANREFS, parsemrefs),
+    KEY("defgroup", CK_DEFGROUP, parseint),
+    { 0, 0, 0, 0 }
+};
+
+static const Keyword argkeys[] = {
+    KEY("description", CK_DESCRIPTION, parseval),
+    KEY("default", CK_DEFAULT, parseval),
+    KEY("min", CK_MIN, parseval),
+    KEY("max", CK_MAX, parseval),
+    KEY("group", CK_GROUP, parseint),
+    KEY("optional", CK_OPTIONAL, parseint),
+    { 0, 0, 0, 0 }
+};
+
+static const Keyword namedkeys[] = {
+    KEY("description", CK_DESCRIPTION, parseval),
+    { 0, 0, 0, 0 }
+};
+
+static const Tag tags[] = {
+    { "flag ", 5, parseflag },
+    { "arg ", 4, parsearg },
+    { "file ", 5, parsefile },
+    { "var ", 4, parsevar },
+    { "sig ", 4, parsesig },
+    { 0, 0, 0 }
+};
+
+static const char *nextline(Parser *p)
+{
+    ++p->lineno;
+    if (p->pos == p->end) return p->line = 0;
+    p->line = p->pos;
+    p->eol = StrIndex_eol(p->idx, p->pos);
+    if (p->eol) p->pos = p->eol + 1;
+    else
+    {
+	p->line = "";
+	p->pos = p->end;
+    }
+    return p->line;
+}
+
+static int parsetable(Parser *p)
+{
+    CDEvent ev = {0};
+    ev.type = CE_TABLE;
+    emit(ev);
+
+    int width = -1;
+    const char *tmp = 0;
+    while (istable(tmp))
+    {
+	++p->line;
+	tmp = p->eol;
+	if (!tmp) err("Expected end of line");
+	size_t ncells = 0;
+	for (int x = 0; width < 0 || x < width; ++x)
+	{
+	    skipws(p->line);
+	    tmp = linechr(p->line, '|');
+	    if (!tmp)
+	    {
+		if (width < 0)
+		{
+		    width = x;
+		    break;
+		}
+		err("Expected table cell");
+	    }
+	    const char *end = tmp;
+	    skipwsb(end);
+	    if (ncells == p->cellscapa)
+	    {
+		p->cells = Arena_growvec(p->arena, p->cells,
+			&p->cellscapa, sizeof *p->cells);
+	    }
+	    CDStr *cell = p->cells + ncells++;
+	    cell->s = p->line;
+	    cell->len = end > p->line ? end - p->line : 0;
+	    p->line = tmp+1;
+	}
+	ev.type = CE_TABLEROW;
+	ev.cells = p->cells;
+	ev.ncells = ncells;
+	emit(ev);
+	if (!nextline(p)) err("Unexpected end of file");
+	skipws(p->line);
+    }
+    ev.type = CE_TABLEEND;
+    ev.cells = 0;
+    ev.ncells = 0;
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parsedict(Parser *p)
+{
+    CDEvent ev = {0};
+    ev.type = CE_DICT;
+    emit(ev);
+
+    const char *tmp = 0;
+    while (isdict(tmp))
+    {
+	p->line += 3;
+	skipws(p->line);
+	if (p->line == tmp) err("Empty dictionary key");
+	ev.type = CE_DICTITEM;
+	ev.str.s = p->line;
+	ev.str.len = tmp - p->line;
+	emit(ev);
+	p->line = tmp+2;
+	skipws(p->line);
+
+	int haveentry = 0;
+	if (*p->line == '\n')
+	{
+	    if (!nextline(p)) err("Unexpected end of file");
+	    skipws(p->line);
+	    if (istable(tmp))
+	    {
+		if (parsetable(p) < 0) goto error;
+		haveentry = 1;
+	    }
+	}
+
+	if (!haveentry)
+	{
+	    size_t nchunks = 0;
+	    for (;;)
+	    {
+		if (*p->line == '\n' ||
+			(*p->line == '.' && p->line[1] == '\n')) break;
+		if (isdict(tmp)) break;
+		tmp = p->eol;
+		if (!tmp) err("Expected end of line");
+		skipwsb(tmp);
+		ev.type = CE_TEXT;
+		ev.str.s = p->line;
+		ev.str.len = tmp - p->line;
+		emit(ev);
+		++nchunks;
+		if (!nextline(p)) err("Unexpected end of file");
+		skipws(p->line);
+	    }
+	    if (!nchunks) err("Empty dictionary value");
+	    ev.type = CE_TEXTEND;
+	    emit(ev);
+	}
+    }
+    ev.type = CE_DICTEND;
+    ev.str.s = 0;
+    ev.str.len = 0;
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parseval(Parser *p)
+{
+    CDEvent ev = {0};
+    const char *tmp;
+    if (*p->line == '\n')
+    {
+	int done = 0;
+	while (!done) {
+	    while (*p->line == '\n')
+	    {
+		if (!nextline(p)) err("Unexpected end of file");
+		skipws(p->line);
+	    }
+	    int havedict = 0;
+	    int havetable = 0;
+	    size_t nchunks = 0;
+	    while (*p->line != '\n')
+	    {
+		if (*p->line == '.' && p->line[1] == '\n')
+		{
+		    done = 1;
+		    break;
+		}
+		if (isdict(tmp))
+		{
+		    havedict = 1;
+		    break;
+		}
+		if (istable(tmp))
+		{
+		    havetable = 1;
+		    break;
+		}
+		tmp = p->eol;
+		if (!tmp) err("Expected end of line");
+		skipwsb(tmp);
+		ev.type = CE_TEXT;
+		ev.str.s = p->line;
+		ev.str.len = tmp - p->line;
+		emit(ev);
+		++nchunks;
+		if (!nextline(p)) err("Unexpected end of file");
+		skipws(p->line);
+	    }
+	    if (nchunks)
+	    {
+		ev.type = CE_TEXTEND;
+		emit(ev);
+	    }
+	    if (havedict)
+	    {
+		if (parsedict(p) < 0) goto error;
+		if (*p->line == '.' && p->line[1] == '\n') done = 1;
+	    }
+	    if (havetable)
+	    {
+		if (parsetable(p) < 0) goto error;
+		if (*p->line == '.' && p->line[1] == '\n') done = 1;
+	    }
+	}
+    }
+    else
+    {
+	tmp = p->eol;
+	if (!tmp) err("Expected end of line");
+	skipwsb(tmp);
+	ev.type = CE_TEXT;
+	ev.str.s = p->line;
+	ev.str.len = tmp - p->line;
+	emit(ev);
+	ev.type = CE_TEXTEND;
+	emit(ev);
+    }
+    p->line = 0;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parsemref(Parser *p, const char *end)
+{
+    CDEvent ev = {0};
+    ev.type = CE_MREF;
+    const char *word = p->line;
+    ev.str.s = word;
+    ev.str2.s = "1";
+    ev.str2.len = 1;
+
+    size_t wordlen = 0;
+    int escaped = 0;
+    while (word + wordlen < end && !isws(word[wordlen]))
+    {
+	if (word[wordlen++] == '\\') escaped = 1;
+    }
+    if (escaped && wordlen > p->bufcapa)
+    {
+	p->buf = Arena_realloc(p->arena, p->buf, p->bufcapa, wordlen);
+	p->bufcapa = wordlen;
+    }
+    char *buf = escaped ? p->buf : 0;
+    size_t len = 0;
+    size_t namelen = 0;
+    int havesect = 0;
+    for (size_t i = 0; i < wordlen; ++i, ++len)
+    {
+	if (word[i] == '\\')
+	{
+	    if (++i == wordlen) err("stray backslash");
+	}
+	else if (!havesect && word[i] == '.')
+	{
+	    namelen = len;
+	    havesect = 1;
+	}
+	if (buf) buf[len] = word[i];
+    }
+    if (buf)
+    {
+	ev.str.s = buf;
+	ev.transient = 1;
+    }
+    if (havesect)
+    {
+	ev.str.len = namelen;
+	ev.str2.s = ev.str.s + namelen + 1;
+	ev.str2.len = len - namelen - 1;
+    }
+    else ev.str.len = len;
+    p->line += wordlen;
+    skipws(p->line);
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parsemrefs(Parser *p)
+{
+    const char *tmp;
+    if (*p->line == '\n')
+    {
+	for (;;)
+	{
+	    if (*p->line != '\n')
+	    {
+		if (*p->line == '.' && p->line[1] == '\n') break;
+		tmp = p->eol;
+		if (!tmp) err("Expected end of line");
+		skipwsb(tmp);
+		while (p->line < tmp)
+		{
+		    if (parsemref(p, tmp) < 0) goto error;
+		}
+	    }
+	    if (!nextline(p)) err("Unexpected end of file");
+	    skipws(p->line);
+	}
+    }
+    else
+    {
+	tmp = p->eol;
+	if (!tmp) err("Expected end of line");
+	skipwsb(tmp);
+	while (p->line < tmp)
+	{
+	    if (parsemref(p, tmp) < 0) goto error;
+	}
+    }
+    p->line = 0;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parseint(Parser *p)
+{
+    if (*p->line == '\n') err("Empty value");
+    const char *tmp = p->eol;
+    if (!tmp) err("Expected end of line");
+    skipwsb(tmp);
+    if (tmp == p->line) err("Empty value");
+    errno = 0;
+    char *endp;
+    long tmpval = strtol(p->line, &endp, 10);
+    if (endp != tmp) err("Non-numeric value");
+    if (errno == ERANGE || tmpval < INT_MIN || tmpval > INT_MAX)
+    {
+	err("Value out of range");
+    }
+    CDEvent ev = {0};
+    ev.type = CE_INT;
+    ev.intval = tmpval;
+    emit(ev);
+    p->line = 0;
+    return 0;
+
+error:
+    return -1;
+}
+
+static pthread_mutex_t tzlock = PTHREAD_MUTEX_INITIALIZER;
+
+static int parsedate(Parser *p)
+{
+    struct tm tm = {0};
+    char buf[5] = {0};
+    const char *tmp = p->eol;
+    if (!tmp) err("Expected end of line");
+    skipwsb(tmp);
+    if (tmp == p->line) err ("Empty value");
+    if (tmp - p->line != 8) err ("Expected YYYYMMDD");
+
+    char *endp;
+    memcpy(buf, p->line + 6, 2);
+    tm.tm_mday = strtol(buf, &endp, 10);
+    if (endp != buf + 2) err("Expected YYYYMMDD");
+    memcpy(buf, p->line + 4, 2);
+    tm.tm_mon = strtol(buf, &endp, 10) - 1;
+    if (endp != buf + 2) err("Expected YYYYMMDD");
+    memcpy(buf, p->line, 4);
+    tm.tm_year = strtol(buf, &endp, 10) - 1900;
+    if (endp != buf + 4) err("Expected YYYYMMDD");
+    pthread_mutex_lock(&tzlock);
+    time_t dv = mktime(&tm);
+    pthread_mutex_unlock(&tzlock);
+    if (dv == (time_t)(-1)) err("Expected YYYYMMDD");
+    p->line = 0;
+    CDEvent ev = {0};
+    ev.type = CE_DATE;
+    ev.date = dv;
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
+
+static const Keyword *findkey(const Keyword *keys, const char *key,
+	size_t keylen)
+{
+    for (; keys->name; ++keys)
+    {
+	if (keys->len == keylen && *keys->name == *key
+		&& !memcmp(keys->name, key, keylen)) return keys;
+    }
+    return 0;
+}
+
+static int parsekey(Parser *p, const Keyword *keys)
+{
+    const char *tmp;
+    if (isws(*p->line) || *p->line == ':') err("Empty key");
+    else tmp = linechr(p->line, ':');
+    if (!tmp || tmp == p->line) err("Expected key");
+    const Keyword *key = findkey(keys, p->line, tmp - p->line);
+    if (!key) err("Unknown key");
+    CDEvent ev = {0};
+    ev.type = CE_KEY;
+    ev.key = key->key;
+    ev.str.s = p->line;
+    ev.str.len = key->len;
+    emit(ev);
+    p->line = tmp+1;
+    skipws(p->line);
+    if (key->handler(p) < 0) goto error;
+    ev.type = CE_VALUEEND;
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parsevals(Parser *p, const Keyword *keys)
+{
+    for (;;)
+    {
+	if (!p->line)
+	{
+	    if (!nextline(p)) break;
+	}
+	skipws(p->line);
+	if (!*p->line) err("Expected end of line");
+
+	if (*p->line == '\n')
+	{
+	    p->line = 0;
+	    continue;
+	}
+	if (*p->line == '[')
+	{
+	    break;
+	}
+	if (parsekey(p, keys) < 0) goto error;
+    }
+    return 0;
+
+error:
+    return -1;
+}
+
+static int parseflag(Parser *p)
+{
+    const char *tmp = p->eol;
+    if (!tmp) err("Expected end of line");
+    skipwsb(tmp);
+    --tmp;
+    if (tmp <= p->line) err("Unexpected end of line");
+    if (*tmp != ']') err("Tag not closed");
+    if (!isws(p->line[1]) && p->line[1] != ']')
+    {
+	err("Missing or invalid flag character");
+    }
+    CDEvent ev = {0};
+    ev.type = CE_SECTION;
+    ev.section = CS_FLAG;
+    ev.flag = *p->line++;
+    skipws(p->line);
+    if (p->line != tmp)
+    {
+	ev.str.s = p->line;
+	ev.str.len = tmp - p->line;
+    }
+    emit(ev);
+    p->line = 0;
+    return parsevals(p, argkeys);
+
+error:
+    return -1;
+}
+
+static int parsenamed(Parser *p, CDSection section, const Keyword *keys,
+	const char *missing)
+{
+    const char *tmp = p->eol;
+    if (!tmp) err("Expected end of line");
+    skipwsb(tmp);
+    --tmp;
+    if (tmp <= p->line) err("Unexpected end of line");
+    if (*tmp != ']') err("Tag not closed");
+    skipws(p->line);
+    if (p->line == tmp) err(missing);
+    CDEvent ev = {0};
+    ev.type = CE_SECTION;
+    ev.section = section;
+    ev.str.s = p->line;
+    ev.str.len = tmp - p->line;
+    emit(ev);
+    p->line = 0;
+    return parsevals(p, keys);
+
+error:
+    return -1;
+}
+
+static int parsearg(Parser *p)
+{
+    return parsenamed(p, CS_ARG, argkeys, "Missing argument name");
+}
+
+static int parsefile(Parser *p)
+{
+    return parsenamed(p, CS_FILE, namedkeys, "Missing file name");
+}
+
+static int parsevar(Parser *p)
+{
+    return parsenamed(p, CS_VAR, namedkeys, "Missing var name");
+}
+
+static int parsesig(Parser *p)
+{
+    return parsenamed(p, CS_SIG, namedkeys, "Missing sig name");
+}
+
+SOEXPORT int CliDoc_parse(const char *buf, size_t len,
+	CDEventHandler handler, void *ctx)
+{
+    Arena *arena = Arena_create();
+    int rc = CliDoc_parseInArena(buf, len, handler, ctx, arena);
+    Arena_destroy(arena);
+    return rc;
+}
+
+int CliDoc_parseInArena(const char *buf, size_t len,
+	CDEventHandler handler, void *ctx, Arena *arena)
+{
+    Parser parser = { handler, ctx, arena, StrIndex_create(buf, len, arena),
+	buf, buf + len, 0, 0, 0, 0, 0, 0, 0 };
+    Parser *p = &parser;
+
+    for (;;)
+    {
+	if (!p->line)
+	{
+	    if (!nextline(p)) break;
+	}
+	skipws(p->line);
+	if (!*p->line) err("Expected end of line");
+
+	if (*p->line == '\n')
+	{
+	    p->line = 0;
+	    continue;
+	}
+
+	if (*p->line == '[')
+	{
+	    const Tag *tag;
+	    size_t taglen = p->eol - p->line - 1;
+	    for (tag = tags; tag->name; ++tag)
+	    {
+		if (tag->len <= taglen
+			&& !memcmp(p->line+1, tag->name, tag->len)) break;
+	    }
+	    if (!tag->name) err("Unknown tag");
+	    p->line += tag->len + 1;
+	    if (tag->handler(p) < 0) goto error;
+	    continue;
+	}
+
+	if (parsekey(p, rootkeys) < 0) goto error;
+    }
+    CDEvent ev = {0};
+    ev.type = CE_END;
+    emit(ev);
+    return 0;
+
+error:
+    return -1;
+}
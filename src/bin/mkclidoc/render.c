@@ -0,0 +1,49 @@
+#include "render.h"
+
+#include "binwriter.h"
+#include "manwriter.h"
+#include "sink.h"
+#include "srcwriter.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    CliDocWriter writefunc;
+} writers[] = {
+    { "bin", writeBin },
+    { "cpp", writeCpp },
+    { "html", writeHtml },
+    { "man", writeMan },
+    { "mdoc", writeMdoc },
+    { "sh", writeSh }
+};
+
+SOEXPORT CliDocWriter CliDoc_writer(const char *format)
+{
+    for (unsigned i = 0; i < sizeof writers / sizeof *writers; ++i)
+    {
+	if (!strcmp(format, writers[i].name)) return writers[i].writefunc;
+    }
+    return 0;
+}
+
+SOEXPORT char *CliDoc_render(const CliDoc *self, const char *format,
+	const char *args, size_t *len)
+{
+    CliDocWriter writefunc = CliDoc_writer(format);
+    if (!writefunc)
+    {
+	fprintf(diagout(), "Unknown format `%s'\n", format);
+	return 0;
+    }
+    Sink *out = Sink_createMem();
+    if (writefunc(out, self, args) < 0)
+    {
+	Sink_destroy(out);
+	return 0;
+    }
+    return Sink_detach(out, len);
+}
@@ -0,0 +1,23 @@
+#ifndef MKCLIDOC_RENDER_H
+#define MKCLIDOC_RENDER_H
+
+#include "decl.h"
+
+#include <stddef.h>
+
+C_CLASS_DECL(CliDoc);
+C_CLASS_DECL(CliDocCache);
+C_CLASS_DECL(Sink);
+
+typedef int (*CliDocWriter)(Sink *out, const CliDoc *root, const char *args);
+
+DECLEXPORT CliDocWriter CliDoc_writer(const char *format)
+    ATTR_NONNULL((1)) ATTR_PURE;
+DECLEXPORT char *CliDoc_render(const CliDoc *self, const char *format,
+    const char *args, size_t *len) CMETHOD ATTR_MALLOC ATTR_NONNULL((2));
+
+DECLEXPORT CliDocCache *CliDocCache_create(size_t maxsize) ATTR_RETNONNULL;
+DECLEXPORT void CliDocCache_use(CliDocCache *self);
+DECLEXPORT void CliDocCache_destroy(CliDocCache *self);
+
+#endif
@@ -0,0 +1,105 @@
+#include "rescache.h"
+
+#include "render.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct CliDocCache
+{
+    FileCache *caches[RK_NKINDS];
+    size_t maxsize;
+    pthread_mutex_t lock;
+};
+
+typedef struct Resource
+{
+    char *data;
+    size_t len;
+} Resource;
+
+static _Thread_local CliDocCache *current;
+
+SOEXPORT CliDocCache *CliDocCache_create(size_t maxsize)
+{
+    CliDocCache *self = xmalloc(sizeof *self);
+    for (int i = 0; i < RK_NKINDS; ++i) self->caches[i] = 0;
+    self->maxsize = maxsize;
+    pthread_mutex_init(&self->lock, 0);
+    return self;
+}
+
+SOEXPORT void CliDocCache_use(CliDocCache *self)
+{
+    current = self;
+}
+
+SOEXPORT void CliDocCache_destroy(CliDocCache *self)
+{
+    if (!self) return;
+    if (current == self) current = 0;
+    for (int i = 0; i < RK_NKINDS; ++i) FileCache_destroy(self->caches[i]);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+CachedFile *getCached(ResKind kind, const char *key, int fd,
+	const struct stat *st, FileLoader load, FileUnloader unload)
+{
+    CliDocCache *self = current;
+    if (!self) return CachedFile_load(load, unload, key, fd, st);
+    pthread_mutex_lock(&self->lock);
+    FileCache *cache = self->caches[kind];
+    if (!cache)
+    {
+	cache = FileCache_create(self->maxsize, load, unload);
+	self->caches[kind] = cache;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return FileCache_get(cache, key, fd, st);
+}
+
+static void *load(const char *path, int fd, const struct stat *st)
+{
+    (void)path;
+
+    Resource *res = xmalloc(sizeof *res);
+    if (!(res->data = readfd(fd, S_ISREG(st->st_mode) ? st->st_size : 0,
+		    &res->len)))
+    {
+	free(res);
+	return 0;
+    }
+    return res;
+}
+
+static void unload(void *obj)
+{
+    Resource *res = obj;
+    free(res->data);
+    free(res);
+}
+
+CachedFile *getResource(const char *path)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return 0;
+    CachedFile *res = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+	res = getCached(RK_STYLE, path, fd, &st, load, unload);
+    }
+    close(fd);
+    return res;
+}
+
+const char *resourceData(const CachedFile *res, size_t *len)
+{
+    const Resource *r = CachedFile_obj(res);
+    *len = r->len;
+    return r->data;
+}
@@ -0,0 +1,23 @@
+#ifndef MKCLIDOC_RESCACHE_H
+#define MKCLIDOC_RESCACHE_H
+
+#include "decl.h"
+#include "filecache.h"
+
+#include <stddef.h>
+
+typedef enum ResKind
+{
+    RK_STYLE,
+    RK_TEMPLATE,
+    RK_NKINDS
+} ResKind;
+
+CachedFile *getCached(ResKind kind, const char *key, int fd,
+	const struct stat *st, FileLoader load, FileUnloader unload)
+    ATTR_NONNULL((2)) ATTR_NONNULL((4)) ATTR_NONNULL((5)) ATTR_NONNULL((6));
+CachedFile *getResource(const char *path) ATTR_NONNULL((1));
+const char *resourceData(const CachedFile *res, size_t *len)
+    ATTR_NONNULL((1)) ATTR_NONNULL((2));
+
+#endif
@@ -0,0 +1,196 @@
+#include "sink.h"
+
+#include "util.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FDBUFSZ 16384
+#define MEMBUFSZ 4096
+
+struct Sink
+{
+    char *buf;
+    size_t len;
+    size_t capa;
+    int fd;
+    int failed;
+};
+
+static void fdwrite(Sink *self, const char *str, size_t len)
+{
+    while (len && !self->failed)
+    {
+	ssize_t rc = write(self->fd, str, len);
+	if (rc < 0)
+	{
+	    if (errno != EINTR) self->failed = 1;
+	    continue;
+	}
+	str += rc;
+	len -= rc;
+    }
+}
+
+static int reserve(Sink *self, size_t len)
+{
+    if (self->capa - self->len >= len) return 1;
+    if (self->fd < 0)
+    {
+	while (self->capa - self->len < len) self->capa *= 2;
+	self->buf = xrealloc(self->buf, self->capa);
+	return 1;
+    }
+    fdwrite(self, self->buf, self->len);
+    self->len = 0;
+    return self->capa >= len;
+}
+
+SOEXPORT Sink *Sink_createFd(int fd)
+{
+    Sink *self = xmalloc(sizeof *self);
+    self->buf = xmalloc(FDBUFSZ);
+    self->len = 0;
+    self->capa = FDBUFSZ;
+    self->fd = fd;
+    self->failed = 0;
+    return self;
+}
+
+SOEXPORT Sink *Sink_createMem(void)
+{
+    Sink *self = xmalloc(sizeof *self);
+    self->buf = xmalloc(MEMBUFSZ);
+    self->len = 0;
+    self->capa = MEMBUFSZ;
+    self->fd = -1;
+    self->failed = 0;
+    return self;
+}
+
+SOEXPORT void Sink_write(Sink *self, const char *str, size_t len)
+{
+    if (!reserve(self, len))
+    {
+	fdwrite(self, str, len);
+	return;
+    }
+    memcpy(self->buf + self->len, str, len);
+    self->len += len;
+}
+
+SOEXPORT void Sink_puts(Sink *self, const char *str)
+{
+    Sink_write(self, str, strlen(str));
+}
+
+SOEXPORT void Sink_putc(Sink *self, int c)
+{
+    if (self->len == self->capa) reserve(self, 1);
+    self->buf[self->len++] = c;
+}
+
+SOEXPORT void Sink_putuint(Sink *self, unsigned long val)
+{
+    char num[3 * sizeof val];
+    char *p = num + sizeof num;
+    do *--p = '0' + val % 10; while (val /= 10);
+    Sink_write(self, p, num + sizeof num - p);
+}
+
+SOEXPORT void Sink_pad(Sink *self, int c, size_t n)
+{
+    while (n)
+    {
+	if (self->len == self->capa) reserve(self, n);
+	size_t chunk = self->capa - self->len;
+	if (chunk > n) chunk = n;
+	memset(self->buf + self->len, c, chunk);
+	self->len += chunk;
+	n -= chunk;
+    }
+}
+
+SOEXPORT void Sink_escape(Sink *self, const char *str, size_t len,
+	const char *const esc[256])
+{
+    const char *end = str + len;
+    while (str < end)
+    {
+	const char *run = str;
+	while (str < end && !esc[(unsigned char)*str]) ++str;
+	Sink_write(self, run, str - run);
+	if (str < end) Sink_puts(self, esc[(unsigned char)*str++]);
+    }
+}
+
+SOEXPORT void Sink_printf(Sink *self, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(self->buf + self->len, self->capa - self->len,
+	    fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len < self->capa - self->len)
+    {
+	self->len += len;
+	return;
+    }
+    char *tmp = 0;
+    char *dst;
+    if (reserve(self, len + 1)) dst = self->buf + self->len;
+    else dst = tmp = xmalloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(dst, len + 1, fmt, ap);
+    va_end(ap);
+    if (tmp)
+    {
+	fdwrite(self, tmp, len);
+	free(tmp);
+    }
+    else self->len += len;
+}
+
+SOEXPORT const char *Sink_data(const Sink *self, size_t *len)
+{
+    *len = self->len;
+    return self->buf;
+}
+
+SOEXPORT int Sink_flush(Sink *self)
+{
+    if (self->fd >= 0)
+    {
+	fdwrite(self, self->buf, self->len);
+	self->len = 0;
+    }
+    return self->failed ? -1 : 0;
+}
+
+SOEXPORT char *Sink_detach(Sink *self, size_t *len)
+{
+    char *buf = 0;
+    if (self->fd < 0)
+    {
+	Sink_putc(self, 0);
+	buf = xrealloc(self->buf, self->len);
+	if (len) *len = self->len - 1;
+	self->buf = 0;
+    }
+    Sink_destroy(self);
+    return buf;
+}
+
+SOEXPORT int Sink_destroy(Sink *self)
+{
+    if (!self) return 0;
+    int rc = Sink_flush(self);
+    free(self->buf);
+    free(self);
+    return rc;
+}
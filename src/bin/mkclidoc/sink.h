@@ -0,0 +1,28 @@
+#ifndef MKCLIDOC_SINK_H
+#define MKCLIDOC_SINK_H
+
+#include "decl.h"
+
+#include <stddef.h>
+
+C_CLASS_DECL(Sink);
+
+DECLEXPORT Sink *Sink_createFd(int fd) ATTR_RETNONNULL;
+DECLEXPORT Sink *Sink_createMem(void) ATTR_RETNONNULL;
+DECLEXPORT void Sink_write(Sink *self, const char *str, size_t len) CMETHOD;
+DECLEXPORT void Sink_puts(Sink *self, const char *str)
+    CMETHOD ATTR_NONNULL((2));
+DECLEXPORT void Sink_putc(Sink *self, int c) CMETHOD;
+DECLEXPORT void Sink_putuint(Sink *self, unsigned long val) CMETHOD;
+DECLEXPORT void Sink_pad(Sink *self, int c, size_t n) CMETHOD;
+DECLEXPORT void Sink_escape(Sink *self, const char *str, size_t len,
+	const char *const esc[256]) CMETHOD ATTR_NONNULL((4));
+DECLEXPORT void Sink_printf(Sink *self, const char *fmt, ...)
+    CMETHOD ATTR_NONNULL((2)) ATTR_FORMAT((printf, 2, 3));
+DECLEXPORT const char *Sink_data(const Sink *self, size_t *len)
+    CMETHOD ATTR_NONNULL((2));
+DECLEXPORT int Sink_flush(Sink *self) CMETHOD;
+DECLEXPORT char *Sink_detach(Sink *self, size_t *len) CMETHOD ATTR_MALLOC;
+DECLEXPORT int Sink_destroy(Sink *self);
+
+#endif
@@ -1,143 +1,215 @@
 #include "srcwriter.h"
 
 #include "clidoc.h"
+#include "depends.h"
+#include "rescache.h"
+#include "sink.h"
 #include "util.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct Ctx
 {
     const char *name;
     const char *arg;
+    size_t namelen;
+    size_t arglen;
     int cpp;
     int first;
 } Ctx;
 
-static void srcputc(FILE *out, const Ctx *ctx, int c)
+typedef struct SpanCursor
 {
-    if (c == '\\' || c == '"') fputc('\\', out);
-    if (!ctx->cpp && (c == '$' || c == '`')) fputc('\\', out);
-    fputc(c, out);
+    const char *base;
+    const CDSpan *span;
+    const CDSpan *end;
+} SpanCursor;
+
+typedef enum TmplSlot
+{
+    TS_USAGE,
+    TS_HELP,
+    TS_CLIDOC,
+    TS_NAME,
+    TS_VERSION,
+    TS_NSLOTS,
+    TS_TEXT = TS_NSLOTS
+} TmplSlot;
+
+typedef struct TmplPart
+{
+    TmplSlot slot;
+    size_t off;
+    size_t len;
+} TmplPart;
+
+typedef struct Template
+{
+    char *data;
+    TmplPart *parts;
+    size_t nparts;
+} Template;
+
+typedef struct Slice
+{
+    const char *str;
+    size_t len;
+} Slice;
+
+static const char *const cppesc[256] = {
+    ['\\'] = "\\\\",
+    ['"'] = "\\\""
+};
+
+static const char *const shesc[256] = {
+    ['\\'] = "\\\\",
+    ['"'] = "\\\"",
+    ['$'] = "\\$",
+    ['`'] = "\\`"
+};
+
+static void srcwrite(Sink *out, const Ctx *ctx, const char *str, size_t len)
+{
+    Sink_escape(out, str, len, ctx->cpp ? cppesc : shesc);
 }
 
-static void skipws(const char **str)
+static void skipws(const char **str, const char *end)
 {
-    while (**str == ' ' || **str == '\t') ++(*str);
+    while (*str < end && (**str == ' ' || **str == '\t')) ++(*str);
 }
 
 static const char *findstrpos(const char *str, const char *pat, size_t len)
 {
-    size_t slen = 0;
-    while (slen < len && str[slen]) ++slen;
     size_t plen = strlen(pat);
-    if (plen > slen) return 0;
-    for (size_t i = 0; i <= slen - plen; ++i)
+    const char *end = str + len;
+    while ((size_t)(end - str) >= plen
+	    && (str = memchr(str, *pat, end - str - plen + 1)))
     {
-	if (!strncmp(pat, str+i, plen)) return str+i;
+	if (!memcmp(pat, str, plen)) return str;
+	++str;
     }
     return 0;
 }
 
-static void writeSrcStrLine(FILE *out, const Ctx *ctx,
-	const char **str, int indent)
+static void writeSrcStrLine(Sink *out, const Ctx *ctx,
+	const char **str, const char *end, SpanCursor *cur, int indent)
 {
     int len = 0;
-    skipws(str);
-    if (!**str) return;
+    skipws(str, end);
+    if (*str == end) return;
     if (indent < 0)
     {
 	indent = -indent;
     }
     else
     {
-	if (ctx->cpp) fputs("\\n\" \\\n\"", out);
-	else fputc('\n', out);
-	if (indent) fprintf(out, "%*s", indent, "");
+	if (ctx->cpp) Sink_puts(out, "\\n\" \\\n\"");
+	else Sink_putc(out, '\n');
+	Sink_pad(out, ' ', indent);
     }
-    while (**str)
+    while (*str < end)
     {
 	char wsbuf[78] = {0};
 	char *wsp = wsbuf;
-	while (len + indent < 78 && (**str == ' ' || **str == '\t'))
+	while (len + indent < 78 && *str < end
+		&& (**str == ' ' || **str == '\t'))
 	{
 	    *wsp++ = *(*str)++;
 	    ++len;
 	}
-	size_t wlen = strcspn(*str, " \t");
+	size_t wlen = 0;
+	const CDSpan *next = 0;
+	if (cur && cur->span < cur->end
+		&& *str == cur->base + cur->span->off)
+	{
+	    next = cur->span;
+	    do ++next;
+	    while (next < cur->end && !(next->flags & SF_SPACE));
+	    wlen = cur->base + next[-1].off + next[-1].len - *str;
+	}
+	else while (*str + wlen < end && (*str)[wlen] != ' '
+		&& (*str)[wlen] != '\t') ++wlen;
 	size_t olen = 0;
 	size_t rlen = 0;
 	size_t plen = 0;
 	const char *repl = 0;
+	size_t repllen = 0;
 	const char *token = 0;
 	if (wlen >= 8 && (token = findstrpos(*str, "%%name%%", wlen)))
 	{
 	    repl = ctx->name;
+	    repllen = ctx->namelen;
 	    rlen = 8;
-	    olen = wlen - rlen + strlen(repl);
+	    olen = wlen - rlen + repllen;
 	    plen = token - *str;
 	    wlen -= (rlen + plen);
 	}
 	else if (wlen >= 7 && (token = findstrpos(*str, "%%arg%%", wlen)))
 	{
 	    repl = ctx->arg;
+	    repllen = ctx->arglen;
 	    rlen = 7;
-	    olen = wlen - rlen + strlen(repl);
+	    olen = wlen - rlen + repllen;
 	    plen = token - *str;
 	    wlen -= (rlen + plen);
 	}
 	else olen = wlen;
 	if (!len || len + indent + olen < 78)
 	{
-	    wsp = wsbuf;
-	    while (*wsp) fputc(*wsp++, out);
+	    Sink_write(out, wsbuf, wsp - wsbuf);
 	    if (repl)
 	    {
-		for (size_t i = 0; i < plen; ++i) srcputc(out, ctx, (*str)[i]);
+		srcwrite(out, ctx, *str, plen);
 		*str += rlen + plen;
-		while (*repl) srcputc(out, ctx, *repl++);
+		srcwrite(out, ctx, repl, repllen);
 	    }
-	    for (size_t i = 0; i < wlen; ++i) srcputc(out, ctx, (*str)[i]);
+	    srcwrite(out, ctx, *str, wlen);
 	    *str += wlen;
 	    len += olen;
+	    if (next) cur->span = next;
 	}
 	else break;
     }
 }
 
-static int writeUsageFlag(FILE *out, const Ctx *ctx, int pos,
-	const char *flag, int optional)
+static int writeUsageFlag(Sink *out, const Ctx *ctx, int pos,
+	const char *pre, const char *flag, size_t flaglen, int optional)
 {
-    size_t len = strlen(flag);
+    size_t len = strlen(pre) + flaglen;
     if (optional) len += 2;
     if (pos > 12 && pos + len >= 78)
     {
-	if (ctx->cpp) fputs("\\n\" \\\n\"            ", out);
-	else fputs("\n            ", out);
+	if (ctx->cpp) Sink_puts(out, "\\n\" \\\n\"            ");
+	else Sink_puts(out, "\n            ");
 	pos = 12;
     }
     else
     {
 	++len;
-	fputc(' ', out);
+	Sink_putc(out, ' ');
     }
-    if (optional) fputc('[', out);
-    while (*flag) srcputc(out, ctx, *flag++);
-    if (optional) fputc(']', out);
+    if (optional) Sink_putc(out, '[');
+    srcwrite(out, ctx, pre, strlen(pre));
+    srcwrite(out, ctx, flag, flaglen);
+    if (optional) Sink_putc(out, ']');
     return pos + len;
 }
 
 #define err(m) do { \
-    fprintf(stderr, "Cannot write src: %s\n", (m)); goto error; } while (0)
+    fprintf(diagout(), "Cannot write src: %s\n", (m)); goto error; } while (0)
 #define istext(m) ((m) && CliDoc_type(m) == CT_TEXT)
 
-static void writeDescription(FILE *out, Ctx *ctx,
+static void writeDescription(Sink *out, Ctx *ctx,
 	const CliDoc *desc, int indent);
 
-static void writeList(FILE *out, Ctx *ctx,
+static void writeList(Sink *out, Ctx *ctx,
 	const CliDoc *list, int indent)
 {
     size_t len = CDList_length(list);
@@ -147,26 +219,32 @@ static void writeList(FILE *out, Ctx *ctx,
     }
 }
 
-static void writeDict(FILE *out, Ctx *ctx,
+static void writeDict(Sink *out, Ctx *ctx,
 	const CliDoc *dict, int indent)
 {
     int subindent = 0;
     size_t len = CDDict_length(dict);
     for (size_t i = 0; i < len; ++i)
     {
-	size_t keywidth = strlen(CDDict_key(dict, i)) + 2;
+	size_t keywidth;
+	CDDict_keyn(dict, i, &keywidth);
+	keywidth += 2;
 	if (keywidth > (size_t)subindent) subindent = keywidth;
     }
     for (size_t i = 0; i < len; ++i)
     {
-	fprintf(out, ctx->cpp ? "\\n\" \\\n\"%*s%-*s" : "\n%*s%-*s",
-		indent, "", subindent, CDDict_key(dict, i));
+	size_t keylen;
+	const char *key = CDDict_keyn(dict, i, &keylen);
+	Sink_puts(out, ctx->cpp ? "\\n\" \\\n\"" : "\n");
+	Sink_pad(out, ' ', indent);
+	Sink_write(out, key, keylen);
+	Sink_pad(out, ' ', subindent - keylen);
 	ctx->first = 1;
 	writeDescription(out, ctx, CDDict_val(dict, i), indent + subindent);
     }
 }
 
-static void writeTable(FILE *out, Ctx *ctx,
+static void writeTable(Sink *out, Ctx *ctx,
 	const CliDoc *table, int indent)
 {
     size_t width = CDTable_width(table);
@@ -176,7 +254,8 @@ static void writeTable(FILE *out, Ctx *ctx,
     {
 	for (size_t x = 0; x < width && x < 32; ++x)
 	{
-	    size_t cw = strlen(CDTable_cell(table, x, y));
+	    size_t cw;
+	    CDTable_celln(table, x, y, &cw);
 	    if (cw > (size_t)colpos[x]) colpos[x] = cw;
 	}
     }
@@ -188,61 +267,68 @@ static void writeTable(FILE *out, Ctx *ctx,
     }
     for (size_t y = 0; y < height; ++y)
     {
-	if (!ctx->first) fprintf(out, ctx->cpp ? "\\n\" \\\n\"%*s" : "\n%*s",
-		indent, "");
+	if (!ctx->first)
+	{
+	    Sink_puts(out, ctx->cpp ? "\\n\" \\\n\"" : "\n");
+	    Sink_pad(out, ' ', indent);
+	}
 	ctx->first = 0;
 	pos = 0;
 	for (size_t x = 0; x < width; ++x)
 	{
-	    const char *cell = CDTable_cell(table, x, y);
-	    while (*cell)
+	    size_t celllen;
+	    const char *cell = CDTable_celln(table, x, y, &celllen);
+	    const char *end = cell + celllen;
+	    while (cell < end)
 	    {
-		if (!strncmp(cell, "%%name%%", 8))
+		if (end - cell >= 8 && !memcmp(cell, "%%name%%", 8))
 		{
-		    const char *repl = ctx->name;
-		    while (*repl)
-		    {
-			srcputc(out, ctx, *repl++);
-			++pos;
-		    }
+		    srcwrite(out, ctx, ctx->name, ctx->namelen);
+		    pos += ctx->namelen;
 		    cell += 8;
 		}
-		else if (!strncmp(cell, "%%arg%%", 7))
+		else if (end - cell >= 7 && !memcmp(cell, "%%arg%%", 7))
 		{
-		    const char *repl = ctx->arg;
-		    while (*repl)
-		    {
-			srcputc(out, ctx, *repl++);
-			++pos;
-		    }
-		    cell += 8;
+		    srcwrite(out, ctx, ctx->arg, ctx->arglen);
+		    pos += ctx->arglen;
+		    cell += 7;
 		}
 		else
 		{
-		    srcputc(out, ctx, *cell++);
-		    ++pos;
+		    const char *run = memchr(cell + 1, '%', end - cell - 1);
+		    if (!run) run = end;
+		    srcwrite(out, ctx, cell, run - cell);
+		    pos += run - cell;
+		    cell = run;
 		}
 	    }
-	    if (x < width - 1) while (pos < colpos[x])
+	    if (x < width - 1 && pos < colpos[x])
 	    {
-		fputc(' ', out);
-		++pos;
+		Sink_pad(out, ' ', colpos[x] - pos);
+		pos = colpos[x];
 	    }
 	}
     }
 }
 
-static void writeDescription(FILE *out, Ctx *ctx,
+static void writeDescription(Sink *out, Ctx *ctx,
 	const CliDoc *desc, int indent)
 {
     const char *str;
+    size_t len;
+    size_t nspans;
+    SpanCursor cur;
     switch (CliDoc_type(desc))
     {
 	case CT_TEXT:
-	    str = CDText_str(desc);
-	    while (*str)
+	    str = CDText_strn(desc, &len);
+	    cur.base = str;
+	    cur.span = CDText_spans(desc, &nspans);
+	    cur.end = cur.span + nspans;
+	    for (const char *end = str + len; str < end;)
 	    {
-		writeSrcStrLine(out, ctx, &str, (ctx->first?-1:1) * indent);
+		writeSrcStrLine(out, ctx, &str, end, &cur,
+			(ctx->first?-1:1) * indent);
 		ctx->first = 0;
 	    }
 	    break;
@@ -264,7 +350,7 @@ static void writeDescription(FILE *out, Ctx *ctx,
     }
 }
 
-static void writeArgDesc(FILE *out, Ctx *ctx,
+static void writeArgDesc(Sink *out, Ctx *ctx,
 	const CliDoc *arg, int indent)
 {
     writeDescription(out, ctx, CDArg_description(arg), indent);
@@ -274,337 +360,390 @@ static void writeArgDesc(FILE *out, Ctx *ctx,
     if (istext(min) || istext(max) || istext(def))
     {
 	const char *minstr = 0;
+	size_t minlen = 0;
 	size_t mmdlen = 0;
 	if (istext(min))
 	{
-	    minstr = CDText_str(min);
-	    mmdlen += strlen(minstr) + 5;
+	    minstr = CDText_strn(min, &minlen);
+	    mmdlen += minlen + 5;
 	}
 	const char *maxstr = 0;
+	size_t maxlen = 0;
 	if (istext(max))
 	{
-	    maxstr = CDText_str(max);
+	    maxstr = CDText_strn(max, &maxlen);
 	    if (mmdlen) mmdlen += 2;
-	    mmdlen += strlen(maxstr) + 5;
+	    mmdlen += maxlen + 5;
 	}
 	const char *defstr = 0;
+	size_t deflen = 0;
 	if (istext(def))
 	{
-	    defstr = CDText_str(def);
+	    defstr = CDText_strn(def, &deflen);
 	    if (mmdlen) mmdlen += 2;
-	    mmdlen += strlen(defstr) + 9;
+	    mmdlen += deflen + 9;
 	}
 	char *mmd = xmalloc(mmdlen + 1);
-	*mmd = 0;
+	size_t pos = 0;
 	if (minstr)
 	{
-	    strcat(mmd, "min: ");
-	    strcat(mmd, minstr);
+	    pos += sprintf(mmd + pos, "min: %.*s", (int)minlen, minstr);
 	}
 	if (maxstr)
 	{
-	    if (*mmd) strcat(mmd, ", max: ");
-	    else strcat(mmd, "max: ");
-	    strcat(mmd, maxstr);
+	    pos += sprintf(mmd + pos, pos ? ", max: %.*s" : "max: %.*s",
+		    (int)maxlen, maxstr);
 	}
 	if (defstr)
 	{
-	    if (*mmd) strcat(mmd, ", default: ");
-	    else strcat(mmd, "default: ");
-	    strcat(mmd, defstr);
+	    pos += sprintf(mmd + pos, pos ? ", default: %.*s"
+		    : "default: %.*s", (int)deflen, defstr);
 	}
 	const char *str = mmd;
-	while (*str)
+	while (str < mmd + pos)
 	{
-	    writeSrcStrLine(out, ctx, &str, (ctx->first?-1:1) * indent);
+	    writeSrcStrLine(out, ctx, &str, mmd + pos, 0,
+		    (ctx->first?-1:1) * indent);
 	    ctx->first = 0;
 	}
 	free(mmd);
     }
 }
 
-static int write(FILE *out, const CliDoc *root, int cpp)
+static int writeSrc(Sink *out, Sink *helpout, const CliDoc *root, int cpp)
 {
     assert(CliDoc_type(root) == CT_ROOT);
 
     const CliDoc *name = CDRoot_name(root);
     if (!istext(name)) err("missing name");
-    const char *namestr = CDText_str(name);
-    Ctx ctx = { namestr, 0, cpp, 0};
+    size_t namelen;
+    const char *namestr = CDText_strn(name, &namelen);
+    Ctx ctx = { namestr, 0, namelen, 0, cpp, 0};
     char ucname[64];
     int usagewidth;
     int i;
     if (cpp)
     {
-	for (i = 0; i < 63 && namestr[i]; ++i)
+	for (i = 0; i < 63 && (size_t)i < namelen; ++i)
 	{
 	    ucname[i] = toupper(namestr[i]);
 	}
 	ucname[i] = 0;
 	usagewidth = i;
 
-	fprintf(out, "#ifndef %s_HELP\n\n#undef %s_USAGE_FMT\n"
+	Sink_printf(out, "#ifndef %s_HELP\n\n#undef %s_USAGE_FMT\n"
 		"#undef %s_USAGE_ARGS\n\n#define %s_USAGE_FMT \\\n\"Usage: %%s",
 		ucname, ucname, ucname, ucname);
     }
     else
     {
-	usagewidth = strlen(namestr);
-	fputs("usage() {\n  echo \"\\\nUsage: $1", out);
+	usagewidth = namelen;
+	Sink_puts(out, "usage() {\n  echo \"\\\nUsage: $1");
     }
     if (usagewidth < 32) usagewidth = 32;
 
     int nflags = CDRoot_nflags(root);
     int nargs = CDRoot_nargs(root);
+    size_t ngroups = CDRoot_ngroups(root);
+    const char *synflags = CDRoot_synflags(root);
     int separators = 0;
     int indent = 0;
     char flagstr[256];
 
-    if (nflags + nargs > 0)
+    for (size_t g = 0; g < ngroups; ++g)
     {
-	int defgroup = CDRoot_defgroup(root);
-	int n;
-	for (i = 0, n = 0; i <= defgroup || n; ++i, n = 0)
+	int pos = usagewidth;
+	if (g) Sink_puts(out, cpp ? "\\n\" \\\n\"       %s" : "\n       $1");
+	size_t nitems;
+	const CDSynItem *item = CDRoot_group(root, g, &nitems);
+	for (const CDSynItem *end = item + nitems; item < end; ++item)
 	{
-	    char noarg[128] = {0};
-	    char rnoarg[128] = {0};
-	    int nalen = 0;
-	    int rnalen = 0;
-	    for (int j = 0; j < nflags; ++j)
-	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		if (CDFlag_arg(flag)) continue;
-		if (CDFlag_flag(flag) == '-') continue;
-		if (CDFlag_optional(flag) == 0)
-		{
-		    rnoarg[rnalen++] = CDFlag_flag(flag);
-		    if (rnalen == sizeof rnoarg) err("too many flags");
-		}
-		else
-		{
-		    noarg[nalen++] = CDFlag_flag(flag);
-		    if (nalen == sizeof noarg) err("too many flags");
-		}
-	    }
-	    int pos = usagewidth;
-	    if (i) fputs (cpp ? "\\n\" \\\n\"       %s" : "\n       $1" , out);
-	    if (rnalen)
+	    int optional = item->type == SY_OPTFLAGS
+		|| item->type == SY_OPTFLAGARG || item->type == SY_SEPARATOR
+		|| item->type == SY_OPTARG;
+	    if (item->type == SY_FLAGS || item->type == SY_OPTFLAGS)
 	    {
-		sprintf(flagstr, "-%s", rnoarg);
-		pos = writeUsageFlag(out, &ctx, pos, flagstr, 0);
-		++n;
+		pos = writeUsageFlag(out, &ctx, pos, "-",
+			synflags + item->index, item->len, optional);
 	    }
-	    if (nalen)
+	    else if (item->type == SY_SEPARATOR)
 	    {
-		sprintf(flagstr, "-%s", noarg);
-		pos = writeUsageFlag(out, &ctx, pos, flagstr, 1);
-		++n;
+		++separators;
+		pos = writeUsageFlag(out, &ctx, pos, "", "--", 2, 1);
 	    }
-	    for (int j = 0; j < nflags; ++j)
+	    else if (item->type == SY_FLAGARG || item->type == SY_OPTFLAGARG)
 	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		if (CDFlag_optional(flag)) continue;
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *arg = CDFlag_arg(flag);
-		if (!arg) continue;
-		size_t arglen = strlen(arg);
+		const CliDoc *flag = CDRoot_flag(root, item->index);
+		size_t arglen;
+		const char *arg = CDFlag_argn(flag, &arglen);
 		if (arglen > 80) err("argument too long");
 		if (arglen + 3 > (size_t)indent) indent = arglen + 3;
-		sprintf(flagstr, "-%c %s", CDFlag_flag(flag), arg);
-		pos = writeUsageFlag(out, &ctx, pos, flagstr, 0);
+		char pre[] = { '-', CDFlag_flag(flag), ' ', 0 };
+		pos = writeUsageFlag(out, &ctx, pos, pre,
+			arg, arglen, optional);
 	    }
-	    for (int j = 0; j < nflags; ++j)
+	    else
 	    {
-		const CliDoc *flag = CDRoot_flag(root, j);
-		if (!CDFlag_optional(flag)) continue;
-		int group = CDFlag_group(flag);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *arg = CDFlag_arg(flag);
-		if (!arg)
-		{
-		    if (CDFlag_flag(flag) == '-')
-		    {
-			++separators;
-			sprintf(flagstr, "--");
-			pos = writeUsageFlag(out, &ctx, pos, flagstr, 1);
-		    }
-		    continue;
-		}
-		size_t arglen = strlen(arg);
-		if (arglen > 80) err("argument too long");
-		if (arglen + 3 > (size_t)indent) indent = arglen + 3;
-		sprintf(flagstr, "-%c %s", CDFlag_flag(flag), arg);
-		pos = writeUsageFlag(out, &ctx, pos, flagstr, 1);
-	    }
-	    for (int j = 0; j < nargs; ++j)
-	    {
-		const CliDoc *arg = CDRoot_arg(root, j);
-		if (CDArg_optional(arg)) continue;
-		int group = CDArg_group(arg);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *argstr = CDArg_arg(arg);
-		size_t arglen = strlen(argstr);
-		if (arglen > 80) err("argument too long");
-		if (arglen > (size_t)indent) indent = arglen;
-		pos = writeUsageFlag(out, &ctx, pos, argstr, 0);
-	    }
-	    for (int j = 0; j < nargs; ++j)
-	    {
-		const CliDoc *arg = CDRoot_arg(root, j);
-		if (!CDArg_optional(arg)) continue;
-		int group = CDArg_group(arg);
-		if (group < 0) group = defgroup;
-		if (group < 0) group = 0;
-		if (group != i) continue;
-		const char *argstr = CDArg_arg(arg);
-		size_t arglen = strlen(argstr);
+		size_t arglen;
+		const char *arg = CDArg_argn(CDRoot_arg(root, item->index),
+			&arglen);
 		if (arglen > 80) err("argument too long");
 		if (arglen > (size_t)indent) indent = arglen;
-		pos = writeUsageFlag(out, &ctx, pos, argstr, 1);
+		pos = writeUsageFlag(out, &ctx, pos, "",
+			arg, arglen, optional);
 	    }
 	}
     }
 
     if (cpp)
     {
-	fprintf(out, "\\n\"\n\n#define %s_USAGE_ARGS(argv0)", ucname);
-	for (int j = 0; j < i; ++j)
+	Sink_printf(out, "\\n\"\n\n#define %s_USAGE_ARGS(argv0)", ucname);
+	for (size_t j = 0; j < ngroups || !j; ++j)
 	{
-	    fputc(j ? ',' : ' ', out);
-	    fputs("(argv0)", out);
+	    Sink_putc(out, j ? ',' : ' ');
+	    Sink_puts(out, "(argv0)");
 	}
-	fprintf(out, "\n\n#define %s_HELP", ucname);
+	Sink_printf(out, "\n\n#define %s_HELP", ucname);
+    }
+    else
+    {
+	Sink_puts(out, "\"\n}\n");
+	if (helpout == out) Sink_putc(out, '\n');
+	out = helpout;
+	Sink_puts(out, "help() {\n  usage \"$1\"\n  echo \"");
     }
-    else fputs ("\"\n}\n\nhelp() {\n  usage \"$1\"\n  echo \"", out);
 
     if (nflags + nargs - separators > 0)
     {
 	indent += 2;
-	if (cpp) fputs(" \"", out);
+	if (cpp) Sink_puts(out, " \"");
 	for (i = 0; i < nflags; ++i)
 	{
 	    const CliDoc *flag = CDRoot_flag(root, i);
 	    if (CDFlag_flag(flag) == '-') continue;
-	    const char *arg = CDFlag_arg(flag);
-	    if (arg) sprintf(flagstr, "-%c %s", CDFlag_flag(flag), arg);
+	    size_t arglen = 0;
+	    const char *arg = CDFlag_argn(flag, &arglen);
+	    if (arg) sprintf(flagstr, "-%c %.*s", CDFlag_flag(flag),
+		    (int)arglen, arg);
 	    else sprintf(flagstr, "-%c", CDFlag_flag(flag));
-	    fprintf(out, cpp ? "\\n\" \\\n\"    %-*s" : "\n    %-*s",
+	    Sink_printf(out, cpp ? "\\n\" \\\n\"    %-*s" : "\n    %-*s",
 		    indent, flagstr);
 	    ctx.arg = arg;
+	    ctx.arglen = arglen;
 	    ctx.first = 1;
 	    writeArgDesc(out, &ctx, flag, indent + 4);
 	}
 	for (i = 0; i < nargs; ++i)
 	{
 	    const CliDoc *arg = CDRoot_arg(root, i);
-	    fprintf(out, cpp ? "\\n\" \\\n\"    %-*s" : "\n    %-*s",
-		    indent, CDArg_arg(arg));
-	    ctx.arg = CDArg_arg(arg);
+	    ctx.arg = CDArg_argn(arg, &ctx.arglen);
+	    int pad = indent > (int)ctx.arglen ? indent - (int)ctx.arglen : 0;
+	    Sink_puts(out, cpp ? "\\n\" \\\n\"    " : "\n    ");
+	    Sink_write(out, ctx.arg, ctx.arglen);
+	    Sink_pad(out, ' ', pad);
 	    ctx.first = 1;
 	    writeArgDesc(out, &ctx, arg, indent + 4);
 	}
-	if (cpp) fputs("\\n\"", out);
+	if (cpp) Sink_puts(out, "\\n\"");
     }
 
-    if (cpp) fputs("\n\n#endif\n", out);
-    else fputs("\"\n}\n", out);
+    if (cpp) Sink_puts(out, "\n\n#endif\n");
+    else Sink_puts(out, "\"\n}\n");
     return 0;
 
 error:
     return -1;
 }
 
-int writeCpp(FILE *out, const CliDoc *root, const char *args)
+SOEXPORT int writeCpp(Sink *out, const CliDoc *root, const char *args)
 {
     if (args)
     {
-	fputs("The cpp format does not support any arguments.\n", stderr);
+	fputs("The cpp format does not support any arguments.\n", diagout());
 	return -1;
     }
-    return write(out, root, 1);
+    return writeSrc(out, out, root, 1);
 }
 
-int writeSh(FILE *out, const CliDoc *root, const char *args)
+char *dependsSh(const char *args)
 {
-    const char *sub = "%%CLIDOC%%";
-    const char *fname = 0;
-    FILE *tmpl = 0;
-    int rc = -1;
-    char buf[512];
+    if (strncmp(args, "t=", 2)) return 0;
+    const char *colon = strchr(args + 2, ':');
+    size_t len = colon ? (size_t)(colon - args - 2) : strlen(args + 2);
+    char *fname = xmalloc(len + 1);
+    memcpy(fname, args + 2, len);
+    fname[len] = 0;
+    return fname;
+}
 
-    if (args)
+static const char *const tmplnames[TS_NSLOTS] = {
+    "%%USAGE%%",
+    "%%HELP%%",
+    "%%CLIDOC%%",
+    "%%NAME%%",
+    "%%VERSION%%"
+};
+
+static void addpart(Template *tmpl, size_t *capa,
+	TmplSlot slot, size_t off, size_t len)
+{
+    if (tmpl->nparts == *capa)
     {
-	if (!strncmp(args, "t=", 2))
-	{
-	    char *tmp = 0;
-	    char *colon = strchr(args + 2, ':');
-	    if (colon)
-	    {
-		sub = colon+1;
-		tmp = xmalloc(colon - args - 1);
-		strncpy(tmp, args + 2, colon - args - 2);
-		tmp[colon - args - 2] = 0;
-		fname = tmp;
-	    }
-	    else fname = args + 2;
-	    tmpl = fopen(fname, "r");
-	    free(tmp);
-	    if (!tmpl)
-	    {
-		fprintf(stderr, "Can't open %s for reading.", fname);
-		goto done;
-	    }
-	}
-	else
-	{
-	    fprintf(stderr, "Unknown arguments for sh format: %s\n", args);
-	    fputs("Supported: t=<file>[:sub] (use a template file)\n", stderr);
-	    goto done;
-	}
+	*capa *= 2;
+	tmpl->parts = xrealloc(tmpl->parts, *capa * sizeof *tmpl->parts);
     }
-    if (tmpl)
+    tmpl->parts[tmpl->nparts++] = (TmplPart){ slot, off, len };
+}
+
+static void *loadTemplate(const char *key, int fd, const struct stat *st)
+{
+    char *fname = dependsSh(key);
+    const char *colon = strchr(key + 2, ':');
+    const char *names[TS_NSLOTS];
+    const char *next[TS_NSLOTS];
+    size_t namelen[TS_NSLOTS];
+    size_t len;
+    size_t capa = 8;
+    size_t pos = 0;
+    Template *tmpl = xmalloc(sizeof *tmpl);
+    tmpl->parts = xmalloc(capa * sizeof *tmpl->parts);
+    tmpl->nparts = 0;
+
+    if (!(tmpl->data = readfd(fd, S_ISREG(st->st_mode) ? st->st_size : 0,
+		    &len)))
     {
-	int sublen = strlen(sub);
-	while (fgets(buf, sizeof buf, tmpl))
-	{
-	    if (!strncmp(buf, sub, sublen) && buf[sublen] == '\n') break;
-	    fputs(buf, out);
-	}
-	if (ferror(tmpl))
+	fprintf(diagout(), "Error reading %s\n", fname);
+	goto error;
+    }
+    memcpy(names, tmplnames, sizeof names);
+    if (colon) names[TS_CLIDOC] = colon + 1;
+    for (int i = 0; i < TS_NSLOTS; ++i)
+    {
+	namelen[i] = strlen(names[i]);
+	next[i] = findstrpos(tmpl->data, names[i], len);
+    }
+    for (;;)
+    {
+	int slot = -1;
+	for (int i = 0; i < TS_NSLOTS; ++i)
 	{
-	    fprintf(stderr, "Error reading %s\n", fname);
-	    goto done;
+	    if (next[i] && (slot < 0 || next[i] < next[slot])) slot = i;
 	}
-	if (feof(tmpl))
+	if (slot < 0) break;
+	size_t off = next[slot] - tmpl->data;
+	if (off > pos) addpart(tmpl, &capa, TS_TEXT, pos, off - pos);
+	addpart(tmpl, &capa, slot, 0, 0);
+	pos = off + namelen[slot];
+	if (slot <= TS_CLIDOC && pos < len && tmpl->data[pos] == '\n') ++pos;
+	for (int i = 0; i < TS_NSLOTS; ++i)
 	{
-	    fprintf(stderr, "%s not found in %s\n", sub, fname);
-	    goto done;
+	    if (next[i] && next[i] < tmpl->data + pos) next[i] = findstrpos(
+		    tmpl->data + pos, names[i], len - pos);
 	}
     }
-    rc = write(out, root, 0);
-    if (rc < 0) goto done;
-    if (tmpl)
+    if (!tmpl->nparts)
+    {
+	fprintf(diagout(), "%s not found in %s\n", names[TS_CLIDOC], fname);
+	goto error;
+    }
+    if (pos < len) addpart(tmpl, &capa, TS_TEXT, pos, len - pos);
+    free(fname);
+    return tmpl;
+
+error:
+    free(tmpl->data);
+    free(tmpl->parts);
+    free(tmpl);
+    free(fname);
+    return 0;
+}
+
+static void unloadTemplate(void *obj)
+{
+    Template *tmpl = obj;
+    free(tmpl->data);
+    free(tmpl->parts);
+    free(tmpl);
+}
+
+static CachedFile *getTemplate(const char *args, const char *fname)
+{
+    int fd = open(fname, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+    {
+	fprintf(diagout(), "Can't open %s for reading.\n", fname);
+	return 0;
+    }
+    CachedFile *tmpl = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+	tmpl = getCached(RK_TEMPLATE, args, fd, &st,
+		loadTemplate, unloadTemplate);
+    }
+    else diagerror(fname);
+    close(fd);
+    return tmpl;
+}
+
+SOEXPORT int writeSh(Sink *out, const CliDoc *root, const char *args)
+{
+    char *fname = 0;
+    CachedFile *cached = 0;
+    Sink *usage = 0;
+    Sink *help = 0;
+    int rc = -1;
+
+    if (!args) return writeSrc(out, out, root, 0);
+    const char *colon = strchr(args, ':');
+    if (!(fname = dependsSh(args)) || (colon && !colon[1]))
+    {
+	fprintf(diagout(), "Unknown arguments for sh format: %s\n", args);
+	fputs("Supported: t=<file>[:sub] (use a template file)\n",
+		diagout());
+	goto done;
+    }
+    if (!(cached = getTemplate(args, fname))) goto done;
+
+    usage = Sink_createMem();
+    help = Sink_createMem();
+    if ((rc = writeSrc(usage, help, root, 0)) < 0) goto done;
+
+    Slice gen[TS_NSLOTS] = { { 0, 0 } };
+    gen[TS_USAGE].str = Sink_data(usage, &gen[TS_USAGE].len);
+    gen[TS_HELP].str = Sink_data(help, &gen[TS_HELP].len);
+    gen[TS_NAME].str = CDText_strn(CDRoot_name(root), &gen[TS_NAME].len);
+    const CliDoc *version = CDRoot_version(root);
+    if (istext(version))
+    {
+	gen[TS_VERSION].str = CDText_strn(version, &gen[TS_VERSION].len);
+    }
+
+    const Template *tmpl = CachedFile_obj(cached);
+    for (size_t i = 0; i < tmpl->nparts; ++i)
     {
-	while (fgets(buf, sizeof buf, tmpl)) fputs(buf, out);
-	if (ferror(tmpl))
+	const TmplPart *part = tmpl->parts + i;
+	switch (part->slot)
 	{
-	    fprintf(stderr, "Error reading %s\n", fname);
-	    rc = -1;
+	    case TS_TEXT:
+		Sink_write(out, tmpl->data + part->off, part->len);
+		break;
+
+	    case TS_CLIDOC:
+		Sink_write(out, gen[TS_USAGE].str, gen[TS_USAGE].len);
+		Sink_putc(out, '\n');
+		Sink_write(out, gen[TS_HELP].str, gen[TS_HELP].len);
+		break;
+
+	    default:
+		Sink_write(out, gen[part->slot].str, gen[part->slot].len);
 	}
     }
 
 done:
-    if (tmpl) fclose(tmpl);
+    Sink_destroy(help);
+    Sink_destroy(usage);
+    CachedFile_release(cached);
+    free(fname);
     return rc;
 }
@@ -3,13 +3,12 @@
 
 #include "decl.h"
 
-#include <stdio.h>
-
 C_CLASS_DECL(CliDoc);
+C_CLASS_DECL(Sink);
 
-int writeCpp(FILE *out, const CliDoc *root, const char *args)
+DECLEXPORT int writeCpp(Sink *out, const CliDoc *root, const char *args)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
-int writeSh(FILE *out, const CliDoc *root, const char *args)
+DECLEXPORT int writeSh(Sink *out, const CliDoc *root, const char *args)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
 
 #endif
@@ -0,0 +1,179 @@
+#include "strindex.h"
+
+#include "arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define HAVE_X86SIMD
+#  include <immintrin.h>
+#endif
+
+struct StrIndex
+{
+    const char *buf;
+    size_t len;
+    size_t nblocks;
+    uint64_t *nl;
+    uint64_t *st;
+};
+
+static unsigned lowbit(uint64_t m)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(m);
+#else
+    unsigned i = 0;
+    while (!(m & 1))
+    {
+	m >>= 1;
+	++i;
+    }
+    return i;
+#endif
+}
+
+static void indexscalar(StrIndex *self, size_t block)
+{
+    for (; block < self->nblocks; ++block)
+    {
+	const char *s = self->buf + 64 * block;
+	size_t n = self->len - 64 * block;
+	if (n > 64) n = 64;
+	uint64_t nl = 0;
+	uint64_t st = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+	    uint64_t bit = (uint64_t)1 << i;
+	    switch (s[i])
+	    {
+		case '\n':
+		    nl |= bit;
+		    break;
+
+		case '|':
+		case ':':
+		case ']':
+		    st |= bit;
+		    break;
+
+		default:
+		    break;
+	    }
+	}
+	self->nl[block] = nl;
+	self->st[block] = st;
+    }
+}
+
+#ifdef HAVE_X86SIMD
+__attribute__ ((target ("sse2")))
+static void indexsse2(StrIndex *self)
+{
+    const __m128i vnl = _mm_set1_epi8('\n');
+    const __m128i vpipe = _mm_set1_epi8('|');
+    const __m128i vcolon = _mm_set1_epi8(':');
+    const __m128i vbrack = _mm_set1_epi8(']');
+    size_t full = self->len / 64;
+    for (size_t block = 0; block < full; ++block)
+    {
+	const char *s = self->buf + 64 * block;
+	uint64_t nl = 0;
+	uint64_t st = 0;
+	for (unsigned i = 0; i < 4; ++i)
+	{
+	    __m128i v = _mm_loadu_si128((const __m128i *)(s + 16 * i));
+	    __m128i x = _mm_or_si128(_mm_cmpeq_epi8(v, vpipe),
+		    _mm_or_si128(_mm_cmpeq_epi8(v, vcolon),
+			_mm_cmpeq_epi8(v, vbrack)));
+	    nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+		    _mm_cmpeq_epi8(v, vnl)) << 16 * i;
+	    st |= (uint64_t)(uint16_t)_mm_movemask_epi8(x) << 16 * i;
+	}
+	self->nl[block] = nl;
+	self->st[block] = st;
+    }
+    indexscalar(self, full);
+}
+
+__attribute__ ((target ("avx2")))
+static void indexavx2(StrIndex *self)
+{
+    const __m256i vnl = _mm256_set1_epi8('\n');
+    const __m256i vpipe = _mm256_set1_epi8('|');
+    const __m256i vcolon = _mm256_set1_epi8(':');
+    const __m256i vbrack = _mm256_set1_epi8(']');
+    size_t full = self->len / 64;
+    for (size_t block = 0; block < full; ++block)
+    {
+	const char *s = self->buf + 64 * block;
+	uint64_t nl = 0;
+	uint64_t st = 0;
+	for (unsigned i = 0; i < 2; ++i)
+	{
+	    __m256i v = _mm256_loadu_si256((const __m256i *)(s + 32 * i));
+	    __m256i x = _mm256_or_si256(_mm256_cmpeq_epi8(v, vpipe),
+		    _mm256_or_si256(_mm256_cmpeq_epi8(v, vcolon),
+			_mm256_cmpeq_epi8(v, vbrack)));
+	    nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+		    _mm256_cmpeq_epi8(v, vnl)) << 32 * i;
+	    st |= (uint64_t)(uint32_t)_mm256_movemask_epi8(x) << 32 * i;
+	}
+	self->nl[block] = nl;
+	self->st[block] = st;
+    }
+    indexscalar(self, full);
+}
+#endif
+
+StrIndex *StrIndex_create(const char *buf, size_t len, Arena *arena)
+{
+    StrIndex *self = Arena_alloc(arena, sizeof *self);
+    self->buf = buf;
+    self->len = len;
+    self->nblocks = (len + 63) / 64;
+    self->nl = Arena_alloc(arena, (self->nblocks + 1) * sizeof *self->nl);
+    self->st = Arena_alloc(arena, (self->nblocks + 1) * sizeof *self->st);
+#ifdef HAVE_X86SIMD
+    if (__builtin_cpu_supports("avx2")) indexavx2(self);
+    else if (__builtin_cpu_supports("sse2")) indexsse2(self);
+    else
+#endif
+    indexscalar(self, 0);
+    return self;
+}
+
+static const char *nextbit(const StrIndex *self, const uint64_t *masks,
+	const char *pos, const char *end)
+{
+    size_t off = pos - self->buf;
+    size_t endoff = end - self->buf;
+    if (off >= endoff) return 0;
+    size_t block = off / 64;
+    uint64_t m = masks[block] & (~(uint64_t)0 << (off % 64));
+    while (!m)
+    {
+	if (++block * 64 >= endoff) return 0;
+	m = masks[block];
+    }
+    off = 64 * block + lowbit(m);
+    return off < endoff ? self->buf + off : 0;
+}
+
+const char *StrIndex_eol(const StrIndex *self, const char *pos)
+{
+    return nextbit(self, self->nl, pos, self->buf + self->len);
+}
+
+const char *StrIndex_chr(const StrIndex *self, const char *pos,
+	const char *end, char c)
+{
+    assert(c == '|' || c == ':' || c == ']');
+    while ((pos = nextbit(self, self->st, pos, end)))
+    {
+	if (*pos == c) return pos;
+	++pos;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef MKCLIDOC_STRINDEX_H
+#define MKCLIDOC_STRINDEX_H
+
+#include "decl.h"
+
+#include <stddef.h>
+
+C_CLASS_DECL(Arena);
+C_CLASS_DECL(StrIndex);
+
+StrIndex *StrIndex_create(const char *buf, size_t len, Arena *arena)
+    ATTR_NONNULL((3)) ATTR_RETNONNULL;
+const char *StrIndex_eol(const StrIndex *self, const char *pos)
+    CMETHOD ATTR_PURE;
+const char *StrIndex_chr(const StrIndex *self, const char *pos,
+	const char *end, char c) CMETHOD ATTR_PURE;
+
+#endif
@@ -1,7 +1,12 @@
 #include "util.h"
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+static _Thread_local FILE *diag;
 
 void *xmalloc(size_t size)
 {
@@ -25,3 +30,62 @@ char *copystr(const char *str)
     return res;
 }
 
+char *readfile(FILE *doc, size_t *len)
+{
+    size_t capa = 4096;
+    size_t size = 0;
+    size_t chunk;
+    char *buf = xmalloc(capa);
+    while ((chunk = fread(buf + size, 1, capa - size, doc)))
+    {
+	size += chunk;
+	if (size == capa) buf = xrealloc(buf, capa *= 2);
+    }
+    if (ferror(doc))
+    {
+	fputs("Error reading input\n", diagout());
+	free(buf);
+	return 0;
+    }
+    *len = size;
+    return buf;
+}
+
+char *readfd(int fd, size_t sizehint, size_t *len)
+{
+    size_t capa = sizehint ? sizehint + 1 : 4096;
+    size_t size = 0;
+    ssize_t rd;
+    char *buf = xmalloc(capa);
+    for (;;)
+    {
+	if (size + 1 == capa) buf = xrealloc(buf, capa *= 2);
+	rd = read(fd, buf + size, capa - size - 1);
+	if (rd > 0) size += rd;
+	else if (rd == 0) break;
+	else if (errno != EINTR)
+	{
+	    free(buf);
+	    return 0;
+	}
+    }
+    buf[size] = 0;
+    *len = size;
+    return buf;
+}
+
+FILE *diagout(void)
+{
+    return diag ? diag : stderr;
+}
+
+void setdiagout(FILE *file)
+{
+    diag = file;
+}
+
+void diagerror(const char *name)
+{
+    int err = errno;
+    fprintf(diagout(), "%s: %s\n", name, strerror(err));
+}
@@ -4,9 +4,16 @@
 #include "decl.h"
 
 #include <stddef.h>
+#include <stdio.h>
 
 void *xmalloc(size_t size) ATTR_MALLOC ATTR_ALLOCSZ((1)) ATTR_RETNONNULL;
 void *xrealloc(void *ptr, size_t size) ATTR_ALLOCSZ((2)) ATTR_RETNONNULL;
 char *copystr(const char *str) ATTR_MALLOC;
+char *readfile(FILE *doc, size_t *len) ATTR_MALLOC ATTR_NONNULL((1, 2));
+char *readfd(int fd, size_t sizehint, size_t *len)
+    ATTR_MALLOC ATTR_NONNULL((3));
+FILE *diagout(void) ATTR_RETNONNULL;
+void setdiagout(FILE *file);
+void diagerror(const char *name) ATTR_NONNULL((1));
 
 #endif